@@ -0,0 +1,219 @@
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include "Allocator.h"
+
+//=============================================================================
+// new[]/delete[]
+class HeapAllocator : public Allocator
+{
+public:
+    uchar* Alloc(unsigned len)            {return new uchar[len];}
+    void   Free(uchar* buf, unsigned)     {delete [] buf;}
+};
+
+Allocator* Allocator::Heap()
+{
+    static HeapAllocator heap;
+    return &heap;
+}
+
+//=============================================================================
+PoolAllocator::PoolAllocator()
+{
+    for(unsigned k=0; k<CLASSCNT; k++)
+	list[k] = 0;
+    for(unsigned t=0; t<MAXTHREADS; t++)
+	memset(cache[t].cnt, 0, sizeof(cache[t].cnt));
+}
+
+// Free every buffer in the pool -- buffers still out are the caller's
+PoolAllocator::~PoolAllocator()
+{
+    for(unsigned t=0; t<MAXTHREADS; t++)
+	for(unsigned k=0; k<CLASSCNT; k++)
+	    for(unsigned i=0; i<cache[t].cnt[k]; i++)
+		delete [] (uchar*)cache[t].blk[k][i];
+    for(unsigned k=0; k<CLASSCNT; k++)
+	while(list[k])
+	{
+	    Block* b = list[k];
+	    list[k]  = b->nxt;
+	    delete [] (uchar*)b;
+	}
+}
+
+// Size class of a len byte buffer (CLASSCNT if too big for one)
+unsigned PoolAllocator::sizeClass(unsigned len)
+{
+    unsigned k = 0;
+    while(k < CLASSCNT && (1u<<(k+MINSHIFT)) < len)
+	k++;
+    return k;
+}
+
+// Threads take the lowest free cache slot when they first allocate and
+//   give it back when they exit, so a program that starts thread after
+//   thread doesn't run out of them. The buffers a slot has cached go to
+//   the next thread to take it
+static_assert(PoolAllocator::MAXTHREADS <= 64, "slots are bits of a word");
+static std::atomic<uint64_t> slotsUsed(0);
+
+unsigned PoolAllocator::threadSlot()
+{
+    struct Slot
+    {
+	unsigned k;
+	Slot()
+	{
+	    const uint64_t all = (MAXTHREADS == 64 ? ~0ull :
+				  (1ull << MAXTHREADS)-1);
+	    uint64_t u = slotsUsed.load();
+	    do
+	    {
+		if((u & all) == all) {k = MAXTHREADS; return;}
+		k = __builtin_ctzll(~u);
+	    } while(!slotsUsed.compare_exchange_weak(u, u | (1ull << k)));
+	}
+	~Slot() {if(k < MAXTHREADS) slotsUsed.fetch_and(~(1ull << k));}
+    };
+    static thread_local Slot slot;
+    return slot.k;
+}
+
+// Move the top n buffers of class k from a cache to the shared list
+void PoolAllocator::spill(Cache& c, unsigned k, unsigned n)
+{
+    std::lock_guard<std::mutex> g(lock);
+    for(; n && c.cnt[k]; n--)
+    {
+	Block* b = c.blk[k][--c.cnt[k]];
+	b->nxt   = list[k];
+	list[k]  = b;
+    }
+}
+
+// Move up to n buffers of class k from the shared list to a cache
+void PoolAllocator::refill(Cache& c, unsigned k, unsigned n)
+{
+    std::lock_guard<std::mutex> g(lock);
+    for(; n && list[k] && c.cnt[k] < CACHELEN; n--)
+    {
+	c.blk[k][c.cnt[k]++] = list[k];
+	list[k] = list[k]->nxt;
+    }
+}
+
+uchar* PoolAllocator::Alloc(unsigned len)
+{
+    unsigned k = sizeClass(len);
+    if(k == CLASSCNT) return new uchar[len];
+
+    unsigned t = threadSlot();
+    if(t == MAXTHREADS)
+    {
+	// No cache -- straight to the shared list
+	std::lock_guard<std::mutex> g(lock);
+	if(list[k])
+	{
+	    Block* b = list[k];
+	    list[k]  = b->nxt;
+	    return (uchar*)b;
+	}
+    }
+    else
+    {
+	Cache& c = cache[t];
+	if(c.cnt[k] == 0) refill(c, k, CACHELEN/2);
+	if(c.cnt[k])      return (uchar*)c.blk[k][--c.cnt[k]];
+    }
+    return new uchar[1u<<(k+MINSHIFT)];
+}
+
+void PoolAllocator::Free(uchar* buf, unsigned len)
+{
+    if(!buf) return;
+    unsigned k = sizeClass(len);
+    if(k == CLASSCNT) {delete [] buf; return;}
+
+    unsigned t = threadSlot();
+    if(t == MAXTHREADS)
+    {
+	std::lock_guard<std::mutex> g(lock);
+	((Block*)buf)->nxt = list[k];
+	list[k] = (Block*)buf;
+	return;
+    }
+    Cache& c = cache[t];
+    if(c.cnt[k] == CACHELEN) spill(c, k, CACHELEN/2);
+    c.blk[k][c.cnt[k]++] = (Block*)buf;
+}
+
+//=============================================================================
+ArenaAllocator::ArenaAllocator(unsigned cl)
+{
+    assert(cl > 0);
+    chunkLen = cl;
+    chunks   = 0;
+    used     = 0;
+    total    = 0;
+}
+
+ArenaAllocator::~ArenaAllocator()
+{
+    Release();
+}
+
+// Bump allocate out of the newest chunk (8 byte aligned). Buffers too big
+//   to share a chunk get one of their own behind the newest
+uchar* ArenaAllocator::Alloc(unsigned len)
+{
+    unsigned n = (len+7) & ~7u;
+    total += len;
+    if(n > chunkLen/4)
+    {
+	Chunk* c = (Chunk*)new uchar[sizeof(Chunk)+n];
+	c->len = n;
+	if(chunks)
+	{
+	    c->nxt      = chunks->nxt;
+	    chunks->nxt = c;
+	}
+	else
+	{
+	    c->nxt = 0;
+	    chunks = c;
+	    used   = n;
+	}
+	return c->Data();
+    }
+    if(!chunks || used+n > chunks->len)
+    {
+	Chunk* c = (Chunk*)new uchar[sizeof(Chunk)+chunkLen];
+	c->len = chunkLen;
+	c->nxt = chunks;
+	chunks = c;
+	used   = 0;
+    }
+    uchar* buf = chunks->Data()+used;
+    used += n;
+    return buf;
+}
+
+void ArenaAllocator::Free(uchar*, unsigned) {}
+
+// Free every chunk
+void ArenaAllocator::Release()
+{
+    while(chunks)
+    {
+	Chunk* c = chunks;
+	chunks   = c->nxt;
+	delete [] (uchar*)c;
+    }
+    used  = 0;
+    total = 0;
+}
+
+unsigned long ArenaAllocator::Allocated() const {return total;}
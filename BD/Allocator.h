@@ -0,0 +1,111 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <mutex>
+#include "syntactic_sugar.h"
+
+// An Allocator hands out the buffers that BitDevices and BitDeviceMachines
+//   keep their tapes in. A buffer goes back to the allocator it came from,
+//   with the length it was asked for
+class Allocator
+{
+public:
+    virtual ~Allocator() {}
+    virtual uchar* Alloc(unsigned len) = 0;
+    virtual void   Free(uchar* buf, unsigned len) = 0;
+
+    // new[]/delete[] -- what everything uses unless told otherwise
+    static Allocator* Heap();
+};
+
+// A PoolAllocator keeps freed buffers on a free list per size class
+//   (powers of two from MINSHIFT to MAXSHIFT) and hands them out again.
+//   Each thread has its own cache of a few buffers per class, so a thread
+//   that makes and drops machines in a loop never takes the lock. Caches
+//   spill to and refill from the shared lists a batch at a time
+//
+// Buffers larger than the biggest class come from (and go back to) the heap
+class PoolAllocator : public Allocator
+{
+public:
+    enum { MINSHIFT = 6, MAXSHIFT = 16, CLASSCNT = MAXSHIFT-MINSHIFT+1,
+	   CACHELEN = 32, MAXTHREADS = 64 };
+
+private:
+    // A free buffer holds the link to the next one
+    struct Block { Block* nxt; };
+
+    // Per thread cache -- each on its own cache line
+    struct Cache
+    {
+	alignas(64) unsigned cnt[CLASSCNT];
+	Block*               blk[CLASSCNT][CACHELEN];
+    };
+
+    // Private data members
+    std::mutex    lock;
+    Block*        list[CLASSCNT];  // Shared free lists
+    Cache         cache[MAXTHREADS];
+
+    // Size class of a len byte buffer (CLASSCNT if too big for one)
+    static unsigned sizeClass(unsigned len);
+
+    // Index of the calling thread's cache (MAXTHREADS if it has none) --
+    //   held until the thread exits
+    static unsigned threadSlot();
+
+    // Move n buffers of class k between a cache and the shared list
+    void spill(Cache& c, unsigned k, unsigned n);
+    void refill(Cache& c, unsigned k, unsigned n);
+
+    // Not copyable
+    PoolAllocator(const PoolAllocator&);
+    PoolAllocator& operator=(const PoolAllocator&);
+
+public:
+    PoolAllocator();
+    ~PoolAllocator();  // Frees every buffer in the pool
+
+    uchar* Alloc(unsigned len);
+    void   Free(uchar* buf, unsigned len);
+};
+
+// An ArenaAllocator carves buffers out of large chunks and never frees
+//   them one at a time: Release frees every buffer at once at the end of
+//   a unit of work. Not thread safe -- use one arena per thread
+class ArenaAllocator : public Allocator
+{
+private:
+    // A chunk, followed by its bytes
+    struct Chunk
+    {
+	Chunk*   nxt;
+	unsigned len;
+	uchar* Data() {return (uchar*)(this+1);}
+    };
+
+    // Private data members
+    unsigned chunkLen; // Bytes in a chunk
+    Chunk*   chunks;   // Chunks in use, newest first
+    unsigned used;     // Bytes used in the newest chunk
+    unsigned long total;
+
+    // Not copyable
+    ArenaAllocator(const ArenaAllocator&);
+    ArenaAllocator& operator=(const ArenaAllocator&);
+
+public:
+    ArenaAllocator(unsigned chunkLen = 1<<20);
+    ~ArenaAllocator();
+
+    uchar* Alloc(unsigned len);
+    void   Free(uchar* buf, unsigned len);  // Does nothing
+
+    // Free every buffer handed out since the last Release
+    void Release();
+
+    // Bytes handed out since the last Release
+    unsigned long Allocated() const;
+};
+
+#endif
@@ -1,12 +1,21 @@
 #include <iostream>
 #include <fstream>
 #include <assert.h>
-#include "BDTests.h"
+#include <string.h>
+#include <signal.h>
 #include "BitDeviceMachine.h"
+#include "DeciderPipeline.h"
+#include "History.h"
+#include "Breakpoints.h"
+#include "ResultsDB.h"
+#include "Sampler.h"
+#include "Farm.h"
+#include "BDTests.h"
 
 void UsageMessage()
 {
-    std::cout<< "usage: BDM -i <fname1>|-Add1|-Sub1|-PAL|-BB3 [-o <fname2>] [-h][-s][-q]";
+    std::cout<< "usage: BDM -i <fname1>|-Add1|-Sub1|-PAL|-BB3|-PAL2|-Add2 [-o <fname2>] [-h][-s][-q]";
+    std::cout<< "[-p [-w <d,c,a,s>][-db <file>]][-min][-b][-sparse][-width <w>][-map|-live][-steps <n>][-sample <n,s,b,seed> [-farm <w,dir[,u-v]>|-merge <dir[,u-v]>]][-k <log>][-resume <log>]";
     std::cout << std::endl; 
     std::cout << "   h    : print this help message"     << std::endl;
     std::cout << "   i    : set filename for input"      << std::endl;
@@ -16,20 +25,103 @@ void UsageMessage()
     std::cout << "   BB3  : make a 3-state busy beaver"  << std::endl;
     std::cout << "   BB4  : make a 4-state busy beaver"  << std::endl;
     std::cout << "   PAL  : make a palindrom detector"   << std::endl;
+    std::cout << "   PAL2 : make a two-tape palindrome detector" << std::endl;
+    std::cout << "   Add2 : make a two-tape binary adder" << std::endl;
     std::cout << "   n    : no execution"                << std::endl;
-    std::cout << "   s    : execute a single step"       << std::endl;
+    std::cout << "   s    : execute a single step, then step from stdin:" << std::endl;
+    std::cout << "          s [n] forward, b [n] back, g <n> go to step n, c continue,"
+	      << std::endl;
+    std::cout << "          break state|trans|step|head, watch cell|reg, delete, info, q"
+	      << std::endl;
     std::cout << "   q    : execute without output"      << std::endl;
+    std::cout << "   p    : classify with decider pipeline" << std::endl;
+    std::cout << "   w    : pipeline workers per stage"     << std::endl;
+    std::cout << "   db   : results file the pipeline looks in and adds to" << std::endl;
+    std::cout << "   min  : minimize the state table before running" << std::endl;
+    std::cout << "   b    : share the bootstrap between machines" << std::endl;
+    std::cout << "   sparse : allocate the tape (or the samples') a page at a time"
+	      << std::endl;
+    std::cout << "            as it's written" << std::endl;
+    std::cout << "   width : lay the tape out with 1, 2, 4 or 8-bit symbols"
+	      << std::endl;
+    std::cout << "           (1 only for a machine without 0s)" << std::endl;
+    std::cout << "   map  : run the input file in place (the file is left as it was)"
+	      << std::endl;
+    std::cout << "   live : run the input file in place, writing through to it"
+	      << std::endl;
+    std::cout << "          (synced at the end and on SIGUSR1/SIGTERM)" << std::endl;
+    std::cout << "   steps : stop a run after n steps (10000 by default, 0 for no limit)"
+	      << std::endl;
+    std::cout << "   k    : log for snapshots (BDM.ckpt, or the resumed one)" << std::endl;
+    std::cout << "   resume : continue from the last snapshot in a log" << std::endl;
+    std::cout << "   sample : run n random s-state machines for up to b steps"
+	      << std::endl;
+    std::cout << "            (default 1000000,4,1000,0) on every core and report;"
+	      << std::endl;
+    std::cout << "            o writes the one that ran longest before halting"
+	      << std::endl;
+    std::cout << "   farm : run the samples in units of " << Farm::UNIT
+	      << " by w worker processes," << std::endl;
+    std::cout << "          a shard file per unit in dir (units u to v only if given)"
+	      << std::endl;
+    std::cout << "   merge: add up the shards in dir (units u to v only if given)"
+	      << std::endl;
+    std::cout << "   (SIGUSR1 snapshots to the log, SIGTERM snapshots and stops)"
+	      << std::endl;
+}
+
+// Set by the signal handlers and polled between steps: pending asks for
+//   a snapshot, and stop for the run to end after it
+static volatile sig_atomic_t pending = 0;
+static volatile sig_atomic_t stop    = 0;
+
+static void onSignal(int sig)
+{
+    if(sig == SIGTERM) stop = 1;
+    pending = 1;
+}
+
+static void installHandlers()
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
 }
 
 class CMDOPTIONS
 {
 public:
-    enum mtype {Add1, Sub1, BB3, BB4, PAL};
+    enum mtype {Add1, Sub1, BB3, BB4, PAL, PAL2, Add2};
     char* inname;
     char* outname;
+    char* ckptname;
+    char* resumename;
+    char* dbname;
     bool  singleStep;
     bool  silent;
     bool  noExec;
+    bool  pipeline;
+    bool  shareBoot;
+    bool  minimize;
+    bool  sparse;
+    unsigned      width;      // Bits a symbol
+    bool          mapIn;      // Run the input file mapped
+    bool          live;       //   shared, writing through to it
+    unsigned long stepLimit;  // Steps a run stops at (0 for none)
+    unsigned long samples;    // Random machines to run (0 for none)
+    unsigned      sampleStates;
+    unsigned long sampleSteps;
+    unsigned long sampleSeed;
+    char*         farmDir;    // Shards of a farmed -sample run
+    unsigned      farmWorkers;
+    bool          mergeOnly;  //   just added up
+    unsigned long unitFirst;
+    unsigned long unitLast;
+    unsigned workers[DeciderPipeline::STAGECNT];
     mtype type;
 
     CMDOPTIONS(int argc, char* argv[]);
@@ -40,10 +132,32 @@ CMDOPTIONS::CMDOPTIONS(int argc, char* argv[])
     // Initialize options
     inname     = 0;
     outname    = 0;
+    ckptname   = 0;
+    resumename = 0;
+    dbname     = 0;
     singleStep = false;
     silent     = false;
     noExec     = false;
+    pipeline   = false;
+    shareBoot  = false;
+    minimize   = false;
+    sparse     = false;
+    width        = 2;
+    mapIn        = false;
+    live         = false;
+    stepLimit    = 10000;
+    samples      = 0;
+    sampleStates = 4;
+    sampleSteps  = 1000;
+    sampleSeed   = 0;
+    farmDir      = 0;
+    farmWorkers  = 0;
+    mergeOnly    = false;
+    unitFirst    = 0;
+    unitLast     = ~0ul;
     type       = Sub1;
+    for(int s=0; s<DeciderPipeline::STAGECNT; s++)
+	workers[s] = 1;
     
     // Process first required argument
     int i = 1;
@@ -51,16 +165,22 @@ CMDOPTIONS::CMDOPTIONS(int argc, char* argv[])
     {
 	if(!strcmp(argv[i], "-i"))
 	{
-	    if(argc>2)
+	    if(i+1 < argc)
 		inname = argv[++i];
-	    std::ifstream f(inname, std::ifstream::in | std::ifstream::binary);
-	    if(!f) inname = 0;
+	    if(!inname)
+	    {
+		std::cout << "Valid filename must follow -i" << std::endl;
+		exit (0);
+	    }
+	    i++;
 	}
 	else if(!strcmp(argv[i], "-Add1")){type = Add1; i++;}
 	else if(!strcmp(argv[i], "-Sub1")){type = Sub1; i++;}
 	else if(!strcmp(argv[i], "-BB3")) {type = BB3;  i++;}
 	else if(!strcmp(argv[i], "-BB4")) {type = BB4;  i++;}
 	else if(!strcmp(argv[i], "-PAL")) {type = PAL;  i++;} 
+	else if(!strcmp(argv[i], "-PAL2")){type = PAL2; i++;}
+	else if(!strcmp(argv[i], "-Add2")){type = Add2; i++;}
     }
     // Look through the rest of the arguments...
     for(; i < argc; i++)
@@ -80,6 +200,122 @@ CMDOPTIONS::CMDOPTIONS(int argc, char* argv[])
 	    silent = true;
 	else if(!strcmp(argv[i], "-n")) // No Execution (overrides s)
 	    noExec = true;
+	else if(!strcmp(argv[i], "-p")) // Classify with decider pipeline
+	    pipeline = true;
+	else if(!strcmp(argv[i], "-b")) // Share the bootstrap
+	    shareBoot = true;
+	else if(!strcmp(argv[i], "-min")) // Minimize the state table
+	    minimize = true;
+	else if(!strcmp(argv[i], "-sparse")) // Sparse tape
+	    sparse = true;
+	else if(!strcmp(argv[i], "-map")) // Map the input file
+	    mapIn = true;
+	else if(!strcmp(argv[i], "-live")) // Map it shared
+	    mapIn = live = true;
+	else if(!strcmp(argv[i], "-steps")) // Step limit
+	{
+	    char* e = 0;
+	    if(i+1 < argc) stepLimit = strtoul(argv[++i], &e, 10);
+	    if(!e || *e)
+	    {
+		std::cout << "-steps needs a count (0 for no limit)" << std::endl;
+		exit (0);
+	    }
+	}
+	else if(!strcmp(argv[i], "-width")) // Symbol width
+	{
+	    char*         e = 0;
+	    unsigned long w = (i+1 < argc ? strtoul(argv[++i], &e, 10) : 0);
+	    if(!e || *e || (w != 1 && w != 2 && w != 4 && w != 8))
+	    {
+		std::cout << "-width must be 1, 2, 4 or 8" << std::endl;
+		exit (0);
+	    }
+	    width = w;
+	}
+	else if(!strcmp(argv[i], "-k") || !strcmp(argv[i], "-resume"))
+	{
+	    // Checkpoint log -- to write, or to resume from and carry on
+	    bool  resume = !strcmp(argv[i], "-resume");
+	    char* name   = (i+1 < argc ? argv[++i] : 0);
+	    if(!name)
+	    {
+		std::cout << "Valid filename must follow " << argv[i]
+			  << std::endl;
+		exit (0);
+	    }
+	    if(resume) resumename = name;
+	    else       ckptname   = name;
+	}
+	else if(!strcmp(argv[i], "-db")) // Results file for the pipeline
+	{
+	    if(i+1 < argc) dbname = argv[++i];
+	    if(!dbname)
+	    {
+		std::cout << "Valid filename must follow -db" << std::endl;
+		exit (0);
+	    }
+	}
+	else if(!strcmp(argv[i], "-sample")) // Random machines
+	{
+	    char* a = (i+1 < argc && argv[i+1][0] != '-' ? argv[++i] : 0);
+	    samples = 1000000;
+	    unsigned long* f[] = {&samples, 0, &sampleSteps, &sampleSeed};
+	    for(int k=0; a && *a && k<4; k++)
+	    {
+		unsigned long v = strtoul(a, &a, 10);
+		if(k == 1) sampleStates = v;
+		else       *f[k]        = v;
+		if(*a == ',') a++;
+	    }
+	    if(samples == 0 || sampleStates == 0 || sampleSteps == 0)
+	    {
+		std::cout << "-sample needs counts above 0" << std::endl;
+		exit (0);
+	    }
+	}
+	else if(!strcmp(argv[i], "-farm") || !strcmp(argv[i], "-merge"))
+	{
+	    // [workers,]dir[,first-last]
+	    mergeOnly = !strcmp(argv[i], "-merge");
+	    char* a   = (i+1 < argc ? argv[++i] : 0);
+	    if(a && !mergeOnly)
+	    {
+		farmWorkers = strtoul(a, &a, 10);
+		if(*a == ',') a++;
+	    }
+	    farmDir = (a && *a ? a : 0);
+	    char* r = (farmDir ? strchr(farmDir, ',') : 0);
+	    if(r)
+	    {
+		*r++      = 0;
+		unitFirst = strtoul(r, &r, 10);
+		unitLast  = (*r == '-' ? strtoul(r+1, &r, 10) : unitFirst);
+	    }
+	    if(!farmDir || (!mergeOnly && farmWorkers == 0) ||
+	       unitFirst > unitLast)
+	    {
+		std::cout << "-farm needs workers and a directory, -merge a directory"
+			  << std::endl;
+		exit (0);
+	    }
+	}
+	else if(!strcmp(argv[i], "-w")) // Workers per pipeline stage
+	{
+	    char* w = (i+1 < argc ? argv[++i] : 0);
+	    for(int s=0; w && s<DeciderPipeline::STAGECNT; s++)
+	    {
+		workers[s] = strtoul(w, &w, 10);
+		if(*w == ',') w++;
+	    }
+	    for(int s=0; s<DeciderPipeline::STAGECNT; s++)
+		if(!w || workers[s] == 0)
+		{
+		    std::cout << "-w needs a worker count for each stage"
+			      << std::endl;
+		    exit (0);
+		}
+	}
 	else if(!strcmp(argv[i], "-h")) // Help
 	{
 	    UsageMessage();
@@ -92,7 +328,126 @@ CMDOPTIONS::CMDOPTIONS(int argc, char* argv[])
 	    exit(0);
 	}
     }
-    
+
+    if(mapIn && !inname)
+    {
+	std::cout << "-map and -live need an input file" << std::endl;
+	exit (0);
+    }
+
+    // Snapshots of a resumed run go on the log it resumed from
+    if(!ckptname) ckptname = (resumename ? resumename : (char*)"BDM.ckpt");
+}
+
+// Take a step, then more as standard input asks, till it ends:
+//
+//     s [n]                 : n steps forward (1 by default)
+//     b [n]                 : n steps back (replays from a snapshot if
+//                             the undo log doesn't reach)
+//     g <n>                 : go to step n
+//     c                     : continue till a breakpoint holds or halt
+//     break state <s>       : stop at state s
+//     break trans <s> <x>   : stop at state s reading x
+//     break step <n>        : stop after n steps
+//     break head <pos> [t]  : stop with the head of tape t at pos
+//     watch cell <pos> [t]  : stop when the symbol at pos changes
+//     watch reg <r>         : stop when register r changes
+//     delete <i>|all        : delete breakpoint i or all of them
+//     info                  : list the breakpoints
+//     q                     : quit
+//
+//   Returns the machine as of the last step
+static BitDeviceMachine* stepSession(History &h, bool silent)
+{
+    Breakpoints bp;
+    h.Forward();
+    if(!silent) h.Machine()->Print(h.Steps());
+
+    char line[256];
+    while(fgets(line, sizeof(line), stdin))
+    {
+	// A command word, maybe a second word, and up to two numbers
+	char*         tok[4] = {0, 0, 0, 0};
+	unsigned long num[2] = {0, 0};
+	unsigned      nums   = 0;
+	char*         w      = strtok(line, " \t\n");
+	for(int k=0; w && k<4; k++, w=strtok(0, " \t\n"))
+	{
+	    tok[k] = w;
+	    char* e;
+	    unsigned long v = strtoul(w, &e, 10);
+	    if(*e == 0 && nums < 2) num[nums++] = v;
+	}
+	const char* cmd  = (tok[0] ? tok[0] : "s");
+	const char* what = (tok[1] ? tok[1] : "");
+	unsigned long n  = (nums ? num[0] : 1);
+
+	if(!strcmp(cmd, "s"))
+	    for(unsigned long i=0; i<n && h.Forward(); i++);
+	else if(!strcmp(cmd, "b"))
+	    h.StepBack(n);
+	else if(!strcmp(cmd, "g") && nums)
+	    h.SeekTo(num[0]);
+	else if(!strcmp(cmd, "c"))
+	{
+	    bool hit = h.Continue(bp);
+	    std::cout << (hit ? "Breakpoint " : "Halted") << std::flush;
+	    if(hit) bp.Print(stdout, bp.Last());
+	    else    std::cout << std::endl;
+	}
+	else if(!strcmp(cmd, "break") && nums)
+	{
+	    if(!strcmp(what, "state"))
+		bp.BreakState(num[0]);
+	    else if(!strcmp(what, "trans") && nums == 2)
+		bp.BreakTransition(num[0], num[1]);
+	    else if(!strcmp(what, "step"))
+		bp.BreakStep(num[0]);
+	    else if(!strcmp(what, "head"))
+		bp.BreakHead(num[0], nums == 2 ? num[1] : 0);
+	    else
+		std::cout << "break state|trans|step|head ..." << std::endl;
+	    continue;
+	}
+	else if(!strcmp(cmd, "watch") && nums)
+	{
+	    if(!strcmp(what, "cell"))
+		bp.WatchCell(num[0], nums == 2 ? num[1] : 0);
+	    else if(!strcmp(what, "reg") && num[0] < MAXREGS)
+		bp.WatchReg(num[0]);
+	    else
+		std::cout << "watch cell|reg ..." << std::endl;
+	    continue;
+	}
+	else if(!strcmp(cmd, "delete"))
+	{
+	    if(!strcmp(what, "all"))     bp.Clear();
+	    else if(!nums || !bp.Delete(num[0]))
+		std::cout << "No such breakpoint" << std::endl;
+	    continue;
+	}
+	else if(!strcmp(cmd, "info"))
+	{
+	    bp.Print(stdout);
+	    continue;
+	}
+	else if(!strcmp(cmd, "q"))
+	    return h.Machine();
+	else
+	{
+	    std::cout << "s [n], b [n], g <n>, c, break, watch, delete, info or q"
+		      << std::endl;
+	    continue;
+	}
+
+	// Leave the lines the print rewinds over below the command
+	if(!silent)
+	{
+	    std::cout << "\n\n\n";
+	    h.Machine()->Print(h.Steps());
+	}
+    }
+    return h.Machine();
 }
 
 int main(int argc, char* argv[])
@@ -103,12 +458,73 @@ int main(int argc, char* argv[])
     // Look through the arguments...
     CMDOPTIONS opt(argc, argv);
 
+    // Random machines rather than the one
+    if(opt.samples)
+    {
+	Sampler sm(opt.sampleStates, opt.sampleSteps, opt.sampleSeed);
+	sm.SparseTape(opt.sparse);
+
+	// In worker processes, shard by shard
+	if(opt.farmDir)
+	{
+	    Farm fm(sm, opt.samples, opt.farmDir);
+	    if(!opt.mergeOnly) fm.SetWorkers(opt.farmWorkers);
+	    fm.SetUnits(opt.unitFirst, opt.unitLast);
+	    bool ok = (opt.mergeOnly || fm.Run());
+	    fm.Report(stdout);
+	    Sampler::Stats st;
+	    if(opt.outname && !fm.Merge(st) && st.halted)
+	    {
+		BitDeviceMachine m;
+		sm.Make(m, st.maxTimeAt);
+		m.WriteFile(opt.outname);
+	    }
+	    return (ok ? 0 : 1);
+	}
+
+	unsigned n = std::thread::hardware_concurrency();
+	sm.SetThreads(n ? n : 1);
+	sm.Run(opt.samples);
+	sm.Report(stdout);
+	if(opt.outname && sm.Totals().halted)
+	{
+	    BitDeviceMachine m;
+	    sm.Make(m, sm.Totals().maxTimeAt);
+	    m.WriteFile(opt.outname);
+	}
+	return 0;
+    }
+
     // Make a BitDeviceMachine
     BitDeviceMachine BDM;
+    BDM.ShareBootstrap(opt.shareBoot);
+    BDM.SparseTape(opt.sparse);
+    BDM.SymbolWidth(opt.width);
+    BDM.MapFiles(opt.mapIn, opt.live);
+    BDM.SetStepLimit(opt.stepLimit);
 
-    // Input file or Init to requested type
-    if(opt.inname)
-	BDM.ReadFile(opt.inname);
+    // Snapshot, input file or Init to requested type
+    unsigned long steps = 0;
+    if(opt.resumename)
+    {
+	if(!BDM.Restore(opt.resumename, steps))
+	{
+	    std::cout << "No snapshot to resume in " << opt.resumename
+		      << std::endl;
+	    return 1;
+	}
+	if(!opt.silent)
+	    std::cout << "Resuming after " << steps << " steps" << std::endl;
+    }
+    else if(opt.inname)
+    {
+	if(!BDM.ReadFile(opt.inname))
+	{
+	    std::cout << "Can't read a machine from " << opt.inname
+		      << std::endl;
+	    return 1;
+	}
+    }
     else
     {
 	switch(opt.type)
@@ -118,17 +534,101 @@ int main(int argc, char* argv[])
 	case CMDOPTIONS::BB3: {BDM.InitToBB3();  break;}
 	case CMDOPTIONS::BB4: {BDM.InitToBB4();  break;}
 	case CMDOPTIONS::PAL: {BDM.InitToPAL();  break;}
+	case CMDOPTIONS::PAL2:{BDM.InitTo2PAL(); break;}
+	case CMDOPTIONS::Add2:{BDM.InitTo2Add(); break;}
 	default:  {assert("Invalid machine type");}
 	}
+	if(BDM.Width() != opt.width && !opt.silent)
+	    std::cout << "This machine uses 0s: its tape is "
+		      << BDM.Width() << " bits wide" << std::endl;
     }
 	
+    // Drop the states it can't reach and merge those that act alike,
+    //   printing where each state went (- if it was dropped)
+    if(opt.minimize)
+    {
+	unsigned  cnt = BDM.CommandCount();
+	unsigned* map = new unsigned[cnt];
+	unsigned  n   = BDM.Minimize(map);
+	if(!n)
+	    std::cout << "Can't minimize this machine" << std::endl;
+	else if(!opt.silent)
+	{
+	    std::cout << "Minimized to " << n << " states:";
+	    for(unsigned i=0; i<cnt; i++)
+	    {
+		if(map[i] == i) continue;
+		std::cout << " " << i << "->";
+		if(map[i] == ~0u) std::cout << "-";
+		else              std::cout << map[i];
+	    }
+	    std::cout << std::endl;
+	}
+	delete [] map;
+    }
+
+    // Classify the machine with the decider pipeline
+    if(!opt.noExec && opt.pipeline)
+    {
+	DeciderPipeline dp;
+	for(int s=0; s<DeciderPipeline::STAGECNT; s++)
+	    dp.SetWorkers((DeciderPipeline::STAGE)s, opt.workers[s]);
+
+	// Skip the run if the results file has it
+	ResultsDB db;
+	if(opt.dbname)
+	{
+	    if(!db.Open(opt.dbname))
+	    {
+		std::cout << "Can't open results file " << opt.dbname
+			  << std::endl;
+		return 1;
+	    }
+	    dp.SetResults(&db);
+	}
+
+	DeciderPipeline::Job job;
+	job.m  = &BDM;
+	job.id = 0;
+	dp.Start();
+	dp.Submit(&job);
+	dp.Finish();
+
+	std::cout << DeciderPipeline::VerdictName(job.verdict)
+		  << " (" << DeciderPipeline::StageName(job.stage)
+		  << ", " << job.steps << " steps"
+		  << (job.cached ? ", from results file" : "") << ")" << std::endl;
+	if(!opt.silent) dp.Report(stdout);
+    }
     // Execute either a single step or until halt
-    if(!opt.noExec)
+    else if(!opt.noExec)
     {
 	if(opt.singleStep)
-	    BDM.ExecuteS();
+	{
+	    History h(&BDM);
+	    BitDeviceMachine* m = stepSession(h, opt.silent);
+	    if(opt.outname) m->WriteFile(opt.outname);
+	    return 0;
+	}
 	else
-	    BDM.Execute(opt.silent);
+	{
+	    // Snapshot between steps when a signal asks for one (a live
+	    //   file is its own snapshot)
+	    installHandlers();
+	    while(!BDM.Execute(opt.silent, steps, &pending))
+	    {
+		pending = 0;
+		const char* to = (opt.live ? opt.inname : opt.ckptname);
+		if(opt.live ? !BDM.SyncFile() : !BDM.Checkpoint(to, steps))
+		    std::cout << "Can't write snapshot to " << to << std::endl;
+		if(stop)
+		{
+		    std::cout << "Stopped after " << steps << " steps (snapshot in "
+			      << to << ")" << std::endl;
+		    return 0;
+		}
+	    }
+	}
     }
     
     // Write it out if we have a filename
@@ -1,5 +1,1051 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <thread>
+#include "Allocator.h"
+#include "BitDevice.h"
+
+// The checks that need a BitDeviceMachine run only in programs that
+//   include BitDeviceMachine.h (and the rest) ahead of this file
+#ifdef BITDEVICEMACHINE_H
+#include "TapeKernels.h"
+#include "BitPlaneTape.h"
+#include "TransitionTable.h"
+#include "Sampler.h"
+#include "History.h"
+#include "Breakpoints.h"
+#include "ResultsDB.h"
+#include "DeciderPipeline.h"
+#endif
+
+// An Allocator that counts what goes through it on the way to the heap
+class CountingAllocator : public Allocator
+{
+public:
+    unsigned long allocs, frees, bytes;
+    CountingAllocator() {allocs = frees = bytes = 0;}
+    uchar* Alloc(unsigned len) {allocs++; bytes += len; return new uchar[len];}
+    void   Free(uchar* buf, unsigned len)
+    {if(buf) {frees++; bytes -= len;} delete [] buf;}
+};
+
+// An Allocator that hands out buffers full of junk, as the heap may
+class JunkAllocator : public Allocator
+{
+public:
+    uchar* Alloc(unsigned len)
+    {uchar* b = new uchar[len]; memset(b, 0xA5, len); return b;}
+    void   Free(uchar* buf, unsigned) {delete [] buf;}
+};
+
+// A pool hands a freed buffer of a size class straight back out, even to
+//   the next thread when the one that freed it has exited (and given its
+//   cache up), and an arena lets go of everything at once
+void TestAllocators()
+{
+    PoolAllocator pool;
+    uchar* b0 = pool.Alloc(100);
+    memset(b0, 1, 128);
+    pool.Free(b0, 100);
+    assert(pool.Alloc(120) == b0);
+    pool.Free(b0, 120);
+    uchar* big = pool.Alloc(1u << (PoolAllocator::MAXSHIFT+1));
+    pool.Free(big, 1u << (PoolAllocator::MAXSHIFT+1));
+    uchar* got[2*PoolAllocator::MAXTHREADS];
+    for(unsigned t=0; t<2*PoolAllocator::MAXTHREADS; t++)
+    {
+	std::thread th([&pool, &got, t]
+		       {got[t] = pool.Alloc(200); pool.Free(got[t], 200);});
+	th.join();
+	assert(got[t] == got[0]);
+    }
+
+    ArenaAllocator arena(4096);
+    uchar* a0 = arena.Alloc(10);
+    uchar* a1 = arena.Alloc(10);
+    assert(a1 == a0+16);
+    arena.Alloc(8192);
+    assert(arena.Allocated() == 10+10+8192);
+    arena.Release();
+    assert(arena.Allocated() == 0);
+}
+
+// A flat device on buf and a segmented one laid out alike: the first
+//   word points at the registers, which sit in one page, and the bits
+//   after them are in 8-byte pages, so fields and runs cross pages
+static void loadDevices(BitDevice dev[2], uchar* buf, unsigned len)
+{
+    unsigned rb = sizeof(unsigned)+MAXREGS*sizeof(int);
+    memset(buf, 0, len);
+    *(unsigned*)buf = 1;
+    dev[0].LoadTape(buf, len);
+    Segment** s = new Segment*[2];
+    s[0] = new Segment(0, rb, 0, 0);
+    s[1] = new Segment(rb, len-rb, 3, 0);
+    *(unsigned*)s[0]->WriteA(0) = 1;
+    dev[1].LoadSegments(s, 2);
+}
+
+// The w bits at bit p of ref, a bit at a time, and the other way round
+static unsigned refBits(const uchar* ref, unsigned p, unsigned w)
+{
+    unsigned v = 0;
+    for(unsigned i=0; i<w; i++)
+	v |= ((ref[(p+i)/bPB] >> (p+i)%bPB) & 1u) << i;
+    return v;
+}
+static void refPut(uchar* ref, unsigned p, unsigned w, unsigned v)
+{
+    for(unsigned i=0; i<w; i++, v >>= 1)
+	ref[(p+i)/bPB] = (ref[(p+i)/bPB] & ~(1u << (p+i)%bPB))
+	    | (v & 1u) << (p+i)%bPB;
+}
+
+// Fields of any width at any bit read back what was written, flat or
+//   across pages, and leave the bits around them alone
+void TestBitFields()
+{
+    enum { LEN = 512 };
+    uchar     buf[LEN], ref[LEN];
+    BitDevice dev[2];
+    unsigned  seed = 1, lo = bPB*(sizeof(unsigned)+MAXREGS*sizeof(int));
+    loadDevices(dev, buf, LEN);
+    memset(ref, 0, LEN);
+    for(int trial=0; trial<4000; trial++)
+    {
+	unsigned w = 1+rand_r(&seed)%32;
+	unsigned p = lo+rand_r(&seed)%(bPB*LEN-lo-w+1);
+	unsigned v = rand_r(&seed) ^ (unsigned)rand_r(&seed) << 16;
+	refPut(ref, p, w, v);
+	for(int k=0; k<2; k++)
+	    dev[k].WriteBits(p, w, v);
+	w = 1+rand_r(&seed)%32;
+	p = lo+rand_r(&seed)%(bPB*LEN-lo-w+1);
+	for(int k=0; k<2; k++)
+	    assert(dev[k].ReadBits(p, w) == refBits(ref, p, w));
+    }
+    for(unsigned i=lo/bPB; i<LEN; i++)
+	assert(buf[i] == ref[i] && *dev[1].ReadA(i) == ref[i]);
+}
+
+// Block copies that overlap either way round, fills and compares do
+//   what a bit at a time would, on byte boundaries or off them and flat
+//   or across pages
+void TestBlockOps()
+{
+    enum { LEN = 512 };
+    uchar     buf[LEN], ref[LEN], tmp[LEN];
+    BitDevice dev[2];
+    unsigned  seed = 2, lo = bPB*(sizeof(unsigned)+MAXREGS*sizeof(int));
+    loadDevices(dev, buf, LEN);
+    memset(ref, 0, LEN);
+    for(unsigned p=lo; p+32<=bPB*LEN; p+=32)
+    {
+	unsigned v = rand_r(&seed) ^ (unsigned)rand_r(&seed) << 16;
+	refPut(ref, p, 32, v);
+	for(int k=0; k<2; k++)
+	    dev[k].WriteBits(p, 32, v);
+    }
+    for(int trial=0; trial<1000; trial++)
+    {
+	unsigned n   = rand_r(&seed)%400, hi = bPB*LEN-n;
+	unsigned src = lo+rand_r(&seed)%(hi-lo+1);
+	unsigned dst = src+rand_r(&seed)%161;
+	dst = (dst < lo+80 ? lo : dst-80 > hi ? hi : dst-80);
+	if(trial%2) {src -= src%bPB; dst -= dst%bPB;}
+	for(unsigned i=0; i<n; i++)
+	    refPut(tmp, i, 1, refBits(ref, src+i, 1));
+	for(unsigned i=0; i<n; i++)
+	    refPut(ref, dst+i, 1, refBits(tmp, i, 1));
+	unsigned x = rand_r(&seed)%3, at = lo+rand_r(&seed)%(bPB*LEN-lo-1);
+	unsigned cnt = rand_r(&seed)%((bPB*LEN-at)/2+1);
+	for(unsigned i=0; i<cnt; i++)
+	    refPut(ref, at+2*i, 2, x);
+	unsigned a = lo+rand_r(&seed)%(bPB*LEN-lo-n+1), d = n;
+	if(trial%4 == 0) a = dst+(trial%8 ? 0 : bPB);
+	if(a+n > bPB*LEN) a = dst;
+	for(unsigned i=0; i<n && d == n; i++)
+	    if(refBits(ref, a+i, 1) != refBits(ref, dst+i, 1)) d = i;
+	for(int k=0; k<2; k++)
+	{
+	    dev[k].LOAD(src, 0);
+	    dev[k].LOAD(dst, 1);
+	    dev[k].LOAD(n, 2);
+	    dev[k].BCPY(0, 1, 2);
+	    dev[k].LOAD(x, 0);
+	    dev[k].LOAD(at, 1);
+	    dev[k].LOAD(cnt, 2);
+	    dev[k].SFIL(0, 1, 2);
+	    dev[k].LOAD(a, 0);
+	    dev[k].LOAD(dst, 1);
+	    dev[k].LOAD(n, 2);
+	    dev[k].BCMP(0, 1, 2);
+	    assert(dev[k].GetRegisters()[2] == (int)d);
+	    for(unsigned i=lo/bPB; i<LEN; i++)
+		assert(*dev[k].ReadA(i) == ref[i]);
+	}
+    }
+}
+
+#ifdef BITDEVICEMACHINE_H
+// A machine's tape comes from and goes back to the allocator it was
+//   given, and samples run on an arena come out as on the heap
+void TestMachineAllocators()
+{
+    CountingAllocator ca;
+    {
+	BitDeviceMachine m;
+	m.SetAllocator(&ca);
+	m.InitToBB3();
+	m.InitToAdd1();
+	assert(ca.allocs == 2 && ca.frees == 1);
+    }
+    assert(ca.allocs == ca.frees && ca.bytes == 0);
+
+    ArenaAllocator arena;
+    Sampler heap(2, 50, 7), onArena(2, 50, 7);
+    onArena.SetAllocator(&arena);
+    heap.Run(64);
+    onArena.Run(64);
+    assert(arena.Allocated() > 0);
+    assert(!memcmp(&heap.Totals(), &onArena.Totals(), sizeof(Sampler::Stats)));
+}
+
+// Samples passed over count as skipped and leave the rest as they'd be
+//   run around them, and a thread says it's on no sample once it's done
+void TestSamplerSkip()
+{
+    Sampler        a(2, 50, 7), b(2, 50, 7);
+    Sampler::Stats st;
+    unsigned long  skip[2]    = {5, 9};
+    unsigned long  from[3]    = {0, 6, 10}, count[3] = {5, 3, 54};
+    std::atomic<unsigned long> at[1];
+    at[0] = 0;
+    b.SetSkip(skip, 2);
+    b.SetProgress(at);
+    b.Run(64);
+    st.Clear();
+    for(int k=0; k<3; k++)
+    {
+	a.Run(count[k], from[k]);
+	st.Merge(a.Totals());
+    }
+    st.skipped = 2;
+    assert(b.Totals().samples == 62 && at[0] == Sampler::NONE);
+    assert(!memcmp(&st, &b.Totals(), sizeof(st)));
+}
+
+// A sparse tape of 16M symbols holds only the pages a machine writes
+//   (and drops them again when it's blanked), and runs as a flat one does
+void TestSparseTape()
+{
+    BitDeviceMachine m[2];
+    TransitionTable  t;
+    for(int k=0; k<2; k++)
+    {
+	m[k].SparseTape(k == 1);
+	unsigned s = m[k].InitToStates(1, 1u << 24);
+	m[k].GetTable(t);
+	t.Set(s, 2, 1, 1, s);
+	m[k].SetTable(t);
+	m[k].ExecuteTable(t, 5000);
+    }
+    assert(m[0].Resident() > (1u << 22));
+    assert(m[1].Resident() < (1u << 14));
+    assert(m[0].FirstDifference(m[1]) == m[0].Tapelen());
+    assert(m[1].GetHead() == (1u << 23)+5000);
+
+    Sampler sm(3, 100, 1), sp(3, 100, 1);
+    sp.SparseTape(true);
+    sm.Run(64);
+    sp.Run(64);
+    assert(!memcmp(&sm.Totals(), &sp.Totals(), sizeof(Sampler::Stats)));
+
+    m[1].FillTape(2);
+    assert(m[1].Resident() < (1u << 12));
+}
+
+// Symbol j of bytes t packed w bits to a symbol, as the kernels read it
+//   (0, 1 or 2 for blank -- or, wider, its value)
+static unsigned symbolAt(const uchar* t, unsigned j, unsigned w)
+{
+    unsigned spb = 8/w, x = (t[j/spb] >> w*(j%spb)) & ((1u<<w)-1);
+    return (w == 1 ? (x ? 1 : 2) : x);
+}
+
+// The kernels find what a symbol at a time does at every width, from
+//   any byte and for any length (words, their tails and neither), and a
+//   tape's last symbol that isn't blank is found from its far end even
+//   when its pages aren't all there
+void TestTapeKernels()
+{
+    Sampler::Rng r(1);
+    uchar        a[96], b[96];
+    unsigned     width[4] = {1, 2, 4, 8};
+    for(int k=0; k<4; k++)
+	for(int trial=0; trial<2000; trial++)
+	{
+	    unsigned w = width[k], spb = 8/w;
+	    unsigned off = r.Below(8), n = r.Below(41);
+	    memset(a, TapeKernels::BlankByte(w), sizeof(a));
+	    for(unsigned i=r.Below(4); i; i--)
+		a[off+r.Below(n+1)] = (uchar)r.Next();
+	    memcpy(b, a, sizeof(a));
+	    if(n && r.Below(2))
+		b[off+r.Below(n)] ^= (uchar)(1u << r.Below(8));
+
+	    unsigned long cnt[3] = {0, 0, 0}, ref[3] = {0, 0, 0};
+	    unsigned      diff = spb*n, last = spb*n;
+	    for(unsigned j=0; j<spb*n; j++)
+	    {
+		unsigned x = symbolAt(a+off, j, w);
+		if(x < 3) ref[x]++;
+		if(diff == spb*n && x != symbolAt(b+off, j, w)) diff = j;
+		if(x != 2) last = j;
+	    }
+	    TapeKernels::Count(a+off, n, cnt, w);
+	    assert(!memcmp(cnt, ref, sizeof(cnt)));
+	    assert(TapeKernels::FirstDiff(a+off, b+off, n, w) == diff);
+	    assert(TapeKernels::LastNonBlank(a+off, n, w) == last);
+	}
+
+    BitDeviceMachine m;
+    unsigned         left, right;
+    m.SparseTape(true);
+    m.Init(1, 1u << 16);
+    m.SetHead(100);
+    m.Write(1);
+    m.SetHead(30000);
+    m.Write(0);
+    assert(m.Extent(left, right) && left == 100 && right == 30000);
+}
+
+// A tape goes into bit planes and back out unchanged, symbol for symbol,
+//   and a Move copies what a symbol at a time would for regions that
+//   overlap either way round and sit anywhere in their words
+void TestBitPlanes()
+{
+    Sampler::Rng     r(3);
+    BitDeviceMachine m;
+    BitPlaneTape     t, u;
+    m.Init(1, 1000);
+    m.GetPlanes(t);
+    for(unsigned i=0; i<t.Len(); i++)
+	t.Set(i, (uchar)r.Below(3));
+    m.SetPlanes(t);
+    for(unsigned i=0; i<t.Len(); i++)
+	assert(m.ReadAt(0, i) == t.Get(i));
+    m.GetPlanes(u);
+    assert(u == t && u.FirstDiff(t) == t.Len());
+
+    uchar ref[1000];
+    for(int trial=0; trial<500; trial++)
+    {
+	unsigned n   = r.Below(300);
+	unsigned src = r.Below(t.Len()-n+1);
+	unsigned lo  = (src > 130 ? src-130 : 0);
+	unsigned hi  = (src+130 < t.Len()-n ? src+130 : t.Len()-n);
+	unsigned dst = lo+r.Below(hi-lo+1);
+	for(unsigned i=0; i<t.Len(); i++)
+	    ref[i] = t.Get(i);
+	memmove(ref+dst, ref+src, n);
+	t.Move(dst, src, n);
+	for(unsigned i=0; i<t.Len(); i++)
+	    assert(t.Get(i) == ref[i]);
+    }
+}
+
+// A table taken from a machine goes back in and comes out again as it
+//   was, its bootstrap and MTState rows (2PAL's are all MTStates) left
+//   as they aren't states, and the machine still runs as before
+void TestTableRoundTrip()
+{
+    void (BitDeviceMachine::*make[2])() = {&BitDeviceMachine::InitToBB3,
+					   &BitDeviceMachine::InitTo2PAL};
+    for(int j=0; j<2; j++)
+    {
+	BitDeviceMachine m, ref;
+	TransitionTable  t, u;
+	(m.*make[j])();
+	(ref.*make[j])();
+	m.GetTable(t);
+	unsigned other = 0;
+	for(unsigned i=0; i<t.Rows(); i++)
+	    other += !t.IsState(i);
+	assert(other > 0 && (j == 1 || other < t.Rows()));
+	m.SetTable(t);
+	m.GetTable(u);
+	assert(u == t);
+
+	unsigned long n = 0, c[3], rc[3];
+	for(; n<1000 && !m.Halted(); n++)
+	{
+	    m.ExecuteS();
+	    ref.ExecuteS();
+	}
+	m.CountSymbols(c);
+	ref.CountSymbols(rc);
+	assert(m.Halted() && ref.Halted() && !memcmp(c, rc, sizeof(c)));
+    }
+}
+
+// BB3, BB4 and Add1 take the same steps and leave the same 0s and 1s on
+//   tapes 1, 2, 4 and 8 bits wide (a narrow tape may round up to more
+//   blanks) -- but Add1 writes 0s, so it won't go on a 1-bit tape
+void TestSymbolWidths()
+{
+    void (BitDeviceMachine::*make[3])() = {&BitDeviceMachine::InitToBB3,
+					   &BitDeviceMachine::InitToBB4,
+					   &BitDeviceMachine::InitToAdd1};
+    unsigned long steps[3], cnt[3][3];
+    unsigned      width[4] = {2, 1, 4, 8};
+    for(int k=0; k<4; k++)
+	for(int j=0; j<3; j++)
+	{
+	    BitDeviceMachine m;
+	    m.SymbolWidth(width[k]);
+	    (m.*make[j])();
+	    assert(m.Width() == (j == 2 && width[k] == 1 ? 2 : width[k]));
+	    unsigned long n = 0, c[3];
+	    for(; n<1000 && !m.Halted(); n++)
+		m.ExecuteT();
+	    m.CountSymbols(c);
+	    assert(m.Halted());
+	    if(k == 0)
+	    {
+		steps[j] = n;
+		memcpy(cnt[j], c, sizeof(c));
+	    }
+	    assert(n == steps[j] && c[0] == cnt[j][0] && c[1] == cnt[j][1]);
+	    assert(c[0]+c[1]+c[2] == m.Tapelen());
+	}
+    assert(steps[1] == 107 && cnt[1][1] == 13 && cnt[2][0] == 1);
+}
+
+// BB3 as the first version of BDM wrote it (BDM -BB3 -n -o): a bare
+//   tape with 50 registers and the head counting the tape's header in
+//   bytes
+static const char* legacyBB3[] = {
+    "bb000000e0140000080000000000000000000000000000004000000001000000",
+    "0000000000000000000000008001000001000000200000000100000000000000",
+    "2002000002000000000000000200000000000000c00200000100000032000000",
+    "0400000000000000600300000500000002000000040000000500000000040000",
+    "04000000050000000100000006000000a0040000050000000100000006000000",
+    "070000004005000002000000070000000800000000000000e005000005000000",
+    "0600000008000000090000008006000003000000090000000a00000000000000",
+    "2007000001000000020000000b00000000000000c0070000040000000b000000",
+    "0a0000000c00000060080000050000001d0000000c0000001a00000000090000",
+    "050000001a000000010000000d000000a0090000030000000d00000018000000",
+    "00000000400a000001000000080000000e00000000000000e00a000005000000",
+    "0d0000000e0000000f000000800b0000030000000f0000001300000000000000",
+    "200c000001000000ffffffff1400000000000000c00c00000500000013000000",
+    "1400000015000000600d0000040000000b0000001500000016000000000e0000",
+    "05000000080000001600000017000000a00e000005000000010000001d000000",
+    "10000000400f000005000000010000001000000010000000e00f000004000000",
+    "010000000a000000110000008010000005000000100000001100000012000000",
+    "2011000002000000120000001900000000000000c01100000100000080000000",
+    "1b00000000000000601200000700000018000000090000000000000000130000",
+    "06000000170000000700000000000000a0130000090000001900000001000000",
+    "0000000040000000d304000024150000400000004000000040000000d3040000",
+    "16050000e01400004000000080150000d304000026010000e014000080150000",
+    "20160000d304000016290000e0140000e0140000201600000000000000000000",
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "0000000000000000000000000000000000000000070000001c000000aaaaaaaa",
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+};
+
+// The legacy file reads (and maps) as the BB3 made now, and runs through
+//   the bootstrap to the same end
+void TestLegacyFile()
+{
+    uchar    buf[1024];
+    unsigned len = 0;
+    for(unsigned i=0; i<sizeof(legacyBB3)/sizeof(legacyBB3[0]); i++)
+	for(const char* x=legacyBB3[i]; *x; x+=2)
+	{
+	    char hex[3] = {x[0], x[1], 0};
+	    buf[len++] = (uchar)strtoul(hex, 0, 16);
+	}
+    char name[] = "/tmp/BDMlegacyXXXXXX";
+    int  fd     = mkstemp(name);
+    assert(fd >= 0 && write(fd, buf, len) == (ssize_t)len);
+    close(fd);
+
+    for(int map=0; map<2; map++)
+    {
+	BitDeviceMachine m, r;
+	m.MapFiles(map);
+	assert(m.ReadFile(name));
+	r.InitToBB3();
+	assert(m.GetHead() == r.GetHead() &&
+	       m.GetCurrentCommand() == r.GetCurrentCommand() &&
+	       m.FirstDifference(r) == m.Tapelen());
+	unsigned long n = 0;
+	for(; n<10000 && !(m.Halted() && r.Halted()); n++)
+	{
+	    m.ExecuteS();
+	    r.ExecuteS();
+	}
+	assert(m.Halted() && r.Halted() && m.GetHead() == r.GetHead() &&
+	       m.FirstDifference(r) == m.Tapelen());
+    }
+    unlink(name);
+}
+
+// A fork and its parent go their own ways once either writes, and pages
+//   neither has written are still shared. A flat machine stays flat
+void TestFork()
+{
+    Segment  s(0, 4 << Segment::MAXPAGESHIFT, Segment::MAXPAGESHIFT, 0xAA);
+    uchar    x[2] = {1, 2};
+    unsigned pl   = s.PageLen();
+    s.Put(x, 0, 1);
+    s.Put(x+1, pl, 1);
+    Segment* t = s.Fork();
+    *t->WriteA(0) = 3;
+    assert(*s.ReadA(0) == 1 && *t->ReadA(0) == 3 && s.ReadA(0) != t->ReadA(0));
+    assert(s.ReadA(pl) == t->ReadA(pl) && *t->ReadA(pl) == 2);
+    delete t;
+
+    BitDeviceMachine  m, bb4;
+    m.InitToBB4();
+    bb4.InitToBB4();
+    unsigned long     flat = m.Resident();
+    BitDeviceMachine* f    = m.Fork();
+    assert(m.Resident() == flat);
+    BitDeviceMachine* g    = f->Fork();
+    while(!f->Halted())
+	f->ExecuteT();
+    assert(m.FirstDifference(bb4) == m.Tapelen() &&
+	   g->FirstDifference(bb4) == g->Tapelen() &&
+	   f->FirstDifference(bb4) != f->Tapelen());
+    while(!g->Halted())
+	g->ExecuteT();
+    assert(g->FirstDifference(*f) == g->Tapelen());
+    delete g;
+    delete f;
+}
+
+// A machine run on a private mapping leaves its file as it was. One run
+//   on a shared mapping writes through, forked or not, and the file reads
+//   back mid-run
+//   (as after a crash) although its checksum is stale, then as the
+//   halted machine once it's let go -- when a flipped bit shows again
+void TestMappedFiles()
+{
+    char name[] = "/tmp/BDMmapXXXXXX";
+    int  fd     = mkstemp(name);
+    assert(fd >= 0);
+    close(fd);
+    BitDeviceMachine bb4, r;
+    bb4.InitToBB4();
+    assert(bb4.WriteFile(name));
+
+    for(int shared=0; shared<2; shared++)
+    {
+	BitDeviceMachine* m = new BitDeviceMachine;
+	m->MapFiles(true, shared);
+	assert(m->ReadFile(name));
+	for(int n=0; n<25; n++)
+	    m->ExecuteT();
+	BitDeviceMachine* f = m->Fork();
+	for(int n=0; n<25; n++)
+	    m->ExecuteT();
+	delete f;
+	assert(r.ReadFile(name));
+	assert((r.FirstDifference(*m) == r.Tapelen()) == (bool)shared);
+	assert((r.FirstDifference(bb4) == r.Tapelen()) != (bool)shared);
+	while(!m->Halted())
+	    m->ExecuteT();
+	assert(!shared || m->SyncFile());
+	delete m;
+    }
+    for(int n=0; n<107; n++)
+	bb4.ExecuteT();
+    assert(r.ReadFile(name) && r.Halted() &&
+	   r.FirstDifference(bb4) == r.Tapelen());
+
+    FILE* f = fopen(name, "r+b");
+    fseek(f, -1, SEEK_END);
+    int x = fgetc(f);
+    fseek(f, -1, SEEK_END);
+    fputc(x^1, f);
+    fclose(f);
+    assert(!r.ReadFile(name));
+    unlink(name);
+}
+
+// A checkpoint log restores the machine of its last record, and when
+//   that record is cut short (a crash while appending) the one before
+void TestCheckpointLog()
+{
+    char name[] = "/tmp/BDMckptXXXXXX";
+    int  fd     = mkstemp(name);
+    assert(fd >= 0);
+    close(fd);
+    BitDeviceMachine m, at30, r;
+    unsigned long    steps;
+    m.InitToBB4();
+    at30.InitToBB4();
+    assert(m.Checkpoint(name, 0));
+    for(int n=0; n<30; n++)
+    {
+	m.ExecuteT();
+	at30.ExecuteT();
+    }
+    assert(m.Checkpoint(name, 30));
+    assert(r.Restore(name, steps) && steps == 30);
+    assert(r.FirstDifference(at30) == r.Tapelen());
+
+    struct stat st;
+    for(int n=0; n<30; n++)
+	m.ExecuteT();
+    assert(m.Checkpoint(name, 60) && stat(name, &st) == 0);
+    assert(r.Restore(name, steps) && steps == 60);
+    assert(r.FirstDifference(m) == r.Tapelen() &&
+	   r.GetHead() == m.GetHead() &&
+	   r.GetCurrentCommand() == m.GetCurrentCommand());
+    assert(truncate(name, st.st_size-1) == 0);
+    assert(r.Restore(name, steps) && steps == 30);
+    assert(r.FirstDifference(at30) == r.Tapelen() &&
+	   r.GetHead() == at30.GetHead() &&
+	   r.GetCurrentCommand() == at30.GetCurrentCommand());
+    unlink(name);
+}
+
+// A history goes back to any step it has run -- by its undo log, from a
+//   snapshot, and across from one to the other -- and finds the machine
+//   as running from the start does, while its snapshots thin out to
+//   stay spread over a run much longer than they'd cover at first. The
+//   machine it was made from is left as it was
+void TestHistory()
+{
+    BitDeviceMachine bb4, ref;
+    bb4.InitToBB4();
+    ref.InitToBB4();
+    History h(&bb4, 50, 2048, 4);
+    while(h.Forward())
+	;
+    unsigned long end = h.Steps(), at = 0;
+    assert(end > 50*4*4 && h.Undoable() > 0 && h.Undoable() < 200);
+    assert(bb4.GetCurrentCommand() == ref.GetCurrentCommand() &&
+	   bb4.FirstDifference(ref) == bb4.Tapelen());
+
+    Sampler::Rng r(5);
+    for(int trial=0; trial<60; trial++)
+    {
+	unsigned long u = h.Undoable();
+	switch(trial%3)
+	{
+	case 0: h.StepBack(u+1+r.Below(3));            break;
+	case 1: h.StepBack(r.Below(u+1));              break;
+	case 2: assert(h.SeekTo(r.Below(end+1)));      break;
+	}
+	if(h.Steps() < at)
+	{
+	    ref.InitToBB4();
+	    at = 0;
+	}
+	for(; at<h.Steps(); at++)
+	    ref.ExecuteS();
+	BitDeviceMachine* m = h.Machine();
+	assert(m->GetCurrentCommand() == ref.GetCurrentCommand() &&
+	       m->GetHead() == ref.GetHead() &&
+	       m->FirstDifference(ref) == m->Tapelen());
+    }
+}
+
+// The hash kept up step by step matches one worked out from scratch
+//   (on a twin run alongside that has never been hashed, forked to
+//   work it out) through the bootstrap, native transitions, two-tape
+//   states, a table run and a program of plain ops
+void TestConfigHash()
+{
+    void (BitDeviceMachine::*make[4])() = {&BitDeviceMachine::InitToBB4,
+					   &BitDeviceMachine::InitToBB4,
+					   &BitDeviceMachine::InitTo2PAL,
+					   &BitDeviceMachine::InitToBB4};
+    for(int e=0; e<5; e++)
+    {
+	BitDeviceMachine m, twin;
+	TransitionTable  t;
+	if(e < 4)
+	{
+	    (m.*make[e])();
+	    (twin.*make[e])();
+	}
+	else
+	{
+	    m.InitToCalls(5);
+	    twin.InitToCalls(5);
+	}
+	m.GetTable(t);
+	m.ConfigHash();
+	for(int n=0; n<400 && !m.Halted(); n++)
+	{
+	    for(int k=0; k<2; k++)
+	    {
+		BitDeviceMachine &x = (k ? twin : m);
+		switch(e)
+		{
+		case 1:  x.ExecuteT();           break;
+		case 3:  x.ExecuteTable(t, 1);   break;
+		default: x.ExecuteS();           break;
+		}
+	    }
+	    BitDeviceMachine* f = twin.Fork();
+	    assert(m.ConfigHash() == f->ConfigHash());
+	    delete f;
+	}
+	assert(m.Halted() || e == 0);
+    }
+}
+
+// Threads with a results file open each put the same keys, pairs of
+//   which share a tag, in orders of their own while reading others back:
+//   every key gets one slot and no read sees half of one write
+void TestResultsDB()
+{
+    enum { THREADS = 4, KEYS = 1499 }; // Prime, so each order has every key
+    char name[] = "/tmp/BDMrsltXXXXXX";
+    int  fd     = mkstemp(name);
+    assert(fd >= 0);
+    close(fd);
+    unlink(name);
+
+    std::thread* th[THREADS];
+    for(unsigned t=0; t<THREADS; t++)
+	th[t] = new std::thread([&name, t]
+	{
+	    ResultsDB db;
+	    assert(db.Open(name, 2*KEYS));
+	    Sampler::Rng r(t+1);
+	    for(unsigned n=0; n<KEYS; n++)
+	    {
+		unsigned i = (n*(2*t+1)+t*KEYS/THREADS) % KEYS;
+		ResultsDB::Key    k = {1+i/2, i};
+		ResultsDB::Result res;
+		res.verdict = t;
+		res.decider = 0;
+		res.steps   = (unsigned long)i << 8 | t;
+		res.ones    = 3*res.steps;
+		assert(db.Put(k, res));
+
+		i = r.Below(KEYS);
+		k.hi = 1+i/2;
+		k.lo = i;
+		if(db.Get(k, res))
+		    assert(res.steps >> 8 == i && res.ones == 3*res.steps &&
+			   res.verdict == (res.steps & 0xFF));
+	    }
+	});
+    for(unsigned t=0; t<THREADS; t++)
+    {
+	th[t]->join();
+	delete th[t];
+    }
+
+    ResultsDB db;
+    assert(db.Open(name) && db.Count() == KEYS);
+    for(unsigned i=0; i<KEYS; i++)
+    {
+	ResultsDB::Key    k = {1+i/2, i};
+	ResultsDB::Result res;
+	assert(db.Get(k, res) && res.steps >> 8 == i &&
+	       res.ones == 3*res.steps);
+    }
+    db.Close();
+    unlink(name);
+}
+
+// Native runs count steps as ExecuteS does, and stop where a step at a
+//   time would for every kind of point but a register watch: continuing
+//   natively hits the same points at the same steps as going Forward
+void TestNativeBreakpoints()
+{
+    BitDeviceMachine m[2];
+    unsigned long    steps[2] = {0, 0};
+    for(int k=0; k<2; k++)
+    {
+	m[k].InitToBB4();
+	m[k].SetStepLimit(0);
+    }
+    assert(m[0].Execute(true, steps[0], 0));
+    assert(m[1].ExecuteN(steps[1], ~0UL) == 0);
+    assert(m[1].Halted() && steps[0] == steps[1] &&
+	   m[0].FirstDifference(m[1]) == m[0].Tapelen());
+
+    BitDeviceMachine bb4;
+    bb4.InitToBB4();
+    unsigned s = bb4.GetCurrentCommand();
+    for(int kind=0; kind<4; kind++)
+    {
+	Breakpoints bp[2];
+	for(int k=0; k<2; k++)
+	    switch(kind)
+	    {
+	    case 0: bp[k].BreakState(s+2);          break;
+	    case 1: bp[k].BreakTransition(s+3, 1);  break;
+	    case 2: bp[k].BreakStep(1000); bp[k].BreakStep(1500); break;
+	    case 3: bp[k].WatchCell(8); bp[k].BreakHead(12); break;
+	    }
+	History slow(&bb4), fast(&bb4);
+	for(int hits=0; ; hits++)
+	{
+	    bool hit = false;
+	    bp[0].Rearm(*slow.Machine());
+	    while(!hit && slow.Forward())
+		hit = bp[0].Hit(*slow.Machine(), slow.Steps());
+	    assert(fast.Continue(bp[1]) == hit);
+	    assert(fast.Steps() == slow.Steps() && bp[0].Last() == bp[1].Last());
+	    if(!hit) {assert(hits > 0); break;}
+	}
+    }
+
+    // The table and the pipeline stop at a point too
+    Breakpoints     bp;
+    TransitionTable t;
+    bp.BreakState(s+3);
+    m[0].InitToBB4();
+    m[0].SetBreakpoints(&bp);
+    m[0].GetTable(t);
+    unsigned long n = m[0].ExecuteTable(t, 1000);
+    assert(n > 0 && n < 107 && m[0].GetCurrentCommand() == s+3);
+
+    DeciderPipeline         dp;
+    DeciderPipeline::Job    job;
+    m[1].InitToBB4();
+    m[1].SetBreakpoints(&bp);
+    job.m  = &m[1];
+    job.id = 0;
+    dp.Start();
+    dp.Submit(&job);
+    dp.Finish();
+    assert(job.stopped && job.verdict == DeciderPipeline::UNDECIDED &&
+	   m[1].GetCurrentCommand() == s+3 && job.steps == n);
+}
+
+// Fill in a frame of n states from rows of (sym, dir, next) for reading
+//   0, 1 and blank -- next numbered from 0 in the rows, -1 to halt --
+//   and start it in state start. Returns the first state's index
+static unsigned setStates(BitDeviceMachine &m, unsigned n, const int (*row)[9],
+			  unsigned start)
+{
+    TransitionTable t;
+    unsigned s = m.InitToStates(n, 100);
+    m.GetTable(t);
+    for(unsigned i=0; i<n; i++)
+	for(uchar x=0; x<3; x++)
+	{
+	    int nx = row[i][3*x+2];
+	    t.Set(s+i, x, row[i][3*x], row[i][3*x+1], (nx < 0 ? 0 : s+nx));
+	}
+    m.SetTable(t);
+    m.SetCurrentCommand(s+start);
+    return s;
+}
+
+// Minimize merges states that behave the same, drops those that can't
+//   be reached (the frame's unused first state too), makes the commands
+//   it frees HALTs and runs as before; the normal form drops them too
+//   and gives a machine and its mirror image (numbered differently) the
+//   same key
+void TestMinimize()
+{
+    static const int a[4][9] = {{1, 1,-1,  1, 1,-1,  1,-1, 1},
+				{1, 1,-1,  1, 1,-1,  1, 1, 2},
+				{1, 1,-1,  1, 1,-1,  1, 1, 1},
+				{0,-1,-1,  0,-1,-1,  0,-1, 3}};
+    static const int b[4][9] = {{0, 1,-1,  0, 1,-1,  0, 1, 0},
+				{1,-1,-1,  1,-1,-1,  1,-1, 3},
+				{1,-1,-1,  1,-1,-1,  1, 1, 3},
+				{1,-1,-1,  1,-1,-1,  1,-1, 1}};
+    BitDeviceMachine m[2];
+    unsigned         s = setStates(m[0], 4, a, 0);
+    setStates(m[1], 4, a, 0);
+    unsigned* map = new unsigned[m[1].CommandCount()];
+    assert(m[1].Minimize(map) == 2);
+    assert(map[0] == 0 && map[s-1] == ~0u && map[s] == s-1 &&
+	   map[s+1] == s && map[s+2] == s && map[s+3] == ~0u);
+    delete [] map;
+    uchar key[2][64];
+    bool  mirrored[2];
+    assert(m[1].Canonical(key[1], sizeof key[1]) == 4+9*2);
+
+    TransitionTable t[2];
+    unsigned long   n[2];
+    for(int k=0; k<2; k++)
+    {
+	m[k].GetTable(t[k]);
+	n[k] = m[k].ExecuteTable(t[k], 1000);
+	assert(m[k].Halted());
+    }
+    assert(n[0] == 3 && n[1] == 3 && m[0].FirstDifference(m[1]) == m[0].Tapelen());
+    assert(t[1].IsState(s) && !t[1].IsState(s+1) && !t[1].IsState(s+3));
+    Breakpoints bp;
+    bp.WatchReg(49);
+    m[1].SetCurrentCommand(s-1);
+    m[1].ExecuteS(); // Into the bootstrap, which sets reg49
+    m[1].SetCurrentCommand(s+2);
+    bp.Rearm(m[1]);
+    m[1].ExecuteS(); // A HALT goes nowhere and clears nothing
+    assert(m[1].GetCurrentCommand() == s+2 && !bp.Hit(m[1], 1));
+
+    setStates(m[0], 4, a, 0);
+    setStates(m[1], 4, b, 2);
+    for(int k=0; k<2; k++)
+	assert(m[k].Canonical(key[k], sizeof key[k], &mirrored[k]) == 4+9*3);
+    assert(!memcmp(key[0], key[1], 4+9*3) && mirrored[0] != mirrored[1]);
+}
+
+// Encodings that differ only in how the states are numbered, in states
+//   that can't be reached and in left for right have one normal form --
+//   and it says which of them were mirrored
+void TestCanonicalize()
+{
+    enum { MAXN = 6, LEN = 4+9*(MAXN+1) };
+    Sampler::Rng r(7);
+    for(int trial=0; trial<500; trial++)
+    {
+	unsigned n = 1+r.Below(MAXN), start = 1+r.Below(n);
+	unsigned perm[MAXN+1];
+	uchar    enc[4][LEN], out[4][LEN];
+	bool     mirrored[4];
+	perm[0] = 0;
+	for(unsigned i=1; i<=n; i++)
+	{
+	    unsigned j = 1+r.Below(i);
+	    perm[i] = perm[j];
+	    perm[j] = i;
+	}
+
+	// The machine, renumbered, mirrored, and both with a state left
+	//   over that nothing goes to
+	for(int v=0; v<4; v++)
+	{
+	    unsigned m = n+(v == 3);
+	    enc[v][0] = m; enc[v][1] = 0;
+	    enc[v][2] = (v & 1 ? perm[start] : start); enc[v][3] = 0;
+	}
+	for(unsigned i=1; i<=n+1; i++)
+	    for(int x=0; x<3; x++)
+	    {
+		unsigned sym = r.Below(2), d = 2*r.Below(2);
+		unsigned nxt = r.Below(n+1);
+		for(int v=0; v<4; v++)
+		{
+		    if(i > n && v != 3) continue;
+		    unsigned si = (v & 1 && i <= n ? perm[i] : i);
+		    unsigned sn = (v & 1 ? perm[nxt] : nxt);
+		    uchar*   t  = enc[v]+4+9*(si-1)+3*x;
+		    t[0] = sym | (v & 2 ? 2-d : d) << 2;
+		    t[1] = sn; t[2] = 0;
+		}
+	    }
+	unsigned len = 0;
+	for(int v=0; v<4; v++)
+	{
+	    unsigned k = BitDeviceMachine::Canonicalize(enc[v],
+							4+9*(n+(v == 3)),
+							out[v], &mirrored[v]);
+	    assert(k >= 4+9 && k <= 4+9*n && (v == 0 || k == len));
+	    assert(!memcmp(out[v], out[0], k));
+	    assert(mirrored[v] == (mirrored[0] != (v >= 2)));
+	    len = k;
+	}
+    }
+}
+
+// The static stage finds that a machine running right for good can't
+//   halt on tapes of any width, but leaves it undecided with a symbol on
+//   the tape it has no transition for
+void TestStaticStage()
+{
+    static const int right[1][9] = {{1, 1, 0,  1, 1, 0,  1, 1, 0}};
+    unsigned         width[3]    = {2, 4, 8};
+    for(int k=0; k<3; k++)
+	for(int wide=0; wide<2; wide++)
+	{
+	    if(wide && width[k] == 2) continue;
+	    BitDeviceMachine m;
+	    m.SymbolWidth(width[k]);
+	    setStates(m, 1, right, 0);
+	    if(wide)
+	    {
+		unsigned h = m.GetHead();
+		m.SetHead(h-10);
+		m.Write(5);
+		m.SetHead(h);
+	    }
+	    DeciderPipeline      dp;
+	    DeciderPipeline::Job job;
+	    job.m  = &m;
+	    job.id = 0;
+	    dp.Start();
+	    dp.Submit(&job);
+	    dp.Finish();
+	    if(wide)
+		assert(job.verdict == DeciderPipeline::UNDECIDED);
+	    else
+		assert(job.verdict == DeciderPipeline::NEVERHALTS &&
+		       job.stage == DeciderPipeline::STATIC);
+	}
+}
+
+// CALLs as deep as the return stack goes come back, one deeper or a RETN
+//   with nothing to return to halts the program Faulted. A new machine's
+//   stack is empty whatever its buffer held
+void TestReturnStack()
+{
+    JunkAllocator    ja;
+    BitDeviceMachine m;
+    m.SetAllocator(&ja);
+    unsigned depth[3]   = {RSTACKLEN-1, RSTACKLEN, 0};
+    bool     over[3]    = {false, false, true};
+    bool     faulted[3] = {false, true, true};
+    for(int k=0; k<3; k++)
+    {
+	m.InitToCalls(depth[k], over[k]);
+	for(int n=0; n<1000 && !m.Halted(); n++)
+	    m.ExecuteS();
+	assert(m.Halted() && m.Faulted() == faulted[k]);
+    }
+}
+#endif
+
 void RunTests()
 {
+    TestAllocators();
+    TestBitFields();
+    TestBlockOps();
+#ifdef BITDEVICEMACHINE_H
+    TestMachineAllocators();
+    TestSamplerSkip();
+    TestSparseTape();
+    TestTapeKernels();
+    TestBitPlanes();
+    TestTableRoundTrip();
+    TestSymbolWidths();
+    TestReturnStack();
+    TestLegacyFile();
+    TestFork();
+    TestMappedFiles();
+    TestCheckpointLog();
+    TestHistory();
+    TestConfigHash();
+    TestResultsDB();
+    TestNativeBreakpoints();
+    TestMinimize();
+    TestCanonicalize();
+    TestStaticStage();
+#endif
 }
 
 FILE* DBGFILE;
@@ -1,5 +1,10 @@
 #include <fstream>
 #include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 #include "BitDevice.h"
 
 // #bytes/word, byte offset to start of registers
@@ -8,33 +13,280 @@
 
 void BitDevice::reset()
 {
-    if(deleteTape) delete tape;
+    if(deleteTape) alloc->Free(tape, tapelen);
+    for(unsigned i=0; i<segCnt; i++)
+	delete seg[i];
+    delete [] seg;
     tape    = 0;
     tapelen = 0;
     reg     = 0;
     deleteTape = false;
+    alloc   = 0;
+    seg     = 0;
+    segCnt  = 0;
 }
 
-void BitDevice::LoadTape(uchar* buf, unsigned buflen, bool oursToDelete)
+void BitDevice::LoadTape(uchar* buf, unsigned buflen, bool oursToDelete,
+			 Allocator* al)
 {
     // Reset BitDevice
     reset();
     
     deleteTape = oursToDelete;
+    alloc      = (al ? al : Allocator::Heap());
     tape       = buf;
     tapelen    = buflen;
     reg        = (buf ? REGSTART(buf) : 0);
 }
 
+// Load a tape made of segments -- they must cover it without gaps and
+//   the registers must sit in a single page
+void BitDevice::LoadSegments(Segment** segs, unsigned cnt)
+{
+    reset();
+    assert(segs && cnt > 0 && segs[0]->Start() == 0);
+    for(unsigned i=1; i<cnt; i++)
+	assert(segs[i]->Start() == segs[i-1]->End());
+
+    seg     = segs;
+    segCnt  = cnt;
+    tapelen = segs[cnt-1]->End();
+
+    unsigned regStart = (*(unsigned*)ReadA(0))*BYTESPERWORD;
+    assert(FindSegment(regStart)->PageLen() >= MAXREGS*sizeof(int));
+    reg = (int*)WriteA(regStart);
+}
+
+// Segments (none if the tape is flat)
+unsigned BitDevice::SegmentCount() const {return segCnt;}
+Segment* BitDevice::GetSegment(unsigned i) const
+{assert(i < segCnt); return seg[i];}
+
+// Segment holding the byte at b -- there are only ever a handful
+Segment* BitDevice::FindSegment(unsigned b) const
+{
+    for(unsigned i=0; i<segCnt; i++)
+	if(seg[i]->Contains(b)) return seg[i];
+    assert(!"Address outside of tape");
+    return 0;
+}
+
+// Address of the byte at b for reading or writing
+const uchar* BitDevice::ReadA(unsigned b) const
+{
+    if(!seg) {assert(b < tapelen); return tape+b;}
+    return FindSegment(b)->ReadA(b);
+}
+uchar* BitDevice::WriteA(unsigned b)
+{
+    if(!seg) {assert(b < tapelen); return tape+b;}
+    return FindSegment(b)->WriteA(b);
+}
+
+// Bytes contiguous from b
+unsigned BitDevice::span(unsigned b) const
+{
+    if(!seg) {assert(b < tapelen); return tapelen-b;}
+    return FindSegment(b)->Span(b);
+}
+
+// Pull the field of w bits at bit o out of x, or put v there (pext/pdep
+//   where the CPU has them)
+static inline unsigned extractBits(uint64_t x, unsigned o, unsigned w)
+{
+    uint64_t m = ((1ULL<<w)-1) << o;
+#ifdef __BMI2__
+    return (unsigned)_pext_u64(x, m);
+#else
+    return (unsigned)((x & m) >> o);
+#endif
+}
+static inline uint64_t depositBits(uint64_t x, unsigned o, unsigned w,
+				   unsigned v)
+{
+    uint64_t m = ((1ULL<<w)-1) << o;
+#ifdef __BMI2__
+    return (x & ~m) | _pdep_u64(v, m);
+#else
+    return (x & ~m) | (((uint64_t)v << o) & m);
+#endif
+}
+
+// Read a w bit field at bit p: one 64-bit load if the 8 bytes from p's
+//   byte are contiguous, a byte at a time near the end of a page
+unsigned BitDevice::ReadBits(unsigned p, unsigned w) const
+{
+    assert(w > 0 && w <= 32);
+    unsigned b = p/bPB, o = p%bPB;
+    uint64_t x = 0;
+    if(span(b) >= sizeof(x))
+	memcpy(&x, ReadA(b), sizeof(x));
+    else
+	for(unsigned i=0; i<(o+w+bPB-1)/bPB; i++)
+	    x |= (uint64_t)*ReadA(b+i) << (bPB*i);
+    return extractBits(x, o, w);
+}
+
+// Write a w bit field at bit p, leaving the bits around it alone
+void BitDevice::WriteBits(unsigned p, unsigned w, unsigned v)
+{
+    assert(w > 0 && w <= 32);
+    unsigned b = p/bPB, o = p%bPB;
+    uint64_t x = 0;
+    if(span(b) >= sizeof(x))
+    {
+	uchar* t = WriteA(b);
+	memcpy(&x, t, sizeof(x));
+	x = depositBits(x, o, w, v);
+	memcpy(t, &x, sizeof(x));
+	return;
+    }
+    unsigned n = (o+w+bPB-1)/bPB;
+    for(unsigned i=0; i<n; i++)
+	x |= (uint64_t)*ReadA(b+i) << (bPB*i);
+    x = depositBits(x, o, w, v);
+    for(unsigned i=0; i<n; i++)
+	*WriteA(b+i) = (uchar)(x >> (bPB*i));
+}
+
+// Move n bytes from s to d. Segmented tapes go a page run at a time --
+//   through a copy if the ranges overlap and d is above s
+void BitDevice::moveBytes(unsigned d, unsigned s, unsigned n)
+{
+    if(d == s || n == 0) return;
+    assert(d+n <= tapelen && s+n <= tapelen);
+    if(!seg) {memmove(tape+d, tape+s, n); return;}
+
+    uchar* tmp = 0;
+    const uchar* src = 0;
+    if(d > s && d < s+n)
+    {
+	tmp = new uchar[n];
+	Copy(tmp, s, n);
+	src = tmp;
+    }
+    for(unsigned i=0, k; i<n; i+=k)
+    {
+	uchar* t = WriteA(d+i);   // First, in case it copies s's page
+	k = span(d+i);
+	if(k > n-i) k = n-i;
+	if(src)
+	    memcpy(t, src+i, k);
+	else
+	{
+	    if(span(s+i) < k) k = span(s+i);
+	    memmove(t, ReadA(s+i), k);
+	}
+    }
+    delete [] tmp;
+}
+
+// Copy n bits from src to dst. Byte aligned ranges move as bytes, others
+//   32 bits at a time -- upwards if the copy moves down and downwards if
+//   it moves up, so overlapping bits are read before they're written
+void BitDevice::CopyBits(unsigned dst, unsigned src, unsigned n)
+{
+    if(dst == src || n == 0) return;
+    if(dst%bPB == 0 && src%bPB == 0)
+    {
+	unsigned nb = n/bPB, r = n%bPB;
+	unsigned tail = (r ? ReadBits(src+nb*bPB, r) : 0);
+	moveBytes(dst/bPB, src/bPB, nb);
+	if(r) WriteBits(dst+nb*bPB, r, tail);
+	return;
+    }
+    if(dst < src)
+	for(unsigned i=0; i<n; i+=32)
+	{
+	    unsigned k = (n-i < 32 ? n-i : 32);
+	    WriteBits(dst+i, k, ReadBits(src+i, k));
+	}
+    else
+	for(unsigned i=n; i>0; )
+	{
+	    unsigned k = (i < 32 ? i : 32);
+	    i -= k;
+	    WriteBits(dst+i, k, ReadBits(src+i, k));
+	}
+}
+
+// Write x cnt times from dst: symbols up to a byte boundary, then bytes
+//   of four x's a page run at a time, then the symbols left over
+void BitDevice::FillSymbols(unsigned dst, uchar x, unsigned cnt)
+{
+    assert(x < 4);
+    unsigned end = dst+2*cnt;
+    for(; dst < end && dst%bPB; dst += 2)
+	WriteBits(dst, 2, x);
+    unsigned nb = (end-dst)/bPB;
+    for(unsigned i=0, k; i<nb; i+=k)
+    {
+	uchar* t = WriteA(dst/bPB+i);
+	k = span(dst/bPB+i);
+	if(k > nb-i) k = nb-i;
+	memset(t, x*0x55, k);
+    }
+    for(dst += nb*bPB; dst < end; dst += 2)
+	WriteBits(dst, 2, x);
+}
+
+// Offset of the first bit that differs in n bits at a and b (n if none)
+unsigned BitDevice::CompareBits(unsigned a, unsigned b, unsigned n) const
+{
+    unsigned i = 0;
+    if(a%bPB == 0 && b%bPB == 0)
+    {
+	// Compare contiguous byte runs then look at the byte that differs
+	unsigned nb = n/bPB;
+	for(unsigned k; i<nb; i+=k)
+	{
+	    k = span(a/bPB+i);
+	    if(span(b/bPB+i) < k) k = span(b/bPB+i);
+	    if(k > nb-i) k = nb-i;
+	    const uchar* pa = ReadA(a/bPB+i);
+	    const uchar* pb = ReadA(b/bPB+i);
+	    if(!memcmp(pa, pb, k)) continue;
+	    unsigned j = 0;
+	    while(pa[j] == pb[j]) j++;
+	    return bPB*(i+j) + __builtin_ctz(pa[j]^pb[j]);
+	}
+	i *= bPB;
+    }
+    for(; i<n; i+=32)
+    {
+	unsigned k = (n-i < 32 ? n-i : 32);
+	unsigned d = ReadBits(a+i, k) ^ ReadBits(b+i, k);
+	if(d) return i + __builtin_ctz(d);
+    }
+    return n;
+}
+
+// Copy len bytes at b into buf, whichever segments they fall in
+void BitDevice::Copy(uchar* buf, unsigned b, unsigned len) const
+{
+    assert(b+len <= tapelen);
+    if(!seg) {memcpy(buf, tape+b, len); return;}
+    while(len)
+    {
+	Segment* s = FindSegment(b);
+	unsigned k = s->End()-b;
+	if(k > len) k = len;
+	s->Get(buf, b, k);
+	buf += k; b += k; len -= k;
+    }
+}
+
 // Copy 32 bits beginning at bit p1 into an unsigned and return
 //   in an unsigned
 unsigned BitDevice::wrd(unsigned p1)
 {
-    // Find the bytes containing p1 -- expect p1 on a byte boundary
-    unsigned b1 = p1/bPB; assert(p1%bPB == 0);
+    // Find the bytes containing p1 -- anywhere but a byte boundary
+    //   (or a word split by a page) is a general bit field
+    unsigned b1 = p1/bPB;
+    if(p1%bPB || span(b1) < sizeof(unsigned)) return ReadBits(p1, 32);
 
     // Get the value out of the string at the given bytes
-    unsigned word = *(unsigned*)(tape+b1);
+    unsigned word = *(const unsigned*)ReadA(b1);
 
     // Return word
     return word;
@@ -43,10 +295,12 @@ unsigned BitDevice::wrd(unsigned p1)
 // Pull a 2bit symbol from buf at bitAddress and return in a uchar
 uchar BitDevice::sym(unsigned bitAddress)
 {
-    // Get they byte where the bits are -- expect both bits in same byte
+    // Get they byte where the bits are -- if they straddle two bytes
+    //   it's a general bit field
     unsigned byteA     = bitAddress/bPB;
-    unsigned offsetA   = bitAddress%bPB; assert(offsetA < 7);
-    uchar byte = *(tape+byteA);
+    unsigned offsetA   = bitAddress%bPB;
+    if(offsetA == 7) return ReadBits(bitAddress, 2);
+    uchar byte = *ReadA(byteA);
     
     // Shift byte so that the desired bits are the two least significant
     // Mask out the top six using mask 00000011(3)
@@ -61,22 +315,24 @@ uchar BitDevice::sym(unsigned bitAddress)
 // Bit Device has no tape top start with
 BitDevice::BitDevice()
 {
+    deleteTape = false; seg = 0; segCnt = 0;
     LoadTape(0, 0, false);
 }
 
 BitDevice::BitDevice(uchar* buf, unsigned buflen)
 {
+    deleteTape = false; seg = 0; segCnt = 0;
     LoadTape(buf, buflen, false);
 }
 
 BitDevice::~BitDevice()
 {
-    if(deleteTape) delete tape;
+    reset();
 }
 
-bool BitDevice::Valid()
+bool BitDevice::Valid() const
 {
-    return (tape != 0);
+    return (tape != 0 || seg != 0);
 }
 
 uchar* BitDevice::GetTape(unsigned &buflen) const
@@ -120,14 +376,22 @@ void BitDevice::Read(const char* fname)
 //Write length bits from buf into fname
 void BitDevice::Write(const char* fname)
 {
-    assert(tape);
+    assert(Valid());
     
     // Open the file for writing
     std::ofstream tfile(fname, std::ofstream::out | std::ofstream::binary);
     if (!tfile)	return;
 
-    // Write the buffer
-    tfile.write((char*)tape, tapelen);
+    // Write the buffer (flattening segments first)
+    if(tape)
+	tfile.write((char*)tape, tapelen);
+    else
+    {
+	uchar* buf = new uchar[tapelen];
+	Copy(buf, 0, tapelen);
+	tfile.write((char*)buf, tapelen);
+	delete [] buf;
+    }
 
     // Close the file
     tfile.close();
@@ -156,6 +420,24 @@ int BitDevice::COMP(unsigned r1, unsigned r2)
     return reg[r1]-reg[r2];
 }
 
+// Push the value in register r onto the return stack
+bool BitDevice::PUSH(unsigned r)
+{
+    assert(r < MAXREGS);
+    if(reg[RSPREG] < 0 || reg[RSPREG] >= RSTACKLEN) return false;
+    reg[RSTACKREG+reg[RSPREG]++] = reg[r];
+    return true;
+}
+
+// Pop the top of the return stack into register r
+bool BitDevice::POPR(unsigned r)
+{
+    assert(r < MAXREGS);
+    if(reg[RSPREG] <= 0 || reg[RSPREG] > RSTACKLEN) return false;
+    reg[r] = reg[RSTACKREG+--reg[RSPREG]];
+    return true;
+}
+
 // Read 32 bits from the tape beginning at bit position specified 
 //   in register r1 into register r2 
 void BitDevice::WRDR(unsigned r1, unsigned r2)
@@ -172,14 +454,18 @@ void BitDevice::WRDW(unsigned r1, unsigned r2)
     assert(r1 < MAXREGS);
     assert(r2 < MAXREGS);
 
-    // Find the byte specified by the offset in r2
-    //      -- assume even boundaries
+    // Find the byte specified by the offset in r2 -- off a byte boundary
+    //   (or split by a page) write it as a general bit field
     unsigned p = reg[r2];
-    assert(p%bPB == 0);
     unsigned b1 = p/bPB; 
+    if(p%bPB || span(b1) < sizeof(unsigned))
+    {
+	WriteBits(p, 32, reg[r1]);
+	return;
+    }
 
     // Write the given value at the given byte
-    *(unsigned*)(tape+b1) = reg[r1];
+    *(unsigned*)WriteA(b1) = reg[r1];
 }
 
 
@@ -205,20 +491,26 @@ void BitDevice::SYMW(unsigned r1, unsigned r2)
     uchar sbyte = reg[r1];
 
     // Get offset from r2 and use it to find target byte
-    // Identify the target byte -- expect both bits to be in same byte
-    unsigned p = reg[r2];    assert(p%2 == 0); // Assume even boundaries
+    // Identify the target byte -- symbols off an even boundary are
+    //   general bit fields
+    unsigned p = reg[r2];
+    if(p%2)
+    {
+	WriteBits(p, 2, sbyte);
+	return;
+    }
     unsigned tbyteA   = p/bPB;
-    unsigned toffsetA = p%bPB; assert(toffsetA < 7);              
-    uchar tbyte = *(tape+tbyteA);
+    unsigned toffsetA = p%bPB;
+    uchar* t     = WriteA(tbyteA);
+    uchar  tbyte = *t;
 
     // Mask out the target bits and replace them with source bits
-    assert(toffsetA == 0 || toffsetA == 2 || toffsetA == 4 || toffsetA == 6);
     tbyte = tbyte & emask[toffsetA/2];
     sbyte = sbyte << toffsetA;
     tbyte = tbyte | sbyte;
 
     // Replace original target byte with newly edited tbyte
-    *(tape+tbyteA) = tbyte;
+    *t = tbyte;
 }
 
 // Multiply/Add the values in register r1 and r2 and place result in r3 
@@ -238,6 +530,34 @@ void BitDevice::ADDN(unsigned r1, unsigned r2, unsigned r3)
     reg[r3] = reg[r1]+reg[r2];
 }
 
+// Copy reg[r3] bits from the bit position in r1 to the one in r2
+void BitDevice::BCPY(unsigned r1, unsigned r2, unsigned r3)
+{
+    assert(r1 <MAXREGS);
+    assert(r2 <MAXREGS);
+    assert(r3 <MAXREGS);
+    CopyBits(reg[r2], reg[r1], reg[r3]);
+}
+
+// Write the symbol in r1 reg[r3] times from the bit position in r2
+void BitDevice::SFIL(unsigned r1, unsigned r2, unsigned r3)
+{
+    assert(r1 <MAXREGS);
+    assert(r2 <MAXREGS);
+    assert(r3 <MAXREGS);
+    FillSymbols(reg[r2], reg[r1], reg[r3]);
+}
+
+// Compare reg[r3] bits at the bit positions in r1 and r2 -- r3 gets the
+//   offset of the first bit that differs
+void BitDevice::BCMP(unsigned r1, unsigned r2, unsigned r3)
+{
+    assert(r1 <MAXREGS);
+    assert(r2 <MAXREGS);
+    assert(r3 <MAXREGS);
+    reg[r3] = CompareBits(reg[r1], reg[r2], reg[r3]);
+}
+
 
 
 
@@ -2,6 +2,8 @@
 #define BITDEVICE_H
 
 #include "syntactic_sugar.h"
+#include "Segment.h"
+#include "Allocator.h"
 
 // BitDevice is an abstraction of a machine that can
 //   read and return 2bits(SYM) or 32bits(WRD)
@@ -11,13 +13,20 @@
 //     *(some limits on byte boundaries apply)
 // Bit Device can also write a given bit string to disk or
 //   read in a bitstring previously stored
+//
+// The bit string is either one flat buffer (LoadTape) or a list of
+//   Segments that together cover it (LoadSegments). Addresses are the
+//   same either way -- segments are translated on every access
 class BitDevice
 {
 private:
-    uchar*   tape;
-    unsigned tapelen;
-    int     *reg;
-    bool     deleteTape;
+    uchar*    tape;
+    unsigned  tapelen;
+    int      *reg;
+    bool      deleteTape;
+    Allocator* alloc; // Where the tape goes back to if it's ours to delete
+    Segment** seg;    // Segments in address order (0 if flat)
+    unsigned  segCnt;
 
     // Dump any exisiting tape
     void reset();
@@ -30,6 +39,12 @@ private:
     //   into an unsigned and return
     unsigned wrd(unsigned bitAddress);
 
+    // Bytes from byteAddress that are contiguous (to the end of its page)
+    unsigned span(unsigned byteAddress) const;
+
+    // Move n bytes from s to d (the ranges may overlap)
+    void moveBytes(unsigned d, unsigned s, unsigned n);
+
 public:
 //=====================CONFIGURATION=====================================
     // Constructors/Destructor
@@ -37,15 +52,48 @@ public:
     BitDevice(uchar* buf, unsigned buflen);
     ~BitDevice();
 
-    // Load the tape we are going to read from and write to
-    void LoadTape(uchar* buf, unsigned buflen, bool oursToDelete=false);
+    // Load the tape we are going to read from and write to. If it's
+    //   ours to delete it goes back to al (the heap if al is 0)
+    void LoadTape(uchar* buf, unsigned buflen, bool oursToDelete=false,
+		  Allocator* al=0);
+
+    // Load a tape made of cnt segments in address order -- the
+    //   BitDevice owns the array and the segments from now on
+    void LoadSegments(Segment** segs, unsigned cnt);
 
     // Accessors
-    // Return pointer to tape/registers
-    bool   Valid();
+    // Return pointer to tape/registers (GetTape is 0 if segmented)
+    bool   Valid() const;
     uchar* GetTape(unsigned &buflen) const;
     int*   GetRegisters();
 
+    // Segments (SegmentCount is 0 if flat)
+    unsigned SegmentCount() const;
+    Segment* GetSegment(unsigned i) const;
+    Segment* FindSegment(unsigned byteAddress) const;
+
+    // Address of the byte at byteAddress for reading or writing. Good to
+    //   the end of its segment's page (to the end of the tape if flat)
+    const uchar* ReadA(unsigned byteAddress) const;
+    uchar*       WriteA(unsigned byteAddress);
+
+    // Copy len bytes at byteAddress into buf
+    void Copy(uchar* buf, unsigned byteAddress, unsigned len) const;
+
+    // Read/write a field of width (1 to 32) bits at any bit address --
+    //   fields may straddle bytes, words and pages
+    unsigned ReadBits(unsigned bitAddress, unsigned width) const;
+    void     WriteBits(unsigned bitAddress, unsigned width, unsigned value);
+
+    // Block operations on bit ranges, a byte run at a time where the
+    //   ranges are byte aligned and 32 bits at a time where they aren't
+    //   copy n bits from src to dst (the ranges may overlap), write the
+    //   symbol x cnt times from dst on and return the offset of the first
+    //   bit that differs in the n bits at a and b (n if none)
+    void     CopyBits(unsigned dst, unsigned src, unsigned n);
+    void     FillSymbols(unsigned dst, uchar x, unsigned cnt);
+    unsigned CompareBits(unsigned a, unsigned b, unsigned n) const;
+
     // File I/O
     // Read/Write a tape from/to fname 
     void Read(const char* fname);
@@ -58,6 +106,12 @@ public:
     //     TODO: is it somehow cheating not to use register for result?
     //           if we use register, how do we access it?
     int  COMP(unsigned r1, unsigned r2); 
+
+    // Push the value in register r onto the return stack / pop the
+    //   top of the return stack into register r -- false (and nothing
+    //   done) if the stack is full / empty, which is the program's fault
+    bool PUSH(unsigned r);
+    bool POPR(unsigned r);
     
     // Clear registers
     void CLRR();
@@ -84,6 +138,19 @@ public:
     // Multiply/Add the values in register r1 and r2 and place result in r3 
     void MULT(unsigned r1, unsigned r2, unsigned r3);
     void ADDN(unsigned r1, unsigned r2, unsigned r3);
+
+    // Copy the number of bits in register r3 from the bit position in
+    //   register r1 to the bit position in register r2 (may overlap)
+    void BCPY(unsigned r1, unsigned r2, unsigned r3);
+
+    // Write the symbol in register r1 the number of times in register r3
+    //   from the bit position in register r2 on
+    void SFIL(unsigned r1, unsigned r2, unsigned r3);
+
+    // Compare the number of bits in register r3 at the bit positions in
+    //   registers r1 and r2 -- r3 gets the offset of the first bit that
+    //   differs (unchanged if none do)
+    void BCMP(unsigned r1, unsigned r2, unsigned r3);
 };
 
 #endif
@@ -114,6 +114,47 @@ bool BitDeviceDemon::execOpCode(int opcode, int arg1, int arg2, int arg3)
 	bd.WRDW(arg1, arg2);
 	break;
     }
+    case OPBCPY:   // Copy a range of bits (ranges may overlap)
+    {
+	bd.BCPY(arg1, arg2, arg3);
+	break;
+    }
+    case OPSFIL:   // Fill a range with a symbol
+    {
+	bd.SFIL(arg1, arg2, arg3);
+	break;
+    }
+    case OPBCMP:   // Compare two ranges of bits
+    {
+	bd.BCMP(arg1, arg2, arg3);
+	break;
+    }
+    case OPJMPZ:   // Go to arg3 if registers r1 and r2 are equal
+    {
+	if(bd.COMP(arg1, arg2) == 0) bd.LOAD(arg3, 43);
+	break;
+    }
+    case OPJMNZ:   // Go to arg3 if registers r1 and r2 differ
+    {
+	if(bd.COMP(arg1, arg2) != 0) bd.LOAD(arg3, 43);
+	break;
+    }
+    case OPJMLT:   // Go to arg3 if register r1 is less than r2
+    {
+	if(bd.COMP(arg1, arg2) < 0) bd.LOAD(arg3, 43);
+	break;
+    }
+    case OPCALL:   // Push the next command and go to arg3
+    {
+	if(bd.PUSH(43)) bd.LOAD(arg3, 43);
+	else             stackFault();
+	break;
+    }
+    case OPRETN:   // Go to the command on top of the return stack
+    {
+	if(!bd.POPR(43)) stackFault();
+	break;
+    }
     case OPHALT:    // OPCode indicates string has HALTED 
     {
 	return true;
@@ -134,6 +175,13 @@ bool BitDeviceDemon::execOpCode(int opcode, int arg1, int arg2, int arg3)
     return false;    
 }
 
+// The bad CALL or RETN goes to the halt command rather than on
+void BitDeviceDemon::stackFault()
+{
+    bd.LOAD(RSTACKERR, RSPREG);
+    bd.LOAD(HALTCMDOFF, 43);
+}
+
 bool BitDeviceDemon::Halted()
 {
     assert(bd.Valid());
@@ -15,9 +15,15 @@ private:
 
     enum OPCODES { OPCLRR, OPLOAD, OPWRDR, OPSYMR, OPMULT,
 		   OPADDN, OPWRDW, OPSYMW, OPHALT, OPRTRN,
+		   OPBCPY, OPSFIL, OPBCMP, OPJMPZ, OPJMNZ,
+		   OPJMLT, OPCALL, OPRETN,
 		   OPTMST=1235};
 
     bool execOpCode(int opcode, int arg1, int arg2, int arg3);
+
+    // Stop on a return stack fault: mark the stack and go to the halt
+    //   command next
+    void stackFault();
     
 public:
     BitDeviceDemon();
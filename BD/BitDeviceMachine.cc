@@ -2,7 +2,15 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <mutex>
 #include "BitDeviceMachine.h"
+#include "TapeKernels.h"
+#include "BitPlaneTape.h"
+#include "TransitionTable.h"
+#include "MappedFile.h"
+#include "Breakpoints.h"
 
 #include "debugfile.h"
 
@@ -10,10 +18,14 @@
 #include "MachineTape.cc"
 #include "RegTape.cc"
 #include "WorkingTape.cc"
+#include "TapeFile.cc"
+#include "CheckpointLog.cc"
 
 // Constructor and destructor
 BitDeviceMachine::BitDeviceMachine()
-{a = 0; b = 0; c = 0;}
+{a = 0; b = 0; c = 0; tapes = 0; symWidth = 2; shareBoot = false; sparse = false; alloc = Allocator::Heap();
+ mapFiles = false; mapShared = false; mapped = 0; snap = 0; snapCnt = 0;
+ brk = 0; stepLimit = 10000; zhash = 0; zhashOk = false;}
 BitDeviceMachine::~BitDeviceMachine()
 {reset(0, 0, false);}
 
@@ -21,24 +33,41 @@ BitDeviceMachine::~BitDeviceMachine()
 //   of buflen bytes. delTape is true if the tape should
 //   be deleted on destruction of the machine
 void BitDeviceMachine::reset(uchar* buf, unsigned buflen, bool delTape)
-{bd.LoadTape(buf, buflen, delTape);}
+{dropSnapshot(); bd.LoadTape(buf, buflen, delTape, alloc); unmap(); zhashOk = false;}
+
+// Let go of the file mapping (the tape must be off it by now). A shared
+//   file is left checked in: the checksum of what it holds and not LIVE
+void BitDeviceMachine::unmap()
+{
+    if (mapped && mapped->Shared())
+	syncFile(false);
+    delete mapped;
+    mapped = 0;
+}
 
 // Return a pointer to the machine's register tape
 int* BitDeviceMachine::getRegisters()
 {return bd.GetRegisters();}
 
 // Write the TuringBootstrap program into MachineTape
-#define aHALT()        {a->cmd[m].Init(Command::OPHALT,   0,   0,   0,   0);m++;}
-#define aLOAD(i, j)    {a->cmd[m].Init(Command::OPLOAD, (i), (j),   0, m+1);m++;}
-#define aWRDR(i, j)    {a->cmd[m].Init(Command::OPWRDR, (i), (j),   0, m+1);m++;}
-#define aSYMR(i, j)    {a->cmd[m].Init(Command::OPSYMR, (i), (j),   0, m+1);m++;}
-#define aSYMW(i, j)    {a->cmd[m].Init(Command::OPSYMW, (i), (j),   0, m+1);m++;}
-#define aWRDW(i, j)    {a->cmd[m].Init(Command::OPWRDW, (i), (j),   0, m+1);m++;}
-#define aCOMP(i, j)    {a->cmd[m].Init(Command::OPCOMP, (i), (j),   0, m+1);m++;}
-#define aADDN(i, j, k) {a->cmd[m].Init(Command::OPADDN, (i), (j), (k), m+1);m++;}
-#define aMULT(i, j, k) {a->cmd[m].Init(Command::OPMULT, (i), (j), (k), m+1);m++;}
-#define aRTRN(i, j)    {a->cmd[m].Init(Command::OPRTRN, (i), (j),   0,   0);m++;}
-unsigned BitDeviceMachine::turingBootstrap()
+#define aHALT()        {cmd[m].Init(Command::OPHALT,   0,   0,   0,   0);m++;}
+#define aLOAD(i, j)    {cmd[m].Init(Command::OPLOAD, (i), (j),   0, m+1);m++;}
+#define aWRDR(i, j)    {cmd[m].Init(Command::OPWRDR, (i), (j),   0, m+1);m++;}
+#define aSYMR(i, j)    {cmd[m].Init(Command::OPSYMR, (i), (j),   0, m+1);m++;}
+#define aSYMW(i, j)    {cmd[m].Init(Command::OPSYMW, (i), (j),   0, m+1);m++;}
+#define aWRDW(i, j)    {cmd[m].Init(Command::OPWRDW, (i), (j),   0, m+1);m++;}
+#define aADDN(i, j, k) {cmd[m].Init(Command::OPADDN, (i), (j), (k), m+1);m++;}
+#define aMULT(i, j, k) {cmd[m].Init(Command::OPMULT, (i), (j), (k), m+1);m++;}
+#define aRTRN(i, j)    {cmd[m].Init(Command::OPRTRN, (i), (j),   0,   0);m++;}
+#define aBCPY(i, j, k) {cmd[m].Init(Command::OPBCPY, (i), (j), (k), m+1);m++;}
+#define aSFIL(i, j, k) {cmd[m].Init(Command::OPSFIL, (i), (j), (k), m+1);m++;}
+#define aBCMP(i, j, k) {cmd[m].Init(Command::OPBCMP, (i), (j), (k), m+1);m++;}
+#define aJMPZ(i, j, t) {cmd[m].Init(Command::OPJMPZ, (i), (j), Command::CMDIDX2OFF(t), m+1);m++;}
+#define aJMNZ(i, j, t) {cmd[m].Init(Command::OPJMNZ, (i), (j), Command::CMDIDX2OFF(t), m+1);m++;}
+#define aJMLT(i, j, t) {cmd[m].Init(Command::OPJMLT, (i), (j), Command::CMDIDX2OFF(t), m+1);m++;}
+#define aCALL(t)       {cmd[m].Init(Command::OPCALL,   0,   0, Command::CMDIDX2OFF(t), m+1);m++;}
+#define aRETN()        {cmd[m].Init(Command::OPRETN,   0,   0,   0,   0);m++;}
+unsigned BitDeviceMachine::writeBootstrap(Command* cmd)
 {
     unsigned m = 0;
     // HALT is always the 0th command
@@ -102,6 +131,31 @@ unsigned BitDeviceMachine::turingBootstrap()
     return (m);
 }
 
+// Write the bootstrap into the command table -- unless the machine
+//   shares the global one, which is already there
+unsigned BitDeviceMachine::turingBootstrap()
+{
+    if(shareBoot && bd.SegmentCount()) return bootstrapSegment()->Len()/sizeof(Command);
+    return writeBootstrap(cmdW(0));
+}
+
+// The bootstrap every machine laid out with ShareBootstrap(true) shares.
+//   Built on first use and never written (or freed) after that
+Segment* BitDeviceMachine::bootstrapSegment()
+{
+    static Segment* boot = 0;
+    static std::once_flag once;
+    std::call_once(once, []()
+    {
+	uchar    buf[64*sizeof(Command)];
+	unsigned n = writeBootstrap((Command*)buf);
+	assert(n <= 64);
+	boot = new Segment(MT_HEADERSZ, n*sizeof(Command), 0, 0);
+	boot->Put(buf, MT_HEADERSZ, n*sizeof(Command));
+    });
+    return boot;
+}
+
 // A bd Tape looks like this:
 //      z     |       p        |   <cmd 0> <cmd 1>...<cmd n-1>
 // unsigned       unsigned           a list of n cmds
@@ -153,8 +207,9 @@ void BitDeviceMachine::computeAddresses2()
 }
 
 // Returns size in bytes of a machine with cmdCnt commands and
-//   a working tape of tapeLen symbols
-unsigned BitDeviceMachine::machineSize(unsigned stateCnt, unsigned tapeSize)
+//   tapeCnt working tapes of tapeLen symbols
+unsigned BitDeviceMachine::machineSize(unsigned stateCnt, unsigned tapeSize,
+				       unsigned tapeCnt, unsigned width)
 {
     // Well formed machine size is complicated by
     //   two things:
@@ -165,20 +220,19 @@ unsigned BitDeviceMachine::machineSize(unsigned stateCnt, unsigned tapeSize)
     //         two bits long and sizeof(WorkingTape) includes
     //         one byte (4 symbols). A tape with tapeSize
     //         symbols takes up 2*tapeSize/8 bytes - the
-    //         one byte in the WorkingTape struct
+    //         one byte in the WorkingTape struct (width*tapeSize/8
+    //         rounded up to words for other widths)
     return (sizeof(BitDeviceMachine::MachineTape) +
 	       (stateCnt-1)*sizeof(BitDeviceMachine::Command) +
 	    sizeof(BitDeviceMachine::RegTape) +
-	    sizeof(BitDeviceMachine::WorkingTape) +
-	       ((tapeSize*2)/8)-4);
+	    tapeCnt*(sizeof(BitDeviceMachine::WorkingTape) +
+		     WorkingTape::bytesFor(tapeSize, width)-4));
 }
 
 bool BitDeviceMachine::Valid() const
 {
     // Start with this: we have to have a tape and three parts
-    unsigned buflen;
-    uchar* tape = bd.GetTape(buflen);
-    return ((tape != 0) && (a != 0) && (b != 0) && (c != 0));
+    return (bd.Valid() && (a != 0) && (b != 0) && (c != 0));
 }
 
 bool BitDeviceMachine::WellFormed() const
@@ -269,17 +323,16 @@ void BitDeviceMachine::InitToSub1()
     //        0	        Write ‘0’    Move tape right   8
     //        1	        Write ‘0’    Move tape left    1
     //        2	        Write ‘2’    Move tape left    0
-    TMState* swiz = (TMState*)a->cmd; //Cast cmd list as state table
     int b = cmdidx; // cmdidx where TuringMachine starts
-    swiz[cmdidx].Init(0, 1, 2,  0,  0,  0,   0,   0,   0);cmdidx++; 
-    swiz[cmdidx].Init(0, 1, 2, -1, -1, -1, b+1, b+1, b+2);cmdidx++;
-    swiz[cmdidx].Init(0, 1, 2, -1, -1, +1, b+2, b+2, b+3);cmdidx++;	
-    swiz[cmdidx].Init(0, 0, 2, +1, +1, -1, b+3, b+4, b+5);cmdidx++;
-    swiz[cmdidx].Init(0, 1, 2, +1, +1, +1, b+4, b+4, b+8);cmdidx++;
-    swiz[cmdidx].Init(0, 1, 2, -1, -1, +1, b+5, b+5, b+6);cmdidx++;
-    swiz[cmdidx].Init(2, 1, 2, +1, +1, +1, b+6, b+6, b+7);cmdidx++;
-    swiz[cmdidx].Init(2, 1, 2, +1, +1, -1, b+7, b+7,   0);cmdidx++;
-    swiz[cmdidx].Init(0, 0, 2, +1, -1, -1, b+8, b+1,   0);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2,  0,  0,  0,   0,   0,   0);cmdidx++; 
+    stateW(cmdidx)->Init(0, 1, 2, -1, -1, -1, b+1, b+1, b+2);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, -1, -1, +1, b+2, b+2, b+3);cmdidx++;	
+    stateW(cmdidx)->Init(0, 0, 2, +1, +1, -1, b+3, b+4, b+5);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, +1, +1, +1, b+4, b+4, b+8);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, -1, -1, +1, b+5, b+5, b+6);cmdidx++;
+    stateW(cmdidx)->Init(2, 1, 2, +1, +1, +1, b+6, b+6, b+7);cmdidx++;
+    stateW(cmdidx)->Init(2, 1, 2, +1, +1, -1, b+7, b+7,   0);cmdidx++;
+    stateW(cmdidx)->Init(0, 0, 2, +1, -1, -1, b+8, b+1,   0);cmdidx++;
     
     // The larger number has to be placed to the left of the smaller number
     //    with a blank symbol in between,
@@ -325,12 +378,11 @@ void BitDeviceMachine::InitToAdd1()
     //               0            Write ‘0’            Move tape left      State 3
     //               1            Write ‘1’            Move tape left      State 3
     //               Blank        Write ‘Blank’        Move tape right     State 0
-    TMState* swiz = (TMState*)a->cmd; //Cast cmd list as state table
     int b = cmdidx; // cmdidx where TuringMachine starts
-    swiz[cmdidx].Init(0, 0, 0,  0,  0,  0,   0,   0,   0);cmdidx++;
-    swiz[cmdidx].Init(0, 1, 2, -1, -1, +1, b+1, b+1, b+2);cmdidx++;
-    swiz[cmdidx].Init(1, 0, 1, +1, +1, -1, b+3, b+2, b+3);cmdidx++;
-    swiz[cmdidx].Init(0, 1, 2, -1, -1, +1, b+3, b+3,   0);cmdidx++;
+    stateW(cmdidx)->Init(0, 0, 0,  0,  0,  0,   0,   0,   0);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, -1, -1, +1, b+1, b+1, b+2);cmdidx++;
+    stateW(cmdidx)->Init(1, 0, 1, +1, +1, -1, b+3, b+2, b+3);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, -1, -1, +1, b+3, b+3,   0);cmdidx++;
     
     // Put "1" beginning at positon 4 on the tape
     //   and proceeing toward 0. Put the head at 4
@@ -361,7 +413,7 @@ void BitDeviceMachine::InitToBB3()
     // TuringBootstrap(including HALT at 0) + 4 TuringStates
     unsigned cmdCount = 33+4;
     unsigned tapeSize   = 80; // Size in symbols
-    Init(cmdCount, tapeSize);
+    Init(cmdCount, tapeSize, 1, false); // Only 1s and blanks
 
     // Write the bootstrap into the command table: cmdidx is index of next command
     unsigned cmdidx = turingBootstrap();
@@ -383,12 +435,11 @@ void BitDeviceMachine::InitToBB3()
     //           0	        ‘Blank’	 None	1
     //           1	        ‘1’	 Right	1
     //         Blank	        ‘1’	 Right	3
-    TMState* swiz = (TMState*)a->cmd; //Cast cmd list as state table
     int b = cmdidx; // cmdidx where TuringMachine starts
-    swiz[cmdidx].Init(0, 1, 2, 0,  0,  0,   0,   0,   0);cmdidx++;
-    swiz[cmdidx].Init(2, 1, 1, 0,  0, -1, b+1,   0, b+2);cmdidx++;
-    swiz[cmdidx].Init(2, 1, 2, 0, -1, -1, b+1, b+2, b+3);cmdidx++;
-    swiz[cmdidx].Init(2, 1, 1, 0, +1, +1, b+1, b+1, b+3);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, 0,  0,  0,   0,   0,   0);cmdidx++;
+    stateW(cmdidx)->Init(2, 1, 1, 0,  0, -1, b+1,   0, b+2);cmdidx++;
+    stateW(cmdidx)->Init(2, 1, 2, 0, -1, -1, b+1, b+2, b+3);cmdidx++;
+    stateW(cmdidx)->Init(2, 1, 1, 0, +1, +1, b+1, b+1, b+3);cmdidx++;
     
     // Start with blank tape with the head at 10
     c->initTape(" ", 4, 10);
@@ -398,6 +449,45 @@ void BitDeviceMachine::InitToBB3()
 }
 
 
+// The null state at b stands for halt, as in the machines above
+unsigned BitDeviceMachine::InitToStates(unsigned n, unsigned tapeSize)
+{
+    assert(n > 0 && tapeSize > 0);
+    Init(33+n, tapeSize);
+    unsigned b = turingBootstrap();
+    for(unsigned i=0; i<=n; i++)
+	stateW(b+i)->Init(0, 1, 2, 0, 0, 0, 0, 0, 0);
+    c->initTape(" ", 0, tapeSize/2);
+    SetCurrentCommand(b+1);
+    return b+1;
+}
+
+// A program of commands alone: CALL a routine that counts reg0 down,
+//   CALLing itself until it reaches 0, and RETN all the way back out.
+//   Then halt, or RETN once more than was CALLed
+void BitDeviceMachine::InitToCalls(unsigned depth, bool overReturn)
+{
+    Init(10, 16);
+    c->clear();
+    c->setHead(0);
+    Command* cmd = cmdW(0);
+    unsigned m = 0;
+    aHALT();              // 0
+    aLOAD(depth, 0);      // 1: calls to go/reg0
+    aLOAD(0, 1);          // 2: 0/reg1
+    aLOAD(-1, 2);         // 3: -1/reg2
+    aCALL(6);             // 4
+    if(overReturn)        // 5: one return too many, or go to halt
+	aRETN()
+    else
+	aJMPZ(1, 1, 0)
+    aJMPZ(0, 1, 9);       // 6: done counting?
+    aADDN(0, 2, 0);       // 7: reg0 = reg0-1
+    aCALL(6);             // 8
+    aRETN();              // 9
+    SetCurrentCommand(1);
+}
+
 //4-State Busy Beaver
 //For a 4-state busybeaver, the maximum number
 // of ‘1’s that can be printed is 13, and it takes 107 steps.
@@ -407,7 +497,7 @@ void BitDeviceMachine::InitToBB4()
     // TuringBootstrap(including HALT at 0) + 5 TuringStates
     unsigned cmdCount = 33+5;
     unsigned tapeSize = 80; // Size in symbols
-    Init(cmdCount, tapeSize);
+    Init(cmdCount, tapeSize, 1, false); // Only 1s and blanks
 
     // Write the bootstrap into the command table: cmdidx is index of next command
     unsigned cmdidx = turingBootstrap();
@@ -431,13 +521,12 @@ void BitDeviceMachine::InitToBB4()
     //        0	        ‘Blank’	None	1
     //        1	        ‘Blank’	right	1
     //       Blank	‘1’	right	4
-    TMState* swiz = (TMState*)a->cmd; //Cast cmd list as state table
     int b = cmdidx; // cmdidx where TuringMachine starts
-    swiz[cmdidx].Init(0, 1, 2, 0,  0,  0,   0,   0,   0);cmdidx++;
-    swiz[cmdidx].Init(2, 1, 1, 0, -1, +1, b+1, b+2, b+2);cmdidx++;
-    swiz[cmdidx].Init(2, 2, 1, 0, -1, -1, b+1, b+3, b+1);cmdidx++;
-    swiz[cmdidx].Init(2, 1, 1, 0, -1, +1, b+1, b+4,   0);cmdidx++;
-    swiz[cmdidx].Init(2, 2, 1, 0, +1, +1, b+1, b+1, b+4);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, 0,  0,  0,   0,   0,   0);cmdidx++;
+    stateW(cmdidx)->Init(2, 1, 1, 0, -1, +1, b+1, b+2, b+2);cmdidx++;
+    stateW(cmdidx)->Init(2, 2, 1, 0, -1, -1, b+1, b+3, b+1);cmdidx++;
+    stateW(cmdidx)->Init(2, 1, 1, 0, -1, +1, b+1, b+4,   0);cmdidx++;
+    stateW(cmdidx)->Init(2, 2, 1, 0, +1, +1, b+1, b+1, b+4);cmdidx++;
     
     // Start with blank tape with the head at 10 
     c->initTape(" ", 4, 10);
@@ -493,16 +582,15 @@ void BitDeviceMachine::InitToPAL()
     //        0	  Blank  right	 7
     //        1	  Blank  right	 7
     //      Blank  ‘0’	 None	 0
-    TMState* swiz = (TMState*)a->cmd; //Cast cmd list as state table
     int b = cmdidx; // cmdidx where TuringMachine starts
-    swiz[cmdidx].Init(0, 1, 2,  0,  0,  0,   0,   0,   0);cmdidx++;
-    swiz[cmdidx].Init(0, 1, 2, -1, -1, +1, b+1, b+1, b+2);cmdidx++;
-    swiz[cmdidx].Init(2, 2, 1, +1, +1,  0, b+3, b+5,   0);cmdidx++;
-    swiz[cmdidx].Init(0, 1, 2, +1, +1, -1, b+3, b+3, b+4);cmdidx++;
-    swiz[cmdidx].Init(2, 1, 2, -1,  0,  0, b+1, b+7, b+1);cmdidx++;
-    swiz[cmdidx].Init(0, 1, 2, +1, +1, -1, b+1, b+1, b+4);cmdidx++;
-    swiz[cmdidx].Init(0, 2, 2,  0, -1,  0, b+7, b+1, b+1);cmdidx++;
-    swiz[cmdidx].Init(2, 2, 0, -1, -1,  0, b+7, b+7, b+0);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2,  0,  0,  0,   0,   0,   0);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, -1, -1, +1, b+1, b+1, b+2);cmdidx++;
+    stateW(cmdidx)->Init(2, 2, 1, +1, +1,  0, b+3, b+5,   0);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, +1, +1, -1, b+3, b+3, b+4);cmdidx++;
+    stateW(cmdidx)->Init(2, 1, 2, -1,  0,  0, b+1, b+7, b+1);cmdidx++;
+    stateW(cmdidx)->Init(0, 1, 2, +1, +1, -1, b+1, b+1, b+4);cmdidx++;
+    stateW(cmdidx)->Init(0, 2, 2,  0, -1,  0, b+7, b+1, b+1);cmdidx++;
+    stateW(cmdidx)->Init(2, 2, 0, -1, -1,  0, b+7, b+7, b+0);cmdidx++;
     
     // Start with legal palindrome between 20-10 the head at 15 
     c->initTape("1111111111 ", 20, 15);
@@ -511,31 +599,269 @@ void BitDeviceMachine::InitToPAL()
     SetCurrentCommand(b+1);
 }
 
+//Two-Tape Palindrome Detector
+// Copies the string to the second tape, rewinds the first and compares
+//   them in opposite directions: O(n) steps against O(n^2) on one tape.
+//   Writes a '1' after the string if it's a palindrome and a '0' if not
+void BitDeviceMachine::InitTo2PAL()
+{
+    // Make a 33+4*4-cmd machine with two 80 symbol tapes
+    // TuringBootstrap(including HALT at 0) + 4 two-tape states
+    unsigned sl       = MTState::Slots(2);
+    unsigned cmdCount = 33+4*sl;
+    unsigned tapeSize = 80; // Size in symbols
+    Init(cmdCount, tapeSize, 2);
+
+    // Write the bootstrap into the command table: cmdidx is index of next command
+    unsigned cmdidx = turingBootstrap();
+
+    //Initialize the StateTable ('*' reads any symbol/writes back what
+    //  was read, moves are per tape, anything else halts)
+    //State	Read    Write   Move    Next State
+    //State 1 (copy to tape 1)
+    //        0*       00      RR      1
+    //        1*       11      RR      1
+    //        *         **     LL      2
+    //State 2 (rewind tape 0)
+    //        0*       **      LN      2
+    //        1*       **      LN      2
+    //        *         **     RN      3
+    //State 3 (compare)
+    //        00       **      RL      3
+    //        11       **      RL      3
+    //        01       **      NN      4
+    //        10       **      NN      4
+    //                 1*      NN      0
+    //State 4 (not a palindrome -- find the end of the string)
+    //        0*       **      RN      4
+    //        1*       **      RN      4
+    //        *        0*      NN      0
+    unsigned s1 = cmdidx, s2 = s1+sl, s3 = s2+sl, s4 = s3+sl;
+    MTState* s;
+    s = mtStateW(s1); s->Init(2);
+    s->Set("0*", "00", "RR", s1);
+    s->Set("1*", "11", "RR", s1);
+    s->Set(" *", "**", "LL", s2);
+    s = mtStateW(s2); s->Init(2);
+    s->Set("0*", "**", "LN", s2);
+    s->Set("1*", "**", "LN", s2);
+    s->Set(" *", "**", "RN", s3);
+    s = mtStateW(s3); s->Init(2);
+    s->Set("00", "**", "RL", s3);
+    s->Set("11", "**", "RL", s3);
+    s->Set("01", "**", "NN", s4);
+    s->Set("10", "**", "NN", s4);
+    s->Set("  ", "1*", "NN",  0);
+    s = mtStateW(s4); s->Init(2);
+    s->Set("0*", "**", "RN", s4);
+    s->Set("1*", "**", "RN", s4);
+    s->Set(" *", "0*", "NN",  0);
+
+    // Start with a palindrome at 20-28 and the head on its first symbol
+    c->clear();
+    c->load(20, "110010011", 9);
+    c->setHead(20);
+    ct[1]->setHead(20);
+
+    //Start in state 1
+    SetCurrentCommand(s1);
+}
+
+//Two-Tape Binary Adder
+// Adds the number on tape 1 to the number on tape 0, both written most
+//   significant digit first and ending at the same position, with the
+//   heads on their last digits. Walks both leftwards once with the carry
+//   in the state: O(n) steps. The sum replaces the number on tape 0
+void BitDeviceMachine::InitTo2Add()
+{
+    // Make a 33+2*4-cmd machine with two 80 symbol tapes
+    // TuringBootstrap(including HALT at 0) + 2 two-tape states
+    unsigned sl       = MTState::Slots(2);
+    unsigned cmdCount = 33+2*sl;
+    unsigned tapeSize = 80; // Size in symbols
+    Init(cmdCount, tapeSize, 2);
 
-void BitDeviceMachine::Init(unsigned cmdCount, unsigned tapeSize)
+    // Write the bootstrap into the command table: cmdidx is index of next command
+    unsigned cmdidx = turingBootstrap();
+
+    // State c adds the digits read and carry c (blank reads as 0), writes
+    //   the digit of the sum on tape 0 and goes left to the state for the
+    //   carry out. Two blanks end it (after writing any carry)
+    const char sc[3] = {'0', '1', ' '};
+    unsigned carry[2] = {cmdidx, cmdidx+sl};
+    for(unsigned cin=0; cin<2; cin++)
+    {
+	MTState* s = mtStateW(carry[cin]);
+	s->Init(2);
+	for(uchar x0=0; x0<3; x0++)
+	    for(uchar x1=0; x1<3; x1++)
+	    {
+		char read[3] = {sc[x0], sc[x1], 0};
+		if(x0 == 2 && x1 == 2)
+		{
+		    s->Set(read, cin ? "1*" : "**", "NN", 0);
+		    continue;
+		}
+		unsigned sum = (x0 == 1) + (x1 == 1) + cin;
+		char write[3] = {sc[sum%2], '*', 0};
+		s->Set(read, write, "LL", carry[sum/2]);
+	    }
+    }
+
+    // 91 (1011011) at 10-16 plus 57 (111001) at 11-16 -- sum at 9-16
+    c->clear();
+    c->load(10, "1011011", 7);
+    c->setHead(16);
+    ct[1]->load(11, "111001", 6);
+    ct[1]->setHead(16);
+
+    //Start with no carry
+    SetCurrentCommand(carry[0]);
+}
+
+
+void BitDeviceMachine::Init(unsigned cmdCount, unsigned tapeSize,
+			    unsigned tapeCount, bool zeros)
 {
+    assert(tapeCount >= 1 && tapeCount <= MAXTAPES);
+    unsigned w = (zeros && symWidth == 1 ? 2 : symWidth);
+    if((shareBoot || sparse) && tapeCount == 1)
+    {
+	initSegmented(cmdCount, tapeSize, w);
+	return;
+    }
+
     // Make a stateCount-state test machine
     //   with a tapeLen symbol / 2*tapelen bit / 2*tapelen/8 byte tape
     //   TODO::: HACKALERT -- sticking size of MachineTape in first byte
     //                        so BitDevice can find the registers
-    unsigned buflen     = machineSize(cmdCount, tapeSize);
-    uchar*   tape       = new uchar[buflen];
+    unsigned buflen     = machineSize(cmdCount, tapeSize, tapeCount, w);
+    uchar*   tape       = alloc->Alloc(buflen);
     *(unsigned*)tape    = (cmdCount*sizeof(BitDeviceMachine::Command)+8)/4;
     reset(tape, buflen, true);
     tape = bd.GetTape(buflen);
     
     // Overlay the three accessor parts and set lengths for MachineTape and WorkingTape
+    //   (the registers start out 0 -- an empty return stack)
     a = (MachineTape*)tape;
     a->setNumberOfCommands(cmdCount);
     b = (RegTape*)(tape + a->Len());
+    memset((void*)b, 0, b->Len());
     c = (WorkingTape*)(tape + a->Len() + b->Len());
-    unsigned tlen1 = buflen - a->Len() - b->Len() - MT_HEADERSZ;
-    unsigned tlen2 = buflen - ((uchar*)(&c->T)-(uchar*)a);
+    unsigned tlen1 = (buflen - a->Len() - b->Len())/tapeCount - MT_HEADERSZ;
+    unsigned tlen2 = (buflen - ((uchar*)(&c->T)-(uchar*)a) -
+		      (tapeCount-1)*(MT_HEADERSZ+tlen1));
     assert(tlen1 == tlen2);
-    assert(SYMPERBYTE*tlen1 == tapeSize);
-    c->setTapeLen(tapeSize);
+    assert(tlen1 == WorkingTape::bytesFor(tapeSize, w));
+
+    // Each tape follows the last -- the others start out blank
+    WorkingTape* t = c;
+    for(unsigned i=0; i<tapeCount; i++)
+    {
+	t->setTapeLen(tapeSize, w);
+	if(i > 0)
+	{
+	    t->clear();
+	    t->setHead(0);
+	}
+	t = (WorkingTape*)((uchar*)t + t->Len());
+    }
+    overlayTapes();
+    assert(tapes == tapeCount);
+}
+
+// Lay out an empty machine on segments, with or without the global
+//   bootstrap:
+//
+//   MachineTape header | [bootstrap |] commands | registers |
+//                                 WorkingTape header | symbols
+//
+//   Only the header, commands, registers and symbols are the machine's
+//   own. The symbols start out blank without a single page allocated
+void BitDeviceMachine::initSegmented(unsigned cmdCount, unsigned tapeSize,
+				     unsigned w)
+{
+    unsigned aLen = MT_HEADERSZ + cmdCount*sizeof(Command);
+    unsigned bLen = sizeof(RegTape);
+    unsigned cA   = aLen + bLen;
+    unsigned tLen = WorkingTape::bytesFor(tapeSize, w);
+
+    Segment** s = new Segment*[6];
+    unsigned  n = 0;
+    s[n++] = new Segment(0, MT_HEADERSZ, 0, 0);
+    if(shareBoot)
+    {
+	Segment* boot = bootstrapSegment();
+	assert(boot->End() < aLen);
+	s[n++] = boot->Fork();
+    }
+    s[n] = new Segment(s[n-1]->End(), aLen-s[n-1]->End(), 0, 0); n++;
+    s[n++] = new Segment(aLen, bLen, 0, 0);
+    s[n++] = new Segment(cA, MT_HEADERSZ, 0, 0, sizeof(Segment*));
+    s[n++] = new Segment(cA+MT_HEADERSZ, tLen, Segment::MAXPAGESHIFT,
+			 TapeKernels::BlankByte(w));
+
+    MachineTape* na = (MachineTape*)s[0]->WriteA(0);
+    na->setNumberOfCommands(cmdCount);
+    na->p = 0;
+    WorkingTape* nc = (WorkingTape*)s[n-2]->WriteA(cA);
+    nc->setTapeLen(tapeSize, w);
+    nc->z |= WorkingTape::PAGED;
+    nc->h  = nc->IND2OFF(0);
+    *(Segment**)s[n-2]->Extra() = s[n-1];
+
+    dropSnapshot();
+    bd.LoadSegments(s, n);
+    unmap();
+    zhashOk = false;
+    a = (MachineTape*)bd.WriteA(0);
+    b = (RegTape*)    bd.WriteA(aLen);
+    c = (WorkingTape*)bd.WriteA(cA);
+    overlayTapes();
+    assert(c->tapeBytes() == tLen && c->tapeLen() >= tapeSize);
+}
+
+// Find the working tapes: on a flat tape they follow c to the end
+void BitDeviceMachine::overlayTapes()
+{
+    unsigned buflen;
+    uchar*   tape = bd.GetTape(buflen);
+    tapes = 0;
+    ct[tapes++] = c;
+    if(!tape) return;
+
+    unsigned o = (uchar*)c - tape + c->Len();
+    while(o < buflen)
+    {
+	assert(tapes < MAXTAPES);
+	ct[tapes] = (WorkingTape*)(tape+o);
+	o += ct[tapes++]->Len();
+    }
+    assert(o == buflen);
 }
 
+// Lay out machines made by Init (and InitTo*) with a shared bootstrap
+void BitDeviceMachine::ShareBootstrap(bool share)
+{shareBoot = share;}
+
+// Lay out machines made by Init (and InitTo*) with sparse symbols
+void BitDeviceMachine::SparseTape(bool sp)
+{sparse = sp;}
+
+// Lay out machines made by Init (and InitTo*) with w-bit symbols
+void BitDeviceMachine::SymbolWidth(unsigned w)
+{
+    assert(w == 1 || w == 2 || w == 4 || w == 8);
+    symWidth = w;
+}
+
+// Take the buffers of machines made from now on from al
+void BitDeviceMachine::MapFiles(bool map, bool shared)
+{mapFiles = map; mapShared = shared;}
+
+void BitDeviceMachine::SetAllocator(Allocator* al)
+{alloc = (al ? al : Allocator::Heap());}
+
 // Init to already created buffer -- if delTape is true, delete on destruction
 void BitDeviceMachine::InitToBuf(uchar* buf, unsigned buflen, bool delTape)
 {
@@ -549,34 +875,228 @@ void BitDeviceMachine::InitToBuf(uchar* buf, unsigned buflen, bool delTape)
     a = (MachineTape*)tape;
     b = (RegTape*)(tape + a->Len());
     c = (WorkingTape*)(tape + a->Len() + b->Len());
-    assert(buflen == a->Len() + b->Len() + c->Len());
+    overlayTapes();
+}
+
+// Index of the first Turing state (single or multi-tape)
+unsigned BitDeviceMachine::firstState() const
+{
+    unsigned n = a->getNumberOfCommands();
+    for(unsigned i=0; i<n; i++)
+	if(cmdA(i)->OpCode() == Command::OPTMST ||
+	   cmdA(i)->OpCode() == Command::OPTMMT)
+	    return i;
+    return n;
+}
+
+// Segments holding a copy of the flat machine, laid out as:
+//
+//   MachineTape header | commands | registers | WorkingTape header | symbols
+//
+//   The headers and registers are small and every fork copies them. The
+//   commands are one page and the symbols are in pages of their own, all
+//   shared copy-on-write. Only pages of symbols with something on them
+//   are made resident
+Segment** BitDeviceMachine::flatSegments() const
+{
+    assert(Valid() && bd.SegmentCount() == 0 && tapes == 1);
+    unsigned aLen = a->Len();
+    unsigned cA   = aLen + b->Len();
+    unsigned tA   = cA + MT_HEADERSZ;
+    unsigned tLen = c->tapeBytes();
+    uchar    bb   = TapeKernels::BlankByte(c->width());
+    unsigned buflen;
+    const uchar* tape = bd.GetTape(buflen);
+
+    Segment** s = new Segment*[SEGCNT];
+    s[0] = new Segment(0,    MT_HEADERSZ,      0, 0);
+    s[1] = new Segment(MT_HEADERSZ, aLen-MT_HEADERSZ, 0, 0);
+    s[2] = new Segment(aLen, b->Len(),         0, 0);
+    s[3] = new Segment(cA,   MT_HEADERSZ,      0, 0, sizeof(Segment*));
+    s[4] = new Segment(tA,   tLen, Segment::MAXPAGESHIFT, bb);
+    for(int i=0; i<4; i++)
+	s[i]->Put(tape+s[i]->Start(), s[i]->Start(), s[i]->Len());
+    for(unsigned o=0; o<tLen; o+=s[4]->PageLen())
+    {
+	unsigned k = (tLen-o < s[4]->PageLen() ? tLen-o : s[4]->PageLen());
+	for(unsigned i=0; i<k; i++)
+	    if(tape[tA+o+i] != bb)
+	    {
+		s[4]->Put(tape+tA+o, tA+o, k);
+		break;
+	    }
+    }
+
+    // The WorkingTape header points at its symbols
+    ((WorkingTape*)s[3]->WriteA(cA))->z |= WorkingTape::PAGED;
+    *(Segment**)s[3]->Extra() = s[4];
+    return s;
+}
+
+// Move the machine onto a segmented BitDevice -- costs a copy of the
+//   machine, once
+void BitDeviceMachine::segment()
+{
+    Segment** s    = flatSegments();
+    unsigned  aLen = a->Len();
+    unsigned  cA   = aLen + b->Len();
+    bd.LoadSegments(s, SEGCNT);
+    unmap();
+    a = (MachineTape*)bd.WriteA(0);
+    b = (RegTape*)    bd.WriteA(aLen);
+    c = (WorkingTape*)bd.WriteA(cA);
+    overlayTapes();
+}
+
+// A fork takes the settings for machines made from now on along
+void BitDeviceMachine::forkSettings(BitDeviceMachine* m) const
+{
+    m->shareBoot = shareBoot;
+    m->sparse    = sparse;
+    m->symWidth  = symWidth;
+    m->alloc     = alloc;
+    m->mapFiles  = mapFiles;
+    m->mapShared = mapShared;
+    m->stepLimit = stepLimit;
+}
+
+// Fork the machine -- a flat one stays as it is (a mapped file stays
+//   mapped) and the fork gets segments of its own
+BitDeviceMachine* BitDeviceMachine::Fork()
+{
+    assert(Valid());
+    BitDeviceMachine* m = new BitDeviceMachine;
+    forkSettings(m);
+    if(tapes > 1)
+    {
+	// Multi-tape machines stay flat -- copy the lot
+	unsigned buflen;
+	uchar*   tape = bd.GetTape(buflen);
+	uchar*   buf  = alloc->Alloc(buflen);
+	memcpy(buf, tape, buflen);
+	m->InitToBuf(buf, buflen, true);
+    }
+    else
+    {
+	unsigned  n = bd.SegmentCount();
+	Segment** s;
+	if(n == 0)
+	{
+	    s = flatSegments();
+	    n = SEGCNT;
+	}
+	else
+	{
+	    s = new Segment*[n];
+	    for(unsigned i=0; i<n; i++)
+		s[i] = bd.GetSegment(i)->Fork();
+	}
+
+	// Writing the headers gives the fork its own copies, so ours stay put
+	unsigned cA = a->Len() + b->Len();
+	m->bd.LoadSegments(s, n);
+	m->a = (MachineTape*)m->bd.WriteA(0);
+	m->b = (RegTape*)    m->bd.WriteA(a->Len());
+	m->c = (WorkingTape*)m->bd.WriteA(cA);
+	*(Segment**)m->c->T = m->bd.FindSegment(cA+MT_HEADERSZ);
+	m->overlayTapes();
+    }
+    m->zhash   = zhash;
+    m->zhashOk = zhashOk;
+    return m;
 }
 
 // Test for halt condition 
 bool BitDeviceMachine::Halted()
 {assert(Valid()); return (GetCurrentCommand() == 0);}
+bool BitDeviceMachine::Faulted()
+{assert(Valid()); return (Halted() && b->getReg(RSPREG) == RSTACKERR);}
 
 // Read/Write symbol under the head
 uchar BitDeviceMachine::Read() const
 {assert(Valid()); return c->Read();}
 void BitDeviceMachine::Write(uchar x)
-{assert(Valid()); assert(x == 0 || x == 1 || x ==2); return c->Write(x);}
+{
+    assert(Valid()); assert(x == 0 || x == 1 || x ==2 || c->width() > 2);
+    uchar was = c->Read();
+    c->Write(x);
+    if(zhashOk) hashStep(0, c->getHead(), was);
+}
 
 //Returns length of tape in symbols
 unsigned BitDeviceMachine::Tapelen()
 {assert(Valid()); return c->tapeLen();}
+unsigned BitDeviceMachine::Width() const
+{assert(Valid()); return c->width();}
+
+// Bytes held by the buffer or by the segments' pages
+unsigned long BitDeviceMachine::Resident() const
+{
+    assert(Valid());
+    unsigned n = bd.SegmentCount();
+    if(n == 0)
+    {
+	unsigned buflen;
+	bd.GetTape(buflen);
+	return buflen;
+    }
+    unsigned long r = 0;
+    for(unsigned i=0; i<n; i++)
+	r += bd.GetSegment(i)->Resident();
+    return r;
+}
 
 // Set/Get head in symbols
 void BitDeviceMachine::SetHead(unsigned np)
-{assert(Valid()); assert(np < Tapelen()); c->setHead(np);}
+{
+    assert(Valid()); assert(np < Tapelen());
+    if(zhashOk) zhash ^= headKey(0, c->getHead()) ^ headKey(0, np);
+    c->setHead(np);
+}
 unsigned BitDeviceMachine::GetHead() const
 {assert(Valid());return (c->getHead());}
 
+// Working tapes -- tape 0 is c
+unsigned BitDeviceMachine::TapeCount() const
+{assert(Valid()); return tapes;}
+uchar BitDeviceMachine::Read(unsigned t) const
+{assert(Valid()); assert(t < tapes); return ct[t]->Read();}
+unsigned BitDeviceMachine::GetHead(unsigned t) const
+{assert(Valid()); assert(t < tapes); return ct[t]->getHead();}
+unsigned BitDeviceMachine::Tapelen(unsigned t) const
+{assert(Valid()); assert(t < tapes); return ct[t]->tapeLen();}
+uchar BitDeviceMachine::ReadAt(unsigned t, unsigned pos) const
+{assert(Valid()); assert(t < tapes && pos < ct[t]->tapeLen()); return ct[t]->value(pos);}
+
 // Set/Get the current command
 unsigned BitDeviceMachine::GetCurrentCommand() const
 {assert(Valid()); return a->getCurrentCommand();}
 void BitDeviceMachine::SetCurrentCommand(unsigned nc)
-{assert(Valid()); a->setCurrentCommand(nc);}
+{
+    assert(Valid());
+    unsigned op = a->p;
+    a->setCurrentCommand(nc);
+    if(zhashOk) zhash ^= stateKey(op) ^ stateKey(a->p);
+}
+
+// Number of commands in the command table
+unsigned BitDeviceMachine::CommandCount() const
+{assert(Valid()); return a->getNumberOfCommands();}
+
+// Symbol written, direction moved and next command of TMState idx
+//   on reading x
+bool BitDeviceMachine::Transition(unsigned idx, uchar x,
+				  uchar &sym, int &dir, unsigned &nxt) const
+{
+    assert(Valid());
+    assert(idx < a->getNumberOfCommands() && x < 3);
+    if(cmdA(idx)->OpCode() != Command::OPTMST) return false;
+    TMState* s = (TMState*)cmdA(idx);
+    sym = s->Sym(x);
+    dir = s->Dird(x);
+    nxt = s->Nxts(x);
+    return true;
+}
 
 // Execute a single opCode - returns true if command is "printable"
 // TODO: Revisit "printable" hack
@@ -587,62 +1107,111 @@ bool BitDeviceMachine::execOpCode(int opcode, int arg1, int arg2, int arg3)
     {
     case Command::OPCLRR:    // Clear registers
     {
-	fprintf(DBGFILE, "CLRR(%d, %d)\n", arg1, arg2);
+	DBGPRINTF("CLRR(%d, %d)\n", arg1, arg2);
 	bd.CLRR();
 	break;
     }
     case Command::OPLOAD:   // Load the value c into the register r
     {
-	fprintf(DBGFILE, "LOAD(%d, %d)\n", arg1, arg2);
+	DBGPRINTF("LOAD(%d, %d)\n", arg1, arg2);
 	bd.LOAD(arg1, arg2);
 	break;
     }
     case Command::OPWRDR:     // Copy 32 bits from tape@p into register r 
     {
-	fprintf(DBGFILE, "WRDR(%d, %d)\n", arg1, arg2);
+	DBGPRINTF("WRDR(%d, %d)\n", arg1, arg2);
 	bd.WRDR(arg1, arg2);
 	break;
     }
     case Command::OPSYMR:     // Copy 2 bits from tape@p p into register r 
     {
-	fprintf(DBGFILE, "SYMR(%d, %d)\n", arg1, arg2);
+	DBGPRINTF("SYMR(%d, %d)\n", arg1, arg2);
 	bd.SYMR(arg1, arg2);
 	break;
     }
     case Command::OPMULT:    // Multiply registers r1 and r2 and place result in r3 
     {
-	fprintf(DBGFILE, "MULT(%d, %d, %d)\n", arg1, arg2, arg3);
+	DBGPRINTF("MULT(%d, %d, %d)\n", arg1, arg2, arg3);
 	bd.MULT(arg1, arg2, arg3);
 	break;
     }
     case Command::OPADDN:     // Add registers r1 and r2 and place result in r3 
     {
-	fprintf(DBGFILE, "ADDN(%d, %d, %d)\n", arg1, arg2, arg3);
+	DBGPRINTF("ADDN(%d, %d, %d)\n", arg1, arg2, arg3);
 	bd.ADDN(arg1, arg2, arg3);
 	break;
     }
     case Command::OPSYMW:   // Copy the 2-bits@p1 to bits@p2) 
     {
-	fprintf(DBGFILE, "SYMW(%d, %d)\n", arg1, arg2);
+	DBGPRINTF("SYMW(%d, %d)\n", arg1, arg2);
 	bd.SYMW(arg1, arg2);
 	break;
     }
     case Command::OPWRDW:   // Copy 32-bit value v into @p2) 
     {
-	fprintf(DBGFILE, "WRDW(%d, %d)\n", arg1, arg2);
+	DBGPRINTF("WRDW(%d, %d)\n", arg1, arg2);
 	bd.WRDW(arg1, arg2);
 	break;
     }
+    case Command::OPBCPY:   // Copy a range of bits (ranges may overlap)
+    {
+	DBGPRINTF("BCPY(%d, %d, %d)\n", arg1, arg2, arg3);
+	bd.BCPY(arg1, arg2, arg3);
+	break;
+    }
+    case Command::OPSFIL:   // Fill a range with a symbol
+    {
+	DBGPRINTF("SFIL(%d, %d, %d)\n", arg1, arg2, arg3);
+	bd.SFIL(arg1, arg2, arg3);
+	break;
+    }
+    case Command::OPBCMP:   // Compare two ranges of bits
+    {
+	DBGPRINTF("BCMP(%d, %d, %d)\n", arg1, arg2, arg3);
+	bd.BCMP(arg1, arg2, arg3);
+	break;
+    }
+    case Command::OPJMPZ:   // Go to arg3 if registers r1 and r2 are equal
+    {
+	DBGPRINTF("JMPZ(%d, %d, %d)\n", arg1, arg2, arg3);
+	if(bd.COMP(arg1, arg2) == 0) bd.LOAD(arg3, 43);
+	break;
+    }
+    case Command::OPJMNZ:   // Go to arg3 if registers r1 and r2 differ
+    {
+	DBGPRINTF("JMNZ(%d, %d, %d)\n", arg1, arg2, arg3);
+	if(bd.COMP(arg1, arg2) != 0) bd.LOAD(arg3, 43);
+	break;
+    }
+    case Command::OPJMLT:   // Go to arg3 if register r1 is less than r2
+    {
+	DBGPRINTF("JMLT(%d, %d, %d)\n", arg1, arg2, arg3);
+	if(bd.COMP(arg1, arg2) < 0) bd.LOAD(arg3, 43);
+	break;
+    }
+    case Command::OPCALL:   // Push the next command and go to arg3
+    {
+	DBGPRINTF("CALL(%d)\n", arg3);
+	if(bd.PUSH(43)) bd.LOAD(arg3, 43);
+	else             stackFault();
+	break;
+    }
+    case Command::OPRETN:   // Go to the command on top of the return stack
+    {
+	DBGPRINTF("RETN()\n");
+	if(!bd.POPR(43)) stackFault();
+	break;
+    }
     case Command::OPHALT:    // OPCode indicates string has HALTED 
     {
-	fprintf(DBGFILE, "HALT()\n");
+	DBGPRINTF("HALT()\n");
 	return true;
     }
     case Command::OPRTRN:    // OPCode to prevent resetting cmd ptr
     {
-	fprintf(DBGFILE, "WRDW(%d, %d)\n", arg1, arg2);
+	DBGPRINTF("WRDW(%d, %d)\n", arg1, arg2);
 	bd.WRDW(arg1, arg2);
-	fprintf(DBGFILE, "RTRN()\n");
+	DBGPRINTF("RTRN()\n");
 	return false;
     }
     default:
@@ -656,6 +1225,16 @@ bool BitDeviceMachine::execOpCode(int opcode, int arg1, int arg2, int arg3)
     return false;    
 }
 
+// The bad CALL or RETN goes to the halt command rather than on, so the
+//   machine halts with the fault on its registers (a host process running
+//   it carries on)
+void BitDeviceMachine::stackFault()
+{
+    DBGPRINTF("stack fault\n");
+    bd.LOAD(RSTACKERR, RSPREG);
+    bd.LOAD(HALTCMDOFF, 43);
+}
+
 // Execute a single step
 bool BitDeviceMachine::ExecuteS()
 {
@@ -673,44 +1252,900 @@ bool BitDeviceMachine::ExecuteS()
 	// Test for halted. If halted, return
 	if (Halted()) return true;
 
+	// The bootstrap reads 2-bit symbols -- run other widths natively
+	if (c->width() != 2) return ExecuteT();
+
 	// Not halted? Call bootstrap
+	unsigned op = a->p;
 	bd.WRDR(31, 29);          // Write currentState to reg29
 	bd.LOAD(FIRSTCMDOFF, 49); // Use 49 to hold offset to 1st command in bootstrap)
 	bd.WRDW(49, 31);          // Make first command in the bootstrap current
+	if(zhashOk) zhash ^= stateKey(op) ^ stateKey(a->p);
 
 	return true;
     }
 
-    // If its not a turing state, get the other arguments and execute the opcode
+    // A multi-tape state is beyond the bootstrap -- run it natively
+    if(opCode == Command::OPTMMT)
+	return executeMT();
+
+    // If its not a turing state, get the other arguments and execute the
+    //   opcode (the hash follows what it writes if it can be told)
+    HashWatch w;
+    if(zhashOk && !watchStep(w)) zhashOk = false;
     computeAddresses2();
     int arg1 = reg[37]; 
     int arg2 = reg[39];
     int arg3 = reg[41];
-    return execOpCode(opCode, arg1, arg2, arg3);
+    bool ok = execOpCode(opCode, arg1, arg2, arg3);
+    if(zhashOk && !followStep(w)) zhashOk = false;
+    return ok;
+}
+
+// Whole bytes that hold the bits [bit, bit+len)
+static void byteRange(unsigned bit, unsigned len, unsigned &b, unsigned &n)
+{b = bit/bPB; n = (bit+len+bPB-1)/bPB - b;}
+
+// Bytes the next ExecuteS will write outside the registers -- p, and
+//   whatever the command writes on the tape
+unsigned BitDeviceMachine::writeSet(unsigned* wb, unsigned* wn, unsigned max)
+{
+    assert(Valid() && max >= 2*MAXTAPES+2);
+    unsigned k = 0;
+    byteRange(32, 32, wb[k], wn[k]); k++;
+
+    // A Turing state through the bootstrap only moves p, run natively it
+    //   writes the symbol under and the head of each tape it works
+    computeAddresses1();
+    int*     reg = getRegisters();
+    unsigned op  = reg[35];
+    if(op == Command::OPTMST || op == Command::OPTMMT)
+    {
+	if(op == Command::OPTMST && c->width() == 2) return k;
+	unsigned cnt = (op == Command::OPTMST ? 1 :
+			((MTState*)cmdA(GetCurrentCommand()))->Tapes());
+	unsigned o = a->Len()+b->Len();
+	for(unsigned t=0; t<cnt; t++)
+	{
+	    byteRange(o*bPB+32, 32, wb[k], wn[k]); k++;
+	    byteRange(o*bPB+ct[t]->h, ct[t]->width(), wb[k], wn[k]); k++;
+	    o += ct[t]->Len();
+	}
+	return k;
+    }
+
+    // Any other command: what it writes, then p through reg31 (unless
+    //   it halts or returns)
+    computeAddresses2();
+    int arg1 = reg[37];
+    int arg2 = reg[39];
+    int arg3 = reg[41];
+    int ap   = reg[31];
+    switch(op)
+    {
+    case Command::OPSYMW:
+	byteRange(reg[arg2], 2, wb[k], wn[k]); k++;
+	break;
+    case Command::OPWRDW:
+    case Command::OPRTRN:
+	byteRange(reg[arg2], 32, wb[k], wn[k]); k++;
+	break;
+    case Command::OPBCPY:
+	byteRange(reg[arg2], reg[arg3], wb[k], wn[k]); k++;
+	break;
+    case Command::OPSFIL:
+	byteRange(reg[arg2], 2*reg[arg3], wb[k], wn[k]); k++;
+	break;
+    case Command::OPCLRR:
+	ap = 0;
+	break;
+    case Command::OPLOAD:
+	if(arg2 == 31) ap = arg1;
+	break;
+    case Command::OPWRDR:
+    case Command::OPSYMR:
+	if(arg2 == 31) return max+1;
+	break;
+    case Command::OPMULT:
+    case Command::OPADDN:
+    case Command::OPBCMP:
+	if(arg3 == 31) return max+1;
+	break;
+    }
+    if(op != Command::OPHALT && op != Command::OPRTRN && ap != 32)
+    {
+	byteRange(ap, 32, wb[k], wn[k]);
+	k++;
+    }
+    return k;
+}
+
+// Byte address of the registers -- just past the command table
+unsigned BitDeviceMachine::regA() const
+{return a->Len();}
+
+// Return the current command as a TMState (0 if it isn't one)
+BitDeviceMachine::TMState* BitDeviceMachine::currentState() const
+{
+    unsigned idx = a->getCurrentCommand();
+    assert(idx < a->getNumberOfCommands());
+    if(cmdA(idx)->OpCode() != Command::OPTMST) return 0;
+    return (TMState*)cmdA(idx);
+}
+
+bool BitDeviceMachine::atState() const
+{
+    unsigned op = cmdA(a->getCurrentCommand())->OpCode();
+    return (op == Command::OPTMST || op == Command::OPTMMT);
+}
+
+bool BitDeviceMachine::leavesTape() const
+{
+    int d[MAXTAPES];
+    unsigned k = 1;
+    if(TMState* s = currentState())
+	d[0] = s->Dird(c->Read());
+    else if(atState())
+    {
+	MTState* s = (MTState*)cmdA(a->getCurrentCommand());
+	uchar x[MAXTAPES];
+	k = s->Tapes();
+	for(unsigned t=0; t<k; t++)
+	    x[t] = ct[t]->Read();
+	unsigned i = MTState::Index(k, s->Colors(), x);
+	for(unsigned t=0; t<k; t++)
+	    d[t] = s->Dird(i, t);
+    }
+    else
+	return false;
+    for(unsigned t=0; t<k; t++)
+    {
+	unsigned h = ct[t]->getHead();
+	if((d[t] < 0 && h == 0) || (d[t] > 0 && h+1 == ct[t]->tapeLen()))
+	    return true;
+    }
+    return false;
+}
+
+// Address of command idx for reading or writing -- commands are
+//   contiguous within a segment (the bootstrap and the states may be
+//   in different ones)
+BitDeviceMachine::Command* BitDeviceMachine::cmdA(unsigned idx) const
+{return (Command*)bd.ReadA(MT_HEADERSZ+idx*sizeof(Command));}
+BitDeviceMachine::Command* BitDeviceMachine::cmdW(unsigned idx)
+{return (Command*)bd.WriteA(MT_HEADERSZ+idx*sizeof(Command));}
+BitDeviceMachine::TMState* BitDeviceMachine::stateW(unsigned idx)
+{return (TMState*)cmdW(idx);}
+BitDeviceMachine::MTState* BitDeviceMachine::mtStateW(unsigned idx)
+{return (MTState*)cmdW(idx);}
+
+// Execute a single Turing transition directly -- the bootstrap does the
+//   same work in 32 BitDevice commands
+bool BitDeviceMachine::ExecuteT()
+{
+    assert(Valid());
+    TMState* s = currentState();
+    if(!s) return executeMT();
+
+    // Write, move and go to the next state for the symbol under the head
+    uchar    x  = c->Read();
+    unsigned hd = c->getHead();
+    c->Write(s->Sym(x));
+    c->Move(s->Dird(x));
+    b->setReg(29, a->p); // Executing state (as the bootstrap leaves it)
+    if(zhashOk)
+    {
+	hashStep(0, hd, x);
+	zhash ^= stateKey(a->p) ^ stateKey(s->Nxto(x));
+    }
+    a->p = s->Nxto(x);
+    return true;
+}
+
+// Execute a transition of a multi-tape state: read a symbol from each
+//   of its tapes, then write, move and go to the next command
+bool BitDeviceMachine::executeMT()
+{
+    unsigned idx = a->getCurrentCommand();
+    assert(idx < a->getNumberOfCommands());
+    if(cmdA(idx)->OpCode() != Command::OPTMMT) return false;
+    MTState* s = (MTState*)cmdA(idx);
+    unsigned k = s->Tapes();
+    assert(k <= tapes);
+
+    uchar x[MAXTAPES];
+    for(unsigned t=0; t<k; t++)
+	x[t] = ct[t]->Read();
+    unsigned i = MTState::Index(k, s->Colors(), x);
+    for(unsigned t=0; t<k; t++)
+    {
+	unsigned hd = ct[t]->getHead();
+	ct[t]->Write(s->Sym(i, t));
+	ct[t]->Move(s->Dird(i, t));
+	if(zhashOk) hashStep(t, hd, x[t]);
+    }
+    b->setReg(29, a->p); // Executing state (as for a TMState)
+    if(zhashOk) zhash ^= stateKey(a->p) ^ stateKey(s->Nxto(i));
+    a->p = s->Nxto(i);
+    return true;
+}
+
+// Length in bytes of a configuration: p, then h and the symbols of each
+//   working tape
+unsigned BitDeviceMachine::ConfigLen() const
+{
+    assert(Valid());
+    unsigned len = sizeof(unsigned);
+    for(unsigned t=0; t<tapes; t++)
+	len += sizeof(unsigned) + ct[t]->tapeBytes();
+    return len;
+}
+
+// Copy the current configuration into buf (ConfigLen() bytes)
+void BitDeviceMachine::GetConfig(uchar* buf) const
+{
+    assert(Valid());
+    memcpy(buf, &a->p, sizeof(unsigned));
+    buf += sizeof(unsigned);
+    unsigned o = a->Len()+b->Len();
+    for(unsigned t=0; t<tapes; t++)
+    {
+	unsigned n = ct[t]->tapeBytes();
+	memcpy(buf, &ct[t]->h, sizeof(unsigned));
+	bd.Copy(buf+sizeof(unsigned), o+MT_HEADERSZ, n);
+	buf += sizeof(unsigned) + n;
+	o   += ct[t]->Len();
+    }
+}
+
+// Zobrist keys: rather than a table of random numbers for every
+//   position, a mix (splitmix64's finalizer) of the field, the tape and
+//   what's there
+static uint64_t zmix(uint64_t x)
+{
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27; x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+uint64_t BitDeviceMachine::cellKey(unsigned t, unsigned pos, unsigned x)
+{return (x == 2 ? 0 : zmix((uint64_t)pos << 16 | t << 10 | x << 2 | 1));}
+uint64_t BitDeviceMachine::headKey(unsigned t, unsigned pos)
+{return zmix((uint64_t)pos << 16 | t << 10 | 2);}
+uint64_t BitDeviceMachine::stateKey(unsigned p)
+{return zmix((uint64_t)p << 16 | 3);}
+
+void BitDeviceMachine::hashStep(unsigned t, unsigned pos, uchar x)
+{
+    zhash ^= cellKey(t, pos, x) ^ cellKey(t, pos, ct[t]->value(pos));
+    zhash ^= headKey(t, pos) ^ headKey(t, ct[t]->getHead());
+}
+
+// Note p, the heads and the symbols in the bytes of each tape the step
+//   will write -- of a header, only the head may be
+bool BitDeviceMachine::watchStep(HashWatch &w)
+{
+    enum { MAXRANGES = 2*MAXTAPES+2 };
+    unsigned wb[MAXRANGES], wn[MAXRANGES];
+    unsigned k = writeSet(wb, wn, MAXRANGES);
+    if(k > MAXRANGES) return false;
+
+    w.p   = a->p;
+    w.cnt = 0;
+    unsigned o = a->Len()+b->Len();
+    for(unsigned t=0; t<tapes; o+=ct[t]->Len(), t++)
+    {
+	w.head[t] = ct[t]->getHead();
+	unsigned d = o+MT_HEADERSZ, end = o+ct[t]->Len();
+	unsigned spb = bPB/ct[t]->width();
+	for(unsigned i=0; i<k; i++)
+	{
+	    if(wb[i] >= end || wb[i]+wn[i] <= o) continue;
+	    if(wb[i] < d)
+	    {
+		if(wb[i] < o+sizeof(unsigned) || wb[i]+wn[i] > d) return false;
+		continue;
+	    }
+	    unsigned j    = (wb[i]-d)*spb;
+	    unsigned last = (wb[i]+wn[i]-d)*spb;
+	    if(last > ct[t]->tapeLen()) last = ct[t]->tapeLen();
+	    for(; j<last; j++, w.cnt++)
+	    {
+		if(w.cnt == HashWatch::MAXSYMS) return false;
+		w.t[w.cnt]   = t;
+		w.pos[w.cnt] = j;
+		w.x[w.cnt]   = ct[t]->value(j);
+	    }
+	}
+    }
+    return true;
+}
+
+bool BitDeviceMachine::followStep(const HashWatch &w)
+{
+    for(unsigned t=0; t<tapes; t++)
+	if(ct[t]->h < ct[t]->IND2OFF(0) ||
+	   ct[t]->OFF2IND(ct[t]->h) >= ct[t]->tapeLen()) return false;
+    zhash ^= stateKey(w.p) ^ stateKey(a->p);
+    for(unsigned t=0; t<tapes; t++)
+	zhash ^= headKey(t, w.head[t]) ^ headKey(t, ct[t]->getHead());
+    for(unsigned i=0; i<w.cnt; i++)
+	zhash ^= cellKey(w.t[i], w.pos[i], w.x[i]) ^
+	         cellKey(w.t[i], w.pos[i], ct[w.t[i]]->value(w.pos[i]));
+    return true;
+}
+
+// Work the hash out over the symbols if a step we don't follow has
+//   been taken since
+uint64_t BitDeviceMachine::ConfigHash()
+{
+    assert(Valid());
+    if(zhashOk) return zhash;
+    zhash = stateKey(a->p);
+    for(unsigned t=0; t<tapes; t++)
+    {
+	zhash ^= headKey(t, ct[t]->getHead());
+	unsigned last = ct[t]->lastNonBlank();
+	if(last == ct[t]->tapeLen()) continue;
+	for(unsigned i=ct[t]->firstNonBlank(); i<=last; i++)
+	    zhash ^= cellKey(t, i, ct[t]->value(i));
+    }
+    zhashOk = true;
+    return zhash;
+}
+
+// Mirrored, each tape is read from its far end (Move stops a head at
+//   either end alike)
+uint64_t BitDeviceMachine::TapeHash(bool mirror)
+{
+    if(!mirror) return ConfigHash() ^ stateKey(a->p);
+    assert(Valid());
+    uint64_t h = 0;
+    for(unsigned t=0; t<tapes; t++)
+    {
+	unsigned end = ct[t]->tapeLen()-1;
+	h ^= headKey(t, end-ct[t]->getHead());
+	unsigned last = ct[t]->lastNonBlank();
+	if(last == ct[t]->tapeLen()) continue;
+	for(unsigned i=ct[t]->firstNonBlank(); i<=last; i++)
+	    h ^= cellKey(t, end-i, ct[t]->value(i));
+    }
+    return h;
+}
+
+// Little endian 16-bit fields of the encoding
+static void     put16(uchar* b, unsigned v) {b[0] = v & 0xFF; b[1] = v >> 8;}
+static unsigned get16(const uchar* b)       {return b[0] | b[1] << 8;}
+
+unsigned BitDeviceMachine::Encode(uchar* buf, unsigned len) const
+{
+    assert(Valid());
+    unsigned cnt   = a->getNumberOfCommands();
+    unsigned first = firstState();
+    while(cnt > first && cmdA(cnt-1)->OpCode() != Command::OPTMST)
+	cnt--; // Spare commands past the states
+    unsigned n     = cnt-first;
+    unsigned cur   = a->getCurrentCommand();
+    if(n == 0 || n > 0xFFFF || 4+9*n > len) return 0;
+    if(cur < first || cur >= cnt) return 0;
+
+    put16(buf,   n);
+    put16(buf+2, cur-first+1);
+    uchar* e = buf+4;
+    for(unsigned i=first; i<cnt; i++)
+    {
+	if(cmdA(i)->OpCode() != Command::OPTMST) return 0;
+	TMState* s = (TMState*)cmdA(i);
+	for(uchar x=0; x<3; x++, e+=3)
+	{
+	    unsigned nx = s->Nxts(x);
+	    if(nx != 0 && (nx < first || nx >= cnt)) return 0;
+	    e[0] = s->Sym(x) | (s->Dird(x)+1) << 2;
+	    put16(e+1, nx ? nx-first+1 : 0);
+	}
+    }
+    return 4+9*n;
+}
+
+// States are numbered in the order a breadth first walk from the start
+//   state reaches them, taking each state's transitions in symbol order,
+//   so the numbering of the table doesn't matter and states that can't
+//   be reached aren't there. The first transition that moves decides the
+//   mirroring: it's made to move right
+unsigned BitDeviceMachine::Canonicalize(const uchar* enc, unsigned len,
+					uchar* out, bool* mirrored)
+{
+    if(len < 4) return 0;
+    unsigned n     = get16(enc);
+    unsigned start = get16(enc+2);
+    if(n == 0 || len != 4+9*n || start == 0 || start > n) return 0;
+
+    unsigned* label = new unsigned[n+1]; // New number of each state (0 if
+    unsigned* order = new unsigned[n+1]; //   not reached), and the inverse
+    memset(label, 0, (n+1)*sizeof(unsigned));
+    unsigned cnt = 0;
+    label[start] = ++cnt;
+    order[cnt]   = start;
+    bool ok = true;
+    for(unsigned q=1; ok && q<=cnt; q++)
+    {
+	const uchar* e = enc+4+9*(order[q]-1);
+	for(unsigned x=0; ok && x<3; x++)
+	{
+	    unsigned nx = get16(e+3*x+1);
+	    ok = (nx <= n && (e[3*x] & 3) < 3 && (e[3*x] >> 2) < 3);
+	    if(ok && nx && !label[nx])
+	    {
+		label[nx]  = ++cnt;
+		order[cnt] = nx;
+	    }
+	}
+    }
+
+    int flip = -1; // Not decided until something moves
+    if(ok)
+    {
+	put16(out,   cnt);
+	put16(out+2, 1);
+	uchar* o = out+4;
+	for(unsigned q=1; q<=cnt; q++)
+	{
+	    const uchar* e = enc+4+9*(order[q]-1);
+	    for(unsigned x=0; x<3; x++, o+=3)
+	    {
+		unsigned d = e[3*x] >> 2; // dir+1
+		if(flip < 0 && d != 1) flip = (d == 0);
+		if(flip > 0) d = 2-d;
+		unsigned nx = get16(e+3*x+1);
+		o[0] = (e[3*x] & 3) | d << 2;
+		put16(o+1, nx ? label[nx] : 0);
+	    }
+	}
+    }
+    delete [] label;
+    delete [] order;
+    if(mirrored) *mirrored = (flip > 0);
+    return (ok ? 4+9*cnt : 0);
+}
+
+unsigned BitDeviceMachine::Canonical(uchar* buf, unsigned len,
+				     bool* mirrored) const
+{
+    unsigned max = 4+9*a->getNumberOfCommands();
+    uchar*   tmp = new uchar[2*max];
+    unsigned n   = Encode(tmp, max);
+    if(n) n = Canonicalize(tmp, n, tmp+max, mirrored);
+    if(n > len) n = 0;
+    if(n) memcpy(buf, tmp+max, n);
+    delete [] tmp;
+    return n;
+}
+
+// Partition refinement (Hopcroft's) over the transitions of the states
+//   that can be reached from the current one. Nodes 0..m-1 are those
+//   states in table order and the rest stand for the commands outside
+//   the table that transitions go to (the halt command), each starting
+//   in a block of its own; the states start in blocks by what they write
+//   and how they move. A block is split by the states whose transition
+//   on x goes into a splitter block, and only the smaller half of a
+//   split has to be a splitter later, so it's O(n log n) in the states
+unsigned BitDeviceMachine::Minimize(unsigned* map)
+{
+    assert(Valid());
+    unsigned cnt   = a->getNumberOfCommands();
+    unsigned first = firstState();
+    unsigned end   = cnt;
+    unsigned cur   = a->getCurrentCommand();
+    while(end > first && cmdA(end-1)->OpCode() != Command::OPTMST)
+	end--; // Spare commands past the states
+    if(tapes != 1 || first == end || cur < first || cur >= end) return 0;
+    for(unsigned i=first; i<end; i++)
+	if(cmdA(i)->OpCode() != Command::OPTMST) return 0;
+
+    // The states that can be reached, in table order, are nodes 0..m-1
+    //   and every command they go to outside the table a node after them
+    unsigned  n    = end-first;
+    TMState*  st   = (TMState*)malloc(n*sizeof(TMState));
+    unsigned* node = new unsigned[cnt];
+    memcpy((void*)st, cmdA(first), n*sizeof(TMState));
+    memset(node, 0xFF, cnt*sizeof(unsigned));
+    unsigned* stack = new unsigned[n];
+    unsigned  sp    = 0;
+    node[cur] = 0;
+    stack[sp++] = cur;
+    while(sp)
+    {
+	TMState &q = st[stack[--sp]-first];
+	for(uchar x=0; x<3; x++)
+	{
+	    unsigned t = q.Nxts(x);
+	    if(t < first || t >= end || node[t] != ~0u) continue;
+	    node[t]     = 0;
+	    stack[sp++] = t;
+	}
+    }
+    unsigned m = 0;
+    for(unsigned i=first; i<end; i++)
+	if(node[i] == 0) node[i] = m++;
+	else             node[i] = ~0u;
+    unsigned N = m;
+    unsigned* delta = new unsigned[3*m];
+    for(unsigned i=first; i<end; i++)
+    {
+	unsigned q = node[i];
+	if(q == ~0u) continue;
+	for(uchar x=0; x<3; x++)
+	{
+	    unsigned t = st[i-first].Nxts(x);
+	    if((t < first || t >= end) && node[t] == ~0u)
+		node[t] = N++;
+	    delta[3*q+x] = node[t];
+	}
+    }
+
+    // Predecessors of each node on each symbol
+    unsigned* invOff = new unsigned[3*(N+1)];
+    unsigned* inv    = new unsigned[3*m];
+    memset(invOff, 0, 3*(N+1)*sizeof(unsigned));
+    for(unsigned q=0; q<m; q++)
+	for(unsigned x=0; x<3; x++)
+	    invOff[x*(N+1)+delta[3*q+x]+1]++;
+    for(unsigned x=0; x<3; x++)
+	for(unsigned v=0; v<N; v++)
+	    invOff[x*(N+1)+v+1] += invOff[x*(N+1)+v];
+    unsigned* fill = new unsigned[3*N];
+    for(unsigned x=0; x<3; x++)
+	memcpy(fill+x*N, invOff+x*(N+1), N*sizeof(unsigned));
+    for(unsigned q=0; q<m; q++)
+	for(unsigned x=0; x<3; x++)
+	    inv[x*m + fill[x*N+delta[3*q+x]]++] = q;
+
+    // The first blocks: states by what they do (a counting sort on the
+    //   12 bits of symbols written and moves), then one per outside node
+    unsigned* elems  = new unsigned[N];
+    unsigned* pos    = new unsigned[N];
+    unsigned* blk    = new unsigned[N];
+    unsigned* bFirst = new unsigned[N];
+    unsigned* bMid   = new unsigned[N]; // Marked nodes are bFirst..bMid
+    unsigned* bEnd   = new unsigned[N];
+    unsigned  nb     = 0;
+    {
+	enum { SIGS = 1 << 12 };
+	unsigned* sig    = new unsigned[m];
+	unsigned* bucket = new unsigned[SIGS]; // States with a signature,
+	memset(bucket, 0, SIGS*sizeof(unsigned)); //   then its block
+	for(unsigned i=first; i<end; i++)
+	{
+	    unsigned q = node[i];
+	    if(q == ~0u) continue;
+	    sig[q] = 0;
+	    for(uchar x=0; x<3; x++)
+		sig[q] |= (st[i-first].Sym(x) | st[i-first].Dirs(x) << 2) << 4*x;
+	    bucket[sig[q]]++;
+	}
+	for(unsigned k=0, at=0; k<SIGS; k++)
+	{
+	    if(!bucket[k]) continue;
+	    bFirst[nb] = bMid[nb] = at;
+	    at        += bucket[k];
+	    bEnd[nb]   = at;
+	    bucket[k]  = nb++;
+	}
+	for(unsigned q=0; q<m; q++)
+	{
+	    unsigned b = bucket[sig[q]];
+	    blk[q]         = b;
+	    pos[q]         = bMid[b];
+	    elems[bMid[b]] = q;
+	    bMid[b]++;
+	}
+	for(unsigned b=0; b<nb; b++) bMid[b] = bFirst[b];
+	delete [] sig;
+	delete [] bucket;
+    }
+    for(unsigned v=m; v<N; v++)
+    {
+	blk[v]   = nb;
+	pos[v]   = v;
+	elems[v] = v;
+	bFirst[nb] = bMid[nb] = v;
+	bEnd[nb++] = v+1;
+    }
+
+    // Every block is a splitter on every symbol to begin with
+    uchar*    inW   = new uchar[3*N];
+    unsigned* work  = new unsigned[3*N];
+    unsigned  wn    = 0;
+    unsigned* pre   = new unsigned[m];
+    unsigned* touch = new unsigned[N];
+    memset(inW, 0, 3*N);
+    for(unsigned b=0; b<nb; b++)
+	for(unsigned x=0; x<3; x++)
+	{
+	    inW[3*b+x]  = 1;
+	    work[wn++]  = 3*b+x;
+	}
+    while(wn)
+    {
+	unsigned w = work[--wn];
+	unsigned B = w/3, x = w%3;
+	inW[w] = 0;
+
+	// The states going into B on x (each once: a state has one
+	//   transition on x), gathered before marking moves anything
+	unsigned np = 0;
+	for(unsigned k=bFirst[B]; k<bEnd[B]; k++)
+	{
+	    unsigned v = elems[k];
+	    for(unsigned j=invOff[x*(N+1)+v]; j<invOff[x*(N+1)+v+1]; j++)
+		pre[np++] = inv[x*m+j];
+	}
+
+	// Mark them, moving each to the front of its block
+	unsigned nt = 0;
+	for(unsigned j=0; j<np; j++)
+	{
+	    unsigned q = pre[j], C = blk[q];
+	    if(bMid[C] == bFirst[C]) touch[nt++] = C;
+	    unsigned o = elems[bMid[C]];
+	    elems[pos[q]]  = o;
+	    pos[o]         = pos[q];
+	    elems[bMid[C]] = q;
+	    pos[q]         = bMid[C];
+	    bMid[C]++;
+	}
+
+	// Split the blocks that were only partly marked
+	for(unsigned j=0; j<nt; j++)
+	{
+	    unsigned C = touch[j];
+	    if(bMid[C] == bEnd[C]) {bMid[C] = bFirst[C]; continue;}
+	    unsigned D = nb++;
+	    bFirst[D] = bMid[D] = bFirst[C];
+	    bEnd[D]   = bMid[C];
+	    bFirst[C] = bMid[C];
+	    for(unsigned k=bFirst[D]; k<bEnd[D]; k++)
+		blk[elems[k]] = D;
+	    bool dSmaller = (bEnd[D]-bFirst[D] <= bEnd[C]-bFirst[C]);
+	    for(unsigned y=0; y<3; y++)
+	    {
+		unsigned add = (inW[3*C+y] || dSmaller ? D : C);
+		if(inW[3*add+y]) continue;
+		inW[3*add+y] = 1;
+		work[wn++]   = 3*add+y;
+	    }
+	}
+    }
+
+    // A state for each block, in the table order of the first of its
+    //   states, written over the table from the front
+    unsigned* newIdx = new unsigned[nb];
+    memset(newIdx, 0xFF, nb*sizeof(unsigned));
+    unsigned  k = 0;
+    TMState*  out = (TMState*)malloc(m*sizeof(TMState));
+    for(unsigned i=first; i<end; i++)
+    {
+	if(node[i] == ~0u) continue;
+	unsigned b = blk[node[i]];
+	if(newIdx[b] != ~0u) continue;
+	newIdx[b] = first+k;
+	out[k++]  = st[i-first];
+    }
+    for(unsigned j=0; j<k; j++)
+    {
+	for(uchar x=0; x<3; x++)
+	{
+	    unsigned t = out[j].Nxts(x);
+	    if(t >= first && t < end)
+		out[j].nxt[x] = TMState::STATE2OFF(newIdx[blk[node[t]]]);
+	}
+	memcpy((void*)stateW(first+j), &out[j], sizeof(TMState));
+    }
+    for(unsigned i=first+k; i<end; i++) // Nothing goes there now, but
+	cmdW(i)->Init(Command::OPHALT, 0, 0, 0, 0); //   halt if it does
+    if(map)
+    {
+	for(unsigned i=0; i<cnt; i++)
+	{
+	    if(i < first || i >= end) map[i] = i;
+	    else map[i] = (node[i] == ~0u ? ~0u : newIdx[blk[node[i]]]);
+	}
+    }
+    SetCurrentCommand(newIdx[blk[node[cur]]]);
+
+    free(st);          free(out);
+    delete [] node;    delete [] stack;  delete [] delta;  delete [] invOff;
+    delete [] inv;     delete [] fill;   delete [] elems;  delete [] pos;
+    delete [] blk;     delete [] bFirst; delete [] bMid;   delete [] bEnd;
+    delete [] inW;     delete [] work;   delete [] pre;    delete [] touch;
+    delete [] newIdx;
+    return k;
+}
+
+// Bulk tape operations
+void BitDeviceMachine::FillTape(uchar x)
+{assert(Valid()); c->fill(x); zhashOk = false;}
+void BitDeviceMachine::LoadSymbols(unsigned pos, const char* str)
+{assert(Valid()); c->load(pos, str, strlen(str)); zhashOk = false;}
+void BitDeviceMachine::LoadPacked(const uchar* buf)
+{assert(Valid()); c->loadPacked(buf); zhashOk = false;}
+void BitDeviceMachine::CountSymbols(unsigned long cnt[3]) const
+{assert(Valid()); c->count(cnt);}
+
+bool BitDeviceMachine::Extent(unsigned &left, unsigned &right) const
+{
+    assert(Valid());
+    left = c->firstNonBlank();
+    if(left == c->tapeLen()) return false;
+    right = c->lastNonBlank();
+    return true;
+}
+
+unsigned BitDeviceMachine::FirstDifference(const BitDeviceMachine &o) const
+{
+    assert(Valid() && o.Valid());
+    return c->firstDiff(*o.c);
+}
+
+// Copy the tape into/out of a bit-sliced BitPlaneTape
+void BitDeviceMachine::GetPlanes(BitPlaneTape &t) const
+{
+    assert(Valid() && c->width() == 2);
+    unsigned n   = c->tapeBytes();
+    uchar*   buf = new uchar[n];
+    bd.Copy(buf, a->Len()+b->Len()+MT_HEADERSZ, n);
+    if(t.Len() != c->tapeLen()) t.Resize(c->tapeLen());
+    t.FromPacked(buf);
+    delete [] buf;
+}
+
+void BitDeviceMachine::SetPlanes(const BitPlaneTape &t)
+{
+    assert(Valid() && t.Len() == c->tapeLen() && c->width() == 2);
+    uchar* buf = new uchar[c->tapeBytes()];
+    t.ToPacked(buf);
+    c->loadPacked(buf);
+    zhashOk = false;
+    delete [] buf;
+}
+
+// Copy the Turing states into/out of a packed TransitionTable
+void BitDeviceMachine::GetTable(TransitionTable &t) const
+{
+    assert(Valid());
+    unsigned n = a->getNumberOfCommands();
+    t.Resize(n);
+    for(unsigned i=0; i<n; i++)
+    {
+	if(cmdA(i)->OpCode() != Command::OPTMST) continue;
+	TMState* s = (TMState*)cmdA(i);
+	for(uchar x=0; x<3; x++)
+	    t.Set(i, x, s->Sym(x), s->Dird(x), s->Nxts(x));
+    }
+}
+
+void BitDeviceMachine::SetTable(const TransitionTable &t)
+{
+    assert(Valid() && t.Rows() == a->getNumberOfCommands());
+    for(unsigned i=0; i<t.Rows(); i++)
+    {
+	if(!t.IsState(i)) continue;
+	assert(c->width() != 1 || (t.Sym(i, 1) != 0 && t.Sym(i, 2) != 0));
+	stateW(i)->Init(t.Sym(i, 0), t.Sym(i, 1), t.Sym(i, 2),
+			t.Dir(i, 0), t.Dir(i, 1), t.Dir(i, 2),
+			t.Nxt(i, 0), t.Nxt(i, 1), t.Nxt(i, 2));
+    }
+}
+
+// Run Turing transitions straight out of a packed TransitionTable
+unsigned long BitDeviceMachine::ExecuteTable(const TransitionTable &t,
+					     unsigned long maxSteps)
+{
+    assert(Valid() && t.Rows() == a->getNumberOfCommands());
+    const uint32_t* e = t.Entries();
+    unsigned        i = a->getCurrentCommand();
+    unsigned long   n = 0;
+    for(; n < maxSteps && i != 0 && e[4*i+3] == 0; n++)
+    {
+	uchar x = c->Read();
+	assert(x < 3);
+	uint32_t w  = e[4*i+x];
+	unsigned hd = c->getHead();
+	c->Write(w & 3);
+	c->Move((int)((w >> 2) & 3) - 1);
+	b->setReg(29, Command::CMDIDX2OFF(i)); // As ExecuteT leaves it
+	if(zhashOk)
+	{
+	    hashStep(0, hd, x);
+	    zhash ^= stateKey(Command::CMDIDX2OFF(i)) ^
+		     stateKey(Command::CMDIDX2OFF(w >> 4));
+	}
+	i = w >> 4;
+	if(brk)
+	{
+	    a->setCurrentCommand(i);
+	    if(brk->Hit(*this, n+1)) {n++; break;}
+	}
+    }
+    a->setCurrentCommand(i);
+    return n;
 }
 
 // Run the current machine -- print each state transition unless silent
 void BitDeviceMachine::Execute(bool silent)
 {
-    // Don't let a machine run more than 10000 steps    
-    static int MAXSTEPS = 10000; 
+    unsigned long steps = 0;
+    Execute(silent, steps, 0);
+}
 
+bool BitDeviceMachine::Execute(bool silent, unsigned long &steps,
+			       volatile sig_atomic_t* stop)
+{
     // Print the tape before first step if not silent
     if(!silent) Print(0);  
 
-    // Run the machine till the stop state is reached
-    for(int i=0; !Halted() && i<MAXSTEPS; i++)
+    // Run the machine till the stop state is reached (the limit counts
+    //   the steps before a stop, so a resumed run stops where it would
+    //   have)
+    while(!Halted() && (!stepLimit || steps < stepLimit))
     {
+	// Stop between steps if asked to
+	if(stop && *stop) return false;
+
 	// Execute a step	
 	bool printable = ExecuteS();
+	steps++;
 
 	// Print the tape after this step(if printable)
-	if(!silent && printable) Print(i);
+	if(!silent && printable) Print(steps-1);
+
+	// Stop after a step a breakpoint holds for
+	if(brk && brk->Hit(*this, steps)) return false;
     }
+    return true;
 }
 
+void BitDeviceMachine::SetStepLimit(unsigned long n)
+{stepLimit = n;}
+
+// Native transitions, counted in ExecuteS steps
+unsigned long BitDeviceMachine::ExecuteN(unsigned long &steps,
+					 unsigned long until)
+{
+    assert(Valid());
+    while(steps < until && !Halted())
+    {
+	unsigned long per  = transitionSteps();
+	unsigned long from = steps;
+	if(!ExecuteT()) break;
+	steps += per;
+	if(brk && brk->HitSince(*this, from, steps)) return per;
+    }
+    return 0;
+}
+
+// A TMState on a 2-bit tape goes through the bootstrap: a step to get
+//   there and one for each command of it (not counting halt)
+unsigned long BitDeviceMachine::transitionSteps() const
+{
+    static const unsigned long boot =
+	bootstrapSegment()->Len()/sizeof(Command);
+    if(cmdA(GetCurrentCommand())->OpCode() == Command::OPTMST &&
+       c->width() == 2)
+	return boot;
+    return 1;
+}
+
+void BitDeviceMachine::SetBreakpoints(Breakpoints* bp)
+{brk = bp;}
+
 // Initialize machine from a file
 bool BitDeviceMachine::ReadFile(const char* fname)
+{
+    if (mapFiles) return mapFile(fname);
+    return readFile(fname);
+}
+
+bool BitDeviceMachine::readFile(const char* fname)
 {
     // Open the file for reading
     std::ifstream tfile(fname, std::ifstream::in | std::ifstream::binary);
@@ -721,8 +2156,28 @@ bool BitDeviceMachine::ReadFile(const char* fname)
     int length = tfile.tellg();
     tfile.seekg (0, tfile.beg);
 
+    // A version 2 file starts with a header -- anything else is taken
+    //   for a legacy file, a bare tape
+    uchar head[sizeof(TapeFile)];
+    bool  v2  = false;
+    int   off = 0;
+    if (length >= (int)sizeof(TapeFile))
+    {
+	tfile.read ((char*)head, sizeof(TapeFile));
+	v2 = TapeFile::IsTapeFile(head, sizeof(TapeFile));
+    }
+    if (v2)
+    {
+	TapeFile* h = (TapeFile*)head;
+	if (!h->Valid(length)) return false;
+	off    = h->imageOff;
+	length = h->imageLen;
+    }
+    tfile.clear();
+    tfile.seekg (off, tfile.beg);
+
     // Make a large enough buffer to hold the tape
-    uchar *buf = new uchar [length];
+    uchar *buf = alloc->Alloc(length);
 
     // read data as a block:
     tfile.read ((char*)buf, length);
@@ -733,13 +2188,155 @@ bool BitDeviceMachine::ReadFile(const char* fname)
     // Close the file
     tfile.close();
 
+    // A legacy image with the old registers is widened to run
+    if (!v2 && oldRegs(buf, length))
+    {
+	unsigned len = length;
+	uchar*   wide = widenRegs(buf, len);
+	alloc->Free(buf, length);
+	buf    = wide;
+	length = len;
+    }
+
+    // Check the image before trusting its sizes
+    if (!checkImage(v2 ? (TapeFile*)head : 0, buf, length))
+    {
+	alloc->Free(buf, length);
+	return false;
+    }
+
     // Overlay the three accessor parts
     InitToBuf(buf, length, true);
 
     return true;
 }
 
-// Write machine to file: as a bit string
+// The image must match its checksum and hold at least the command table
+//   and registers its z promises
+bool BitDeviceMachine::checkImage(const TapeFile* h, const uchar* buf,
+				  unsigned len)
+{
+    if (len < MT_HEADERSZ) return false;
+    if (h && !(h->flags & TapeFile::LIVE) &&
+	h->checksum != TapeFile::Checksum(buf, len)) return false;
+    return ((unsigned long)(*(unsigned*)buf)*BYTESPERWORD + sizeof(RegTape)
+	    + MT_HEADERSZ <= (unsigned long)len);
+}
+
+// The register where a current image keeps its return stack pointer is
+//   where an old one's working tape starts, and its z (the tape's
+//   length in words) is too big to be a stack pointer -- so only an old
+//   image has a tape there that fills the rest
+bool BitDeviceMachine::oldRegs(const uchar* buf, unsigned len)
+{
+    if (len < MT_HEADERSZ) return false;
+    unsigned long at = (unsigned long)(*(unsigned*)buf)*BYTESPERWORD +
+	               OLDREGS*sizeof(int);
+    if (at + MT_HEADERSZ > len) return false;
+    unsigned wz = *(unsigned*)(buf+at);
+    return (!(wz & WorkingTape::FLAGS) &&
+	    at + (unsigned long)wz*BYTESPERWORD == len);
+}
+
+// The new registers (the return stack) start out 0. The old bootstrap
+//   is the new one but for the register count it loads to find the tape,
+//   and the old head counted the tape's header in bytes, not bits
+uchar* BitDeviceMachine::widenRegs(const uchar* buf, unsigned &len)
+{
+    unsigned at  = *(unsigned*)buf*BYTESPERWORD + OLDREGS*sizeof(int);
+    unsigned add = (MAXREGS-OLDREGS)*sizeof(int);
+    uchar*   w   = alloc->Alloc(len+add);
+    memcpy(w, buf, at);
+    memset(w+at, 0, add);
+    memcpy(w+at+add, buf+at, len-at);
+    len += add;
+
+    Command* cmd = (Command*)(w+MT_HEADERSZ);
+    unsigned n   = (*(unsigned*)buf*BYTESPERWORD-MT_HEADERSZ)/sizeof(Command);
+    for (unsigned i=0; i<n && cmd[i].opCode != Command::OPTMST; i++)
+	if (cmd[i].opCode == Command::OPLOAD && cmd[i].arg[0] == OLDREGS &&
+	    cmd[i].arg[1] == 4)
+	    cmd[i].arg[0] = MAXREGS;
+
+    WorkingTape* t = (WorkingTape*)(w+at+add);
+    t->h += MT_HEADERSZ*(bPB-1);
+    return w;
+}
+
+// Map the file and overlay the machine on the image in place
+bool BitDeviceMachine::mapFile(const char* fname)
+{
+    MappedFile* m = new MappedFile;
+    if (!m->Open(fname, mapShared) || m->Len() > 0xFFFFFFFFUL)
+    {
+	delete m;
+	return false;
+    }
+
+    // The image is where the header says, or the whole of a legacy file
+    const TapeFile* h   = 0;
+    unsigned        off = 0;
+    unsigned        len = m->Len();
+    if (len >= sizeof(TapeFile) && TapeFile::IsTapeFile(m->Base(), len))
+    {
+	h = (const TapeFile*)m->Base();
+	if (!h->Valid(len))
+	{
+	    delete m;
+	    return false;
+	}
+	off = h->imageOff;
+	len = h->imageLen;
+    }
+
+    // An image with the old registers can't run in place -- read it
+    if (!h && oldRegs(m->Base(), len))
+    {
+	delete m;
+	return readFile(fname);
+    }
+    if (!checkImage(h, m->Base()+off, len))
+    {
+	delete m;
+	return false;
+    }
+
+    // Not ours to delete -- the mapping goes when the machine lets go.
+    //   A shared file is LIVE (on disk) before execution touches it
+    InitToBuf(m->Base()+off, len, false);
+    mapped = m;
+    if (h && m->Shared())
+    {
+	((TapeFile*)h)->flags |= TapeFile::LIVE;
+	m->Sync(0, sizeof(TapeFile));
+    }
+    return true;
+}
+
+// Update the checksum in the header, then write the dirty pages back
+bool BitDeviceMachine::SyncFile()
+{
+    assert(Valid());
+    if (!mapped || !mapped->Shared()) return false;
+    return syncFile(true);
+}
+
+// The checksum, LIVE or not, then the pages
+bool BitDeviceMachine::syncFile(bool live)
+{
+    uchar* base = mapped->Base();
+    if (mapped->Len() >= sizeof(TapeFile) &&
+	TapeFile::IsTapeFile(base, mapped->Len()))
+    {
+	TapeFile* h = (TapeFile*)base;
+	h->checksum = TapeFile::Checksum(base+h->imageOff, h->imageLen);
+	if (live) h->flags |=  TapeFile::LIVE;
+	else      h->flags &= ~TapeFile::LIVE;
+    }
+    return mapped->Sync();
+}
+
+// Write machine to file: a header, then the flat tape as the image
 bool BitDeviceMachine::WriteFile(const char* fname)
 {
     assert(Valid());
@@ -748,12 +2345,44 @@ bool BitDeviceMachine::WriteFile(const char* fname)
     std::ofstream tfile(fname, std::ofstream::out | std::ofstream::binary);
     if (!tfile) return false;
 
-    // Write the buffer
-    unsigned len = a->Len() + b->Len() + c->Len();
+    // The image is the flat tape -- flatten a segmented machine
+    unsigned len = a->Len() + b->Len();
+    for(unsigned t=0; t<tapes; t++)
+	len += ct[t]->Len();
     unsigned buflen;
     uchar* tape = bd.GetTape(buflen);
+    uchar* buf  = tape;
     assert(len == buflen);
-    tfile.write((char*)(tape), len);
+    if(!tape)
+    {
+	buf = new uchar[len];
+	copyFlat(buf, len);
+    }
+
+    // Header and the section directory, padded out to the image
+    uchar head[(sizeof(TapeFile)+TapeFile::ALIGN-1)/TapeFile::ALIGN*
+	       TapeFile::ALIGN];
+    TapeFile* h = (TapeFile*)head;
+    memset(head, 0, sizeof(head));
+    h->Init(len);
+    assert(h->imageOff == sizeof(head));
+    unsigned cmdLen = MT_HEADERSZ + firstState()*sizeof(Command);
+    h->AddSection(TapeFile::CMDS,   0, 0, cmdLen);
+    h->AddSection(TapeFile::STATES, 0, cmdLen, a->Len()-cmdLen);
+    h->AddSection(TapeFile::REGS,   0, a->Len(), b->Len());
+    unsigned o = a->Len()+b->Len();
+    for(unsigned t=0; t<tapes; t++)
+    {
+	h->AddSection(TapeFile::TAPE, t, o, ct[t]->Len());
+	o += ct[t]->Len();
+    }
+    h->checksum = TapeFile::Checksum(buf, len);
+
+    // Write the header and the image
+    tfile.write((char*)head, sizeof(head));
+    tfile.write((char*)buf, len);
+    if(!tape)
+	delete [] buf;
 
     // Close the file
     tfile.close();
@@ -761,6 +2390,190 @@ bool BitDeviceMachine::WriteFile(const char* fname)
     return true;
 }
 
+// Flat copy of the tape, with the WorkingTape as a flat tape has it
+void BitDeviceMachine::copyFlat(uchar* buf, unsigned len) const
+{
+    bd.Copy(buf, 0, len);
+    unpage(buf);
+}
+
+// The first WorkingTape follows the command table and registers
+void BitDeviceMachine::unpage(uchar* tape)
+{
+    unsigned cA = (*(unsigned*)tape)*BYTESPERWORD + sizeof(RegTape);
+    *(unsigned*)(tape+cA) &= ~WorkingTape::PAGED;
+}
+
+// Fork every segment. The fork takes its own copy of each single page
+//   segment, as Fork does, so the machine's structs stay where they are
+//   -- those are compared at the next checkpoint. The pages of the paged
+//   segments are shared, so the first write to each is noted
+void BitDeviceMachine::takeSnapshot()
+{
+    dropSnapshot();
+    snapCnt = bd.SegmentCount();
+    snap    = new Segment*[snapCnt];
+    for(unsigned i=0; i<snapCnt; i++)
+    {
+	Segment* s = bd.GetSegment(i);
+	snap[i] = s->Fork();
+	if(s->PageLen() >= s->Len())
+	    snap[i]->WriteA(s->Start());
+	else
+	{
+	    s->Track(true);
+	    s->ClearDirty();
+	}
+    }
+}
+
+void BitDeviceMachine::dropSnapshot()
+{
+    for(unsigned i=0; i<snapCnt; i++)
+	delete snap[i];
+    delete [] snap;
+    snap    = 0;
+    snapCnt = 0;
+}
+
+// Append the whole tape or what changed since the last checkpoint
+bool BitDeviceMachine::Checkpoint(const char* fname, unsigned long steps)
+{
+    assert(Valid());
+    if(tapes == 1 && bd.SegmentCount() == 0) segment();
+
+    CheckpointLog::Record r;
+    memset(&r, 0, sizeof(r));
+    r.steps = steps;
+    r.p     = a->p;
+    r.h     = c->h;
+
+    // A new log (or a machine with no snapshot) starts with the lot
+    struct stat st;
+    uchar* payload;
+    if(!snap || stat(fname, &st) != 0 || st.st_size == 0)
+    {
+	unsigned buflen;
+	bd.GetTape(buflen);
+	r.kind  = CheckpointLog::BASE;
+	r.len   = buflen;
+	payload = new uchar[r.len];
+	copyFlat(payload, r.len);
+    }
+    else
+    {
+	// Size up the chunks, then gather them
+	assert(snapCnt == bd.SegmentCount());
+	bool* changed = new bool[snapCnt];
+	r.kind = CheckpointLog::DELTA;
+	for(unsigned i=0; i<snapCnt; i++)
+	{
+	    Segment* s = bd.GetSegment(i);
+	    if(s->PageLen() >= s->Len())
+	    {
+		changed[i] = memcmp(s->ReadA(s->Start()),
+				    snap[i]->ReadA(s->Start()), s->Len());
+		if(changed[i])
+		{
+		    r.chunks++;
+		    r.len += sizeof(CheckpointLog::Chunk) + s->Len();
+		}
+		continue;
+	    }
+	    for(unsigned k=0; k<s->DirtyCount(); k++)
+	    {
+		unsigned addr, n;
+		s->DirtyPage(k, addr, n);
+		r.chunks++;
+		r.len += sizeof(CheckpointLog::Chunk) + n;
+	    }
+	}
+	payload = new uchar[r.len];
+	uchar* o = payload;
+	for(unsigned i=0; i<snapCnt; i++)
+	{
+	    Segment* s = bd.GetSegment(i);
+	    bool single = (s->PageLen() >= s->Len());
+	    unsigned cnt = (single ? changed[i] : s->DirtyCount());
+	    for(unsigned k=0; k<cnt; k++)
+	    {
+		CheckpointLog::Chunk ch;
+		if(single)
+		{
+		    ch.addr = s->Start();
+		    ch.n    = s->Len();
+		}
+		else
+		    s->DirtyPage(k, ch.addr, ch.n);
+		memcpy(o, &ch, sizeof(ch));
+		s->Get(o+sizeof(ch), ch.addr, ch.n);
+		o += sizeof(ch)+ch.n;
+	    }
+	}
+	assert(o == payload+r.len);
+	delete [] changed;
+    }
+
+    bool ok = CheckpointLog::Append(fname, r, payload);
+    delete [] payload;
+    if(ok && tapes == 1) takeSnapshot();
+    return ok;
+}
+
+// Replay the log onto a flat tape and carry on from there -- on segments
+//   with a snapshot, so the next checkpoint to the log is a delta
+bool BitDeviceMachine::Restore(const char* fname, unsigned long &steps)
+{
+    unsigned len, records;
+    unsigned long st;
+    uchar* tape = CheckpointLog::Replay(fname, alloc, len, st, records);
+    if(!tape) return false;
+
+    // A BASE too short to hold the header and registers is no image --
+    //   check before unpage reads the header through them
+    if(len < MT_HEADERSZ || !checkImage(0, tape, len))
+    {
+	alloc->Free(tape, len);
+	return false;
+    }
+    unpage(tape);
+    InitToBuf(tape, len, true);
+    if(tapes == 1)
+    {
+	segment();
+	takeSnapshot();
+    }
+    steps = st;
+    return true;
+}
+
+// Rewrite the log as one BASE, then put it in place of the old one
+bool BitDeviceMachine::CompactLog(const char* fname)
+{
+    unsigned len, records;
+    unsigned long steps;
+    uchar* tape = CheckpointLog::Replay(fname, Allocator::Heap(), len, steps,
+					records);
+    if(!tape) return false;
+    unpage(tape);
+
+    CheckpointLog::Record r;
+    memset(&r, 0, sizeof(r));
+    unsigned cA = (*(unsigned*)tape)*BYTESPERWORD + sizeof(RegTape);
+    r.kind  = CheckpointLog::BASE;
+    r.steps = steps;
+    r.p     = ((unsigned*)tape)[1];
+    r.h     = ((unsigned*)(tape+cA))[1];
+    r.len   = len;
+
+    std::string tmp = std::string(fname) + ".tmp";
+    unlink(tmp.c_str());
+    bool ok = CheckpointLog::Append(tmp.c_str(), r, tape);
+    Allocator::Heap()->Free(tape, len);
+    if(ok) ok = (rename(tmp.c_str(), fname) == 0);
+    return ok;
+}
+
 // Write machine to file member by member
 bool BitDeviceMachine::RewriteFile(const char* fname)
 {
@@ -777,20 +2590,31 @@ bool BitDeviceMachine::RewriteFile(const char* fname)
     tfile.write((char*)&(a->p), sizeof(unsigned));
 
     // Write Command Table as sizeof(Command)*n bytes
-    tfile.write((char*)&(a->cmd),
-		(sizeof(BitDeviceMachine::Command)*a->getNumberOfCommands()));
+    for(unsigned i=0; i<a->getNumberOfCommands(); i++)
+	tfile.write((char*)cmdA(i), sizeof(BitDeviceMachine::Command));
 
     // Write registers as sizeof(RegTape) bytes
     tfile.write((char*)b, sizeof(RegTape));
 
-    // Write Length as 32 bit unsigned
-    tfile.write((char*)&(c->z), sizeof(unsigned));
-
-    // Write HeadPos as 32 bit unsigned
-    tfile.write((char*)&(c->h), sizeof(unsigned));
-
-    // Write the rest of the tape 
-    tfile.write((char*)&(c->T), c->tapeLen()/SYMPERBYTE);
+    // Write each working tape
+    unsigned o = a->Len()+b->Len();
+    for(unsigned t=0; t<tapes; t++)
+    {
+	// Write Length as 32 bit unsigned
+	unsigned cz = ct[t]->z & ~WorkingTape::PAGED;
+	tfile.write((char*)&cz, sizeof(unsigned));
+
+	// Write HeadPos as 32 bit unsigned
+	tfile.write((char*)&(ct[t]->h), sizeof(unsigned));
+
+	// Write the rest of the tape 
+	unsigned tlen = ct[t]->tapeBytes();
+	uchar*   T    = new uchar[tlen];
+	bd.Copy(T, o+MT_HEADERSZ, tlen);
+	tfile.write((char*)T, tlen);
+	delete [] T;
+	o += ct[t]->Len();
+    }
     
     // Close the file
     tfile.close();
@@ -806,7 +2630,27 @@ void BitDeviceMachine::Print(unsigned opCnt)
     //      (current command is start of bootstrap after TuringState execed
     int*     reg    = getRegisters();
     unsigned cs     = TMState::OFF2STATE(reg[29]);
-    c->Print(cs, opCnt);
+    if(tapes == 1)
+    {
+	c->Print(cs, opCnt);
+	return;
+    }
+
+    // Several tapes: print each under the other and rewind over them all
+    static bool firstTime = true;
+    if(!firstTime)
+    {
+	usleep(500000);
+	for(unsigned i=0; i<3*tapes; i++)
+	    std::cout << "\033[1A" << std::flush;
+    }
+    firstTime = false;
+    for(unsigned t=0; t<tapes; t++)
+    {
+	ct[t]->printTapeLine(opCnt);
+	ct[t]->printHeadLine();
+	ct[t]->printStateLine(cs);
+    }
 }
 
 // Accessors
@@ -820,7 +2664,7 @@ unsigned BitDeviceMachine::zA()
 unsigned BitDeviceMachine::pA()
 {assert(Valid()); return (((uchar*)&a->p             -(uchar*)a)*8);}
 unsigned BitDeviceMachine::hA()
-{assert(Valid()); return (((uchar*)&c->h             -(uchar*)a)*8);}
+{assert(Valid()); return ((a->Len()+b->Len()+sizeof(unsigned))*8);}
 
 
 // Equality and inequality operators
@@ -829,7 +2673,14 @@ bool BitDeviceMachine::operator==(const BitDeviceMachine &other) const
     // The resgister parts may differ and Machines are still considered ==
     if(!Valid() || !other.Valid()) return false;
     
-    return (*a == *other.a && *c == *other.c);
+    if(*a != *other.a || tapes != other.tapes) return false;
+    for(unsigned t=0; t<tapes; t++)
+	if(*ct[t] != *other.ct[t])
+	    return false;
+    for(unsigned i=0; i<a->getNumberOfCommands(); i++)
+	if(*cmdA(i) != *other.cmdA(i))
+	    return false;
+    return true;
 }
 
 bool BitDeviceMachine::operator!=(const BitDeviceMachine &other) const
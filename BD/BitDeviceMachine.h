@@ -2,35 +2,114 @@
 #define BITDEVICEMACHINE_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
 
 #include "syntactic_sugar.h"
 #include "BitDevice.h"
 
+class BitPlaneTape;
+class TransitionTable;
+class MappedFile;
+class Breakpoints;
+
 class BitDeviceMachine
 {
 private:
+    friend class DeciderPipeline;
+    friend class History;
+    friend class Breakpoints;
+
 #include "TMState.h"
+#include "MTState.h"
 #include "Command.h"
 #include "MachineTape.h"    
 #include "RegTape.h"
 #include "WorkingTape.h"    
+#include "TapeFile.h"
+#include "CheckpointLog.h"
 
     // Private Data Members
     MachineTape* a;  // The tape as a whole
     RegTape*     b;  //    subtape with registers
     WorkingTape* c;  //    subtape with working space
+    WorkingTape* ct[MAXTAPES]; // All the working tapes (ct[0] is c)
+    unsigned     tapes;        //    and how many there are
     BitDevice    bd; // BitDevice that holds the tape
+    bool  shareBoot; // Init lays out machines with the shared bootstrap
+    bool  sparse;    // Init lays out machines with sparse symbols
+    unsigned symWidth; // Init lays out tapes with symbols this wide (2
+                       //   for a 1-bit machine that may use 0s)
+    Allocator* alloc; // Init and ReadFile take tape buffers from here
+    bool  mapFiles;  // ReadFile maps the file rather than reading it
+    bool  mapShared; //    with a shared mapping (writes go to the file)
+    MappedFile* mapped; // The mapping the machine runs on (0 if none)
+    Segment**   snap;    // The segments as of the last Checkpoint (0 if
+    unsigned    snapCnt; //    none) and how many there are
+    Breakpoints* brk;    // Checked after each step of a run (0 if none)
+    unsigned long stepLimit; // Steps Execute runs to at most (0: no limit)
+    uint64_t    zhash;   // ConfigHash, kept up to date by native steps
+    bool        zhashOk; //    while set (anything else clears it)
 
     // Set BitDeviceMachine to work on the given tape
     //   of buflen bytes. delTape is true if the tape should
     //   be deleted on destruction of the machine
     void reset(uchar* buf, unsigned buflen, bool delTape);
 
+    // Let go of the file the machine was mapped on (if any)
+    void unmap();
+
+    // Keep a fork of the segments to tell what's written from now on,
+    //   and let go of it
+    void takeSnapshot();
+    void dropSnapshot();
+
+    // Copy the tape flat into buf (len bytes) as a file holds it, and
+    //   clear the paged flag of a flat tape read back from one
+    void copyFlat(uchar* buf, unsigned len) const;
+    static void unpage(uchar* tape);
+
+    // Check an image of len bytes from a file whose header is h (0 for a
+    //   legacy file): its checksum, and that it holds the command table
+    //   and registers its z promises
+    static bool checkImage(const TapeFile* h, const uchar* buf,
+			   unsigned len);
+
+    // Does a legacy image of len bytes have the 50 registers it had
+    //   before the return stack (OLDREGS): a working tape that starts
+    //   where those end and fills the rest. Copy such an image into one
+    //   with the registers there are now, and the bootstrap that finds
+    //   the tape past them (len grows to match)
+    enum { OLDREGS = 50 };
+    static bool   oldRegs(const uchar* buf, unsigned len);
+    uchar*        widenRegs(const uchar* buf, unsigned &len);
+
+    // Map fname and overlay the machine on the image in the mapping, or
+    //   read it into a buffer
+    bool mapFile(const char* fname);
+    bool readFile(const char* fname);
+
+    // Bring the shared-mapped file up to date, leaving it LIVE or not
+    bool syncFile(bool live);
+
     // Return a pointer to the machine's register tape
     int* getRegisters();
 
-    // Write commands to execute a TuringState into a tape
-    unsigned turingBootstrap();
+    // Write commands to execute a TuringState into cmd/into the
+    //   machine's command table (returns the number of commands)
+    static unsigned writeBootstrap(Command* cmd);
+    unsigned        turingBootstrap();
+
+    // Bootstrap shared by machines laid out with ShareBootstrap(true)
+    static Segment* bootstrapSegment();
+
+    // Init on segments (for a shared bootstrap or sparse symbols) with
+    //   w-bit symbols
+    void initSegmented(unsigned cmdCount, unsigned tapeSize, unsigned w);
+
+    // Find the working tapes -- one after the other from c to the end
+    //   of a flat tape (a segmented machine has only c)
+    void overlayTapes();
 
     // Compute the addresses necessary to run a BitDeviceProgram
     //    extract opCode    in computeAddresses1
@@ -41,9 +120,91 @@ private:
     // Execute an op code with its arguments
     bool execOpCode(int opcode, int arg1, int arg2, int arg3);
 
+    // Stop on a return stack fault (a CALL with the stack full or a RETN
+    //   with it empty): mark the stack and go to the halt command next
+    void stackFault();
+
+    // The bytes outside the registers the next ExecuteS will write, as
+    //   up to max ranges of wn[i] bytes at wb[i] -- returns how many, or
+    //   max+1 if they can't be told before the step (an op that computes
+    //   where the command pointer goes). Leaves the registers as the
+    //   step will find them
+    unsigned writeSet(unsigned* wb, unsigned* wn, unsigned max);
+
+    // Byte address of the registers on the tape
+    unsigned regA() const;
+
+    // Return the current command as a TMState (0 if it isn't one), and
+    //   is it a TMState or an MTState (a step ExecuteT can take)
+    TMState* currentState() const;
+    bool     atState() const;
+
+    // Would the current state's next step move a head off either end of
+    //   its tape (ExecuteT would clamp it there, the bootstrap run it off)
+    bool     leavesTape() const;
+
+    // Address of command idx for reading or writing
+    //   (never write through cmdA -- the table may be shared)
+    Command* cmdA(unsigned idx) const;
+    Command* cmdW(unsigned idx);
+    TMState* stateW(unsigned idx);
+    MTState* mtStateW(unsigned idx);
+
+    // Zobrist keys for symbol x at pos on tape t (0 for a blank), for
+    //   the head of tape t at pos and for the current command at p
+    static uint64_t cellKey(unsigned t, unsigned pos, unsigned x);
+    static uint64_t headKey(unsigned t, unsigned pos);
+    static uint64_t stateKey(unsigned p);
+
+    // Fold a native step into the hash: tape t had x at pos, under its
+    //   head, before the step wrote and moved (call after the move)
+    void hashStep(unsigned t, unsigned pos, uchar x);
+
+    // What an ExecuteS step that isn't a Turing transition (the
+    //   bootstrap's, say) may change of the hash: p, the heads and the
+    //   symbols in the bytes it writes
+    struct HashWatch
+    {
+	enum { MAXSYMS = 64 };
+	unsigned p;
+	unsigned head[MAXTAPES];
+	unsigned cnt;            // Symbols noted
+	uchar    t[MAXSYMS];
+	unsigned pos[MAXSYMS];
+	uchar    x[MAXSYMS];
+    };
+
+    // Note them before the step -- false if it writes more than that
+    //   (a tape's length, a long run of symbols) or can't be told -- and
+    //   fold what changed into the hash after it (false if a head has
+    //   gone off its tape)
+    bool watchStep(HashWatch &w);
+    bool followStep(const HashWatch &w);
+
+    // Execute a transition of the current command if it's an MTState
+    //    returns false if it isn't
+    bool executeMT();
+
+    // Index of the first TMState or MTState in the command table (the
+    //   number of commands if there's none)
+    unsigned firstState() const;
+
+    // ExecuteS steps the transition out of the current state stands for
+    unsigned long transitionSteps() const;
+
+    // Segments holding a copy of a flat machine (SEGCNT of them), and
+    //   moving the machine onto them (see Fork)
+    enum { SEGCNT = 5 };
+    Segment** flatSegments() const;
+    void      segment();
+
+    // Copy the settings for machines made from now on to a fork
+    void forkSettings(BitDeviceMachine* m) const;
+
     // Returns size in bytes of a machine with cmdCnt commands and
-    //   a working tape of tapeLen symbols
-    static unsigned machineSize(unsigned cmdCnt, unsigned tapeLen);
+    //   tapeCnt working tapes of tapeLen symbols
+    static unsigned machineSize(unsigned cmdCnt, unsigned tapeLen,
+				unsigned tapeCnt=1, unsigned width=2);
     
 public:
     // Constructor and destructor
@@ -63,16 +224,85 @@ public:
     void InitToBB4();
     void InitToPAL();
 
+    // Two-tape machines: a palindrome detector that copies the string to
+    //   the second tape and compares in one pass, and a binary adder that
+    //   adds the number on the second tape to the one on the first
+    void InitTo2PAL();
+    void InitTo2Add();
+
+    // A frame for n states to be filled in (with SetTable, say): the
+    //   bootstrap, then n states that halt at once, on a blank tape of
+    //   tapeSize symbols with the head in the middle, in the first of
+    //   them. Returns its command index -- the states are it..it+n-1
+    unsigned InitToStates(unsigned n, unsigned tapeSize);
+
+    // A command program (no Turing states) that CALLs a routine depth
+    //   levels deep and returns, then halts -- or, with overReturn, RETNs
+    //   once more. Past RSTACKLEN levels, or returning too often, it
+    //   halts Faulted
+    void InitToCalls(unsigned depth, bool overReturn=false);
+
     //TODO: Make Init depend on InitToBuf (trickiness with sizes)
     // Initialize to an empty machine with given cmd count and tapesize
-    void Init(unsigned cmdCount, unsigned tapeSize);
+    //   and tapeCount working tapes. Machines with more than one tape
+    //   are laid out flat (tapes past the first start out blank). A
+    //   1-bit tape has no 0, so SymbolWidth(1) is refused -- the tapes
+    //   are 2 bits wide -- unless the caller promises, with zeros false,
+    //   that no state will read or write a 0
+    void Init(unsigned cmdCount, unsigned tapeSize, unsigned tapeCount=1,
+	      bool zeros=true);
+
+    // Lay out machines made by Init (and InitTo*) with the bootstrap in
+    //   a read-only segment shared by all of them instead of a copy each
+    void ShareBootstrap(bool share);
+
+    // Lay out machines made by Init (and InitTo*) with their symbols in
+    //   pages that are only allocated when first written. Untouched tape
+    //   reads as blank, so a machine costs what its head visits and Init
+    //   doesn't depend on tapeSize
+    void SparseTape(bool sparse);
+
+    // Lay out the tapes of machines made by Init (and InitTo*) with
+    //   symbols w = 1, 2, 4 or 8 bits wide. A 1-bit tape holds 1s and
+    //   blanks, which is all a 2-symbol machine like the busy beavers
+    //   needs, at twice the density (a machine with 0s gets 2 bits). Wider
+    //   tapes hold up to 2^w symbols for MTStates with more colors. Tapes
+    //   that aren't 2 bits wide are run natively rather than through the
+    //   bootstrap, and their length is rounded up to whole words
+    void SymbolWidth(unsigned w);
+
+    // Have ReadFile map the file and run the machine in place rather than
+    //   read it into a buffer. A private mapping is copy-on-write (the
+    //   file is never changed); a shared one writes execution through to
+    //   the file, with SyncFile as the checkpoint, and marks it LIVE until
+    //   the machine lets go (see TapeFile.h). Making another machine on
+    //   this one, or forking it, lets go of the file
+    void MapFiles(bool map, bool shared=false);
+
+    // Allocator for the tape buffers of machines made by Init, InitTo*
+    //   and ReadFile from now on (the heap if al is 0). Set it before
+    //   making the machine -- the buffer goes back where it came from
+    void SetAllocator(Allocator* al);
     
     // Initialize to a previously established buffer (sizes already in buf)
-    //    delTape true means we delete on destruction
+    //    delTape true means we delete on destruction (so buf must have
+    //    come from the machine's allocator)
     void InitToBuf(uchar* buf, unsigned len, bool delTape);
 
-    // Test for halt condition
+    // Return a new machine in the same configuration as this one (the
+    //   caller deletes it). The command table and the tape of a segmented
+    //   machine are shared copy-on-write, so a fork costs its registers
+    //   plus whatever either machine writes afterwards. A flat machine
+    //   is left as it is (a mapped one stays on its file), and its fork
+    //   gets segments holding a copy of the pages in use -- forks of that
+    //   fork are cheap (a machine with more than one tape is copied
+    //   outright)
+    BitDeviceMachine* Fork();
+
+    // Test for halt condition, and did the program halt on a return
+    //   stack fault rather than a HALT of its own
     bool  Halted();
+    bool  Faulted();
 
     // Read/Write symbol under the head
     uchar Read() const;
@@ -81,25 +311,189 @@ public:
     //Returns length of tape in symbols
     unsigned Tapelen();  
 
+    // Width in bits of the symbols on the tape(s)
+    unsigned Width() const;
+
+    // Bytes the machine holds: the whole buffer of a flat machine, the
+    //   pages written (or shared) of a segmented one
+    unsigned long Resident() const;
+
     // Set and get Head Position in symbols
     void     SetHead(unsigned p);
     unsigned GetHead() const;
 
+    // Number of working tapes, and the symbol under and position of
+    //   the head of tape t (tape 0 is the one the calls above use), its
+    //   length in symbols and the symbol at pos on it
+    unsigned TapeCount() const;
+    unsigned Tapelen(unsigned t) const;
+    uchar    Read(unsigned t) const;
+    unsigned GetHead(unsigned t) const;
+    uchar    ReadAt(unsigned t, unsigned pos) const;
+
     // Set and get current command
     unsigned GetCurrentCommand() const;
     void     SetCurrentCommand(unsigned idx);
+
+    // Number of commands and the transition TMState idx makes on symbol x
+    //    (returns false if command idx isn't a TMState)
+    unsigned CommandCount() const;
+    bool     Transition(unsigned idx, uchar x,
+			uchar &sym, int &dir, unsigned &nxt) const;
     
     // Execute a step
-    // Execute till halt
+    // Execute till halt (or the step limit)
+    // Execute till halt or till *stop is set (checked between steps, so
+    //    a signal handler can set it) or a breakpoint holds, adding the
+    //    steps run to steps -- returns false if stopped either way
     bool  ExecuteS();
     void  Execute(bool silent);
+    bool  Execute(bool silent, unsigned long &steps,
+		  volatile sig_atomic_t* stop);
+
+    // Steps Execute stops at (10000 unless set, 0 for no limit)
+    void  SetStepLimit(unsigned long n);
+
+    // Run Turing transitions natively (ExecuteT) from a state till the
+    //    machine halts, steps reaches until or a breakpoint holds (checked
+    //    after each transition). steps goes up by the ExecuteS steps each
+    //    transition stands for -- a pass through the bootstrap, or one --
+    //    so it counts as Execute and History do. Returns 0, or if a
+    //    breakpoint stopped it the steps the last transition stood for
+    //    (the point came to hold somewhere in them)
+    unsigned long ExecuteN(unsigned long &steps, unsigned long until);
+
+    // Check bp after each step a run takes -- Execute, ExecuteN,
+    //    ExecuteTable or the DeciderPipeline (none if bp is 0). The
+    //    caller keeps bp, and tells a breakpoint from *stop by bp->Last()
+    void  SetBreakpoints(Breakpoints* bp);
 
-    // Initialize machine from a file
-    // Write machine to file: as a bit string or member by member
+    // Execute a single Turing transition directly (no bootstrap)
+    //    returns false if halted or the current command isn't a TMState
+    //    or an MTState (ExecuteS runs MTStates this way too)
+    bool  ExecuteT();
+
+    // Bulk tape operations (positions in symbols)
+    //   set every symbol to x, write str ('0', '1', ' ') at pos, pos+1...,
+    //   copy in a tape of packed symbols (Tapelen()/4 bytes for 2-bit
+    //   symbols), count the 0s, 1s and
+    //   blanks (cnt[1] is the "ones written" score), find the leftmost and
+    //   rightmost symbol that isn't blank (false if there's none) and find
+    //   the first symbol that differs from other's (Tapelen() if none)
+    void     FillTape(uchar x);
+    void     LoadSymbols(unsigned pos, const char* str);
+    void     LoadPacked(const uchar* buf);
+    void     CountSymbols(unsigned long cnt[3]) const;
+    bool     Extent(unsigned &left, unsigned &right) const;
+    unsigned FirstDifference(const BitDeviceMachine &other) const;
+
+    // Copy the tape into/out of a bit-sliced BitPlaneTape (resized to
+    //   Tapelen() symbols on the way out)
+    void     GetPlanes(BitPlaneTape &t) const;
+    void     SetPlanes(const BitPlaneTape &t);
+
+    // Copy the Turing states of the command table into/out of a packed
+    //   TransitionTable (resized to CommandCount() rows on the way out;
+    //   on the way in, rows that aren't states leave their command as is)
+    void     GetTable(TransitionTable &t) const;
+    void     SetTable(const TransitionTable &t);
+
+    // Run up to maxSteps Turing transitions out of t (as GetTable fills
+    //   it in) rather than the command table -- a step is one table load
+    //   and a few shifts. Stops on halting, at a command that isn't a
+    //   Turing state or after a step a breakpoint holds for (the steps
+    //   counted from the call), and returns the number of steps taken
+    unsigned long ExecuteTable(const TransitionTable &t,
+			       unsigned long maxSteps);
+
+    // Length in bytes of a configuration (state, then head and tape
+    //   for each tape) and copy the current configuration into buf
+    unsigned ConfigLen() const;
+    void     GetConfig(uchar* buf) const;
+
+    // 64-bit hash of the configuration: the XOR of a key for the current
+    //   command, one for each head and one for each symbol that isn't
+    //   blank. Steps (ExecuteT, ExecuteTable, and ExecuteS through the
+    //   bootstrap), Write, SetHead and SetCurrentCommand update it in
+    //   O(1); anything else (a bulk tape operation, a new machine, an op
+    //   that writes a long run) leaves it to be worked out again, over
+    //   the symbols, at the next call. Equal configurations hash equal
+    uint64_t ConfigHash();
+
+    // The part of ConfigHash for the heads and symbols alone (the same
+    //   whatever the states are numbered), or if mirror the same for the
+    //   tapes turned end to end (worked out over the symbols)
+    uint64_t TapeHash(bool mirror=false);
+
+    // Compact encoding of a single-tape machine's state table, for keys:
+    //
+    //   n | start | <state 1> <state 2> ... <state n>
+    //
+    //   n and start are 16 bits (little endian) and <state i> is three
+    //   transitions, for reading 0, 1 and blank, of a byte sym | (dir+1)<<2
+    //   and a 16-bit next state. States are numbered from 1 in table order
+    //   from the first one and 0 is the halt command. 4+9n bytes -- returns
+    //   how many were written to buf (at most len), or 0 if the current
+    //   command and every command from the first state to the last aren't
+    //   TMStates with transitions among themselves or to halt
+    unsigned Encode(uchar* buf, unsigned len) const;
+
+    // Normal form of an encoding: the states renumbered from 1 at the
+    //   start state in the order they're reached, those that can't be
+    //   reached dropped, and left and right swapped if need be so the
+    //   first move is right (*mirrored says if they were -- the machine
+    //   then does on the mirrored tape what it did on this one). Machines
+    //   that differ only in these ways have the same normal form. Writes
+    //   at most len bytes to out and returns how many, or 0 if enc isn't
+    //   an encoding
+    static unsigned Canonicalize(const uchar* enc, unsigned len, uchar* out,
+				 bool* mirrored=0);
+
+    // Encode then Canonicalize -- 0 if it can't be encoded or len is too
+    //   short
+    unsigned Canonical(uchar* buf, unsigned len, bool* mirrored=0) const;
+
+    // Shrink a single-tape machine's state table to the states that can
+    //   be reached from the current one, with states that behave the same
+    //   (write, move and go to states that behave the same, on every
+    //   symbol) merged into one -- the machine runs as before, step for
+    //   step. The states left are written from the first state on in
+    //   table order, the spare commands after them made halts, and the
+    //   current command moved with its state. Returns how many states are
+    //   left, 0 if it can't be done (the current command or one from the
+    //   first state to the last isn't a TMState); map, if given, gets the
+    //   new index for each of the CommandCount() old ones (~0u for a state
+    //   that's gone), to translate traces with
+    unsigned Minimize(unsigned* map=0);
+
+    // Initialize machine from a file (version 2 or a legacy bare tape,
+    //   as written before or after the return stack was added to the
+    //   registers -- false if it can't be opened or doesn't check out)
+    // Write machine to file: as a version 2 file (see TapeFile.h) or
+    //   member by member
     bool  ReadFile(const char* name);
     bool  WriteFile(const char* name);
     bool  RewriteFile(const char* name);
 
+    // Bring the file a machine is shared-mapped on up to date (its
+    //   checksum, then the dirty pages) -- false if there's no such file
+    bool  SyncFile();
+
+    // Append a checkpoint of the machine, steps steps into its run, to
+    //   the log fname (see CheckpointLog.h). The first checkpoint to a
+    //   log is the whole tape and the ones after it only what changed
+    //   since: the pages of the tape written and the small parts (p, h,
+    //   registers, commands) that differ. For that the machine is moved
+    //   onto segments, as by Fork, so a checkpoint costs what was written
+    //   rather than the length of the tape. Checkpoint to one log at a
+    //   time. A machine with more than one tape is written whole each time
+    // Restore the machine to the last good checkpoint in fname (false if
+    //   there's none) and the steps it had run
+    // Fold a log into a single checkpoint of its last machine
+    bool  Checkpoint(const char* fname, unsigned long steps);
+    bool  Restore(const char* fname, unsigned long &steps);
+    static bool CompactLog(const char* fname);
+
     // Print machine to standard out
     void Print(unsigned opCnt);
 
@@ -0,0 +1,254 @@
+#include <assert.h>
+#include <string.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+#include "BitPlaneTape.h"
+
+// Low bit of every 2-bit symbol in a packed word
+#define LOBITS 0x5555555555555555ULL
+
+// Gather the even bits of a packed word into 32 bits, and spread 32
+//   bits back out to the even bits (pext/pdep where the CPU has them)
+static inline uint64_t evenBits(uint64_t x)
+{
+#ifdef __BMI2__
+    return _pext_u64(x, LOBITS);
+#else
+    x &= LOBITS;
+    x = (x | (x >> 1))  & 0x3333333333333333ULL;
+    x = (x | (x >> 2))  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4))  & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8))  & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return x;
+#endif
+}
+static inline uint64_t spreadBits(uint64_t x)
+{
+#ifdef __BMI2__
+    return _pdep_u64(x, LOBITS);
+#else
+    x &= 0x00000000FFFFFFFFULL;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8))  & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2))  & 0x3333333333333333ULL;
+    x = (x | (x << 1))  & LOBITS;
+    return x;
+#endif
+}
+
+// k (<= 64) bits of plane p starting at bit pos, and the other way round
+static inline uint64_t getBits(const uint64_t* p, unsigned pos, unsigned k)
+{
+    unsigned w = pos/64, o = pos%64;
+    uint64_t v = p[w] >> o;
+    if(o && o+k > 64) v |= p[w+1] << (64-o);
+    return (k == 64 ? v : v & ((1ULL<<k)-1));
+}
+static inline void putBits(uint64_t* p, unsigned pos, unsigned k, uint64_t v)
+{
+    unsigned w = pos/64, o = pos%64;
+    uint64_t m = (k == 64 ? ~0ULL : (1ULL<<k)-1);
+    v &= m;
+    p[w] = (p[w] & ~(m << o)) | (v << o);
+    if(o+k > 64)
+    {
+	unsigned r = o+k-64;
+	uint64_t rm = (1ULL<<r)-1;
+	p[w+1] = (p[w+1] & ~rm) | (v >> (64-o));
+    }
+}
+
+BitPlaneTape::BitPlaneTape(unsigned n)
+{
+    len = 0; words = 0; lo = 0; hi = 0;
+    Resize(n);
+}
+
+BitPlaneTape::~BitPlaneTape()
+{
+    delete [] lo;
+    delete [] hi;
+}
+
+// Make the tape n symbols long and blank
+void BitPlaneTape::Resize(unsigned n)
+{
+    delete [] lo;
+    delete [] hi;
+    len   = n;
+    words = (n+63)/64;
+    lo    = new uint64_t[words+1];  // One spare so getBits can look ahead
+    hi    = new uint64_t[words+1];
+    lo[words] = hi[words] = 0;
+    Fill(2);
+}
+
+unsigned        BitPlaneTape::Len()   const {return len;}
+unsigned        BitPlaneTape::Words() const {return words;}
+const uint64_t* BitPlaneTape::Lo()    const {return lo;}
+const uint64_t* BitPlaneTape::Hi()    const {return hi;}
+
+// Valid bits of word w -- all but the last are full
+uint64_t BitPlaneTape::mask(unsigned w) const
+{
+    if(w+1 < words || len%64 == 0) return ~0ULL;
+    return (1ULL<<(len%64))-1;
+}
+
+uchar BitPlaneTape::Get(unsigned i) const
+{
+    assert(i < len);
+    return ((hi[i/64]>>(i%64)) & 1)<<1 | ((lo[i/64]>>(i%64)) & 1);
+}
+
+void BitPlaneTape::Set(unsigned i, uchar x)
+{
+    assert(i < len && x < 3);
+    uint64_t b = 1ULL<<(i%64);
+    lo[i/64] = (x & 1 ? lo[i/64] | b : lo[i/64] & ~b);
+    hi[i/64] = (x & 2 ? hi[i/64] | b : hi[i/64] & ~b);
+}
+
+// Each 8 packed bytes (32 symbols) make half a word of each plane
+void BitPlaneTape::FromPacked(const uchar* buf)
+{
+    unsigned n = len/SYMPERBYTE, i = 0;
+    memset(lo, 0, words*sizeof(uint64_t));
+    memset(hi, 0, words*sizeof(uint64_t));
+    for(; i+8 <= n; i += 8)
+    {
+	uint64_t w;
+	memcpy(&w, buf+i, sizeof(w));
+	unsigned s = i*SYMPERBYTE;
+	lo[s/64] |= evenBits(w)    << (s%64);
+	hi[s/64] |= evenBits(w>>1) << (s%64);
+    }
+    for(; i < n; i++)
+    {
+	unsigned s = i*SYMPERBYTE;
+	lo[s/64] |= evenBits(buf[i])    << (s%64);
+	hi[s/64] |= evenBits(buf[i]>>1) << (s%64);
+    }
+}
+
+void BitPlaneTape::ToPacked(uchar* buf) const
+{
+    unsigned n = len/SYMPERBYTE, i = 0;
+    for(; i+8 <= n; i += 8)
+    {
+	unsigned s = i*SYMPERBYTE;
+	uint64_t w = spreadBits(lo[s/64] >> (s%64)) |
+	             spreadBits(hi[s/64] >> (s%64)) << 1;
+	memcpy(buf+i, &w, sizeof(w));
+    }
+    for(; i < n; i++)
+    {
+	unsigned s = i*SYMPERBYTE;
+	buf[i] = (spreadBits((lo[s/64] >> (s%64)) & 15) |
+		  spreadBits((hi[s/64] >> (s%64)) & 15) << 1);
+    }
+}
+
+void BitPlaneTape::Fill(uchar x)
+{
+    assert(x < 3);
+    for(unsigned w=0; w<words; w++)
+    {
+	lo[w] = (x & 1 ? mask(w) : 0);
+	hi[w] = (x & 2 ? mask(w) : 0);
+    }
+}
+
+void BitPlaneTape::Count(unsigned long cnt[3]) const
+{
+    cnt[0] = cnt[1] = cnt[2] = 0;
+    for(unsigned w=0; w<words; w++)
+    {
+	cnt[0] += __builtin_popcountll(~lo[w] & ~hi[w] & mask(w));
+	cnt[1] += __builtin_popcountll( lo[w] & ~hi[w]);
+	cnt[2] += __builtin_popcountll(~lo[w] &  hi[w]);
+    }
+}
+
+unsigned BitPlaneTape::FirstDiff(const BitPlaneTape &o) const
+{
+    assert(len == o.len);
+    for(unsigned w=0; w<words; w++)
+    {
+	uint64_t d = (lo[w] ^ o.lo[w]) | (hi[w] ^ o.hi[w]);
+	if(d) return 64*w + __builtin_ctzll(d);
+    }
+    return len;
+}
+
+bool BitPlaneTape::operator==(const BitPlaneTape &o) const
+{
+    return (len == o.len && FirstDiff(o) == len);
+}
+
+// A symbol is blank where hi is set and lo isn't
+unsigned BitPlaneTape::FirstNonBlank() const
+{
+    for(unsigned w=0; w<words; w++)
+    {
+	uint64_t d = (lo[w] | ~hi[w]) & mask(w);
+	if(d) return 64*w + __builtin_ctzll(d);
+    }
+    return len;
+}
+
+unsigned BitPlaneTape::LastNonBlank() const
+{
+    for(unsigned w=words; w>0; w--)
+    {
+	uint64_t d = (lo[w-1] | ~hi[w-1]) & mask(w-1);
+	if(d) return 64*(w-1) + 63-__builtin_clzll(d);
+    }
+    return len;
+}
+
+// Symbols that differ from x are set in (lo^xlo)|(hi^xhi)
+unsigned BitPlaneTape::RunEnd(unsigned i) const
+{
+    assert(i < len);
+    uchar    x   = Get(i);
+    uint64_t xlo = (x & 1 ? ~0ULL : 0);
+    uint64_t xhi = (x & 2 ? ~0ULL : 0);
+    uint64_t below = (1ULL<<(i%64))-1;
+    for(unsigned w=i/64; w<words; w++, below=0)
+    {
+	uint64_t d = ((lo[w] ^ xlo) | (hi[w] ^ xhi)) & mask(w) & ~below;
+	if(d) return 64*w + __builtin_ctzll(d);
+    }
+    return len;
+}
+
+// Copy 64 bits at a time -- upwards if the copy moves down, downwards if
+//   it moves up, so overlapping bits are read before they're written
+void BitPlaneTape::moveBits(uint64_t* p, unsigned d, unsigned s, unsigned n)
+{
+    if(d == s || n == 0) return;
+    if(d < s)
+	for(unsigned i=0; i<n; i+=64)
+	{
+	    unsigned k = (n-i < 64 ? n-i : 64);
+	    putBits(p, d+i, k, getBits(p, s+i, k));
+	}
+    else
+	for(unsigned i=n; i>0; )
+	{
+	    unsigned k = (i < 64 ? i : 64);
+	    i -= k;
+	    putBits(p, d+i, k, getBits(p, s+i, k));
+	}
+}
+
+void BitPlaneTape::Move(unsigned dst, unsigned src, unsigned n)
+{
+    assert(dst+n <= len && src+n <= len);
+    moveBits(lo, dst, src, n);
+    moveBits(hi, dst, src, n);
+}
@@ -0,0 +1,83 @@
+#ifndef BITPLANETAPE_H
+#define BITPLANETAPE_H
+
+#include <stdint.h>
+#include "syntactic_sugar.h"
+
+// A BitPlaneTape holds a tape of symbols bit-sliced into two planes of
+//   64-bit words: lo holds the low bit of every symbol and hi the high
+//   bit, so symbol i is bit i%64 of word i/64 of both:
+//
+//   symbol   |  0  |  1  |  2  (blank)
+//   hi : lo  | 0:0 | 0:1 | 1:0
+//
+// Counting, comparing, finding runs and moving regions are then plain
+//   word operations and popcounts over 64 symbols at a time instead of
+//   shuffling interleaved bit pairs. Conversion to and from the packed
+//   layout of a WorkingTape (four symbols to a byte) is lossless.
+//   Bits past the end of the tape are kept 0 in both planes
+class BitPlaneTape
+{
+private:
+    // Private data members
+    unsigned  len;   // Symbols
+    unsigned  words; // Words in each plane
+    uint64_t* lo;    // Low bits
+    uint64_t* hi;    // High bits
+
+    // Mask of the valid bits of word w
+    uint64_t mask(unsigned w) const;
+
+    // Copy n bits from bit s to bit d of plane p (regions may overlap)
+    static void moveBits(uint64_t* p, unsigned d, unsigned s, unsigned n);
+
+    // Not copyable
+    BitPlaneTape(const BitPlaneTape&);
+    BitPlaneTape& operator=(const BitPlaneTape&);
+
+public:
+    // A blank tape of len symbols
+    BitPlaneTape(unsigned len=0);
+    ~BitPlaneTape();
+
+    // Make the tape len symbols long and blank
+    void Resize(unsigned len);
+
+    // Length in symbols and the planes (Words() words each)
+    unsigned        Len() const;
+    unsigned        Words() const;
+    const uint64_t* Lo() const;
+    const uint64_t* Hi() const;
+
+    // Read/write symbol i
+    uchar Get(unsigned i) const;
+    void  Set(unsigned i, uchar x);
+
+    // Convert from/to packed symbols (Len()/4 bytes)
+    void FromPacked(const uchar* buf);
+    void ToPacked(uchar* buf) const;
+
+    // Set every symbol to x
+    void Fill(uchar x);
+
+    // Count the 0s, 1s and blanks
+    void Count(unsigned long cnt[3]) const;
+
+    // First symbol that differs from other's (Len() if none) -- the
+    //   tapes must be the same length
+    unsigned FirstDiff(const BitPlaneTape &other) const;
+    bool     operator==(const BitPlaneTape &other) const;
+
+    // First/last symbol that isn't blank (Len() if none)
+    unsigned FirstNonBlank() const;
+    unsigned LastNonBlank() const;
+
+    // End of the run of equal symbols starting at i: the first
+    //   position past i with a different symbol (Len() if none)
+    unsigned RunEnd(unsigned i) const;
+
+    // Copy n symbols from position src to position dst (may overlap)
+    void Move(unsigned dst, unsigned src, unsigned n);
+};
+
+#endif
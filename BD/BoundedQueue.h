@@ -0,0 +1,134 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <atomic>
+
+// A BoundedQueue is a fixed capacity, lock-free, multi-producer/
+//   multi-consumer ring of T's (after D. Vyukov's bounded MPMC queue)
+//
+// Each cell carries a sequence number that tells producers and consumers
+//   whose turn it is:
+//      seq == pos      cell is empty and may be filled by the producer at pos
+//      seq == pos+1    cell is full and may be drained by the consumer at pos
+//   Producers and consumers claim a position with a CAS on head/tail and
+//   never wait on each other except when the queue is full or empty
+//
+// Capacity is rounded up to a power of two so positions wrap with a mask
+template <class T>
+class BoundedQueue
+{
+private:
+    struct Cell
+    {
+	std::atomic<unsigned long> seq;
+	T                          data;
+    };
+
+    // Private data members -- head and tail on their own cache lines
+    Cell*                                  cells;
+    unsigned long                          mask;
+    alignas(64) std::atomic<unsigned long> head; // Next position to fill
+    alignas(64) std::atomic<unsigned long> tail; // Next position to drain
+
+    // Not copyable
+    BoundedQueue(const BoundedQueue&);
+    BoundedQueue& operator=(const BoundedQueue&);
+
+public:
+    BoundedQueue(unsigned capacity);
+    ~BoundedQueue();
+
+    // Add x to the queue -- returns false if the queue is full
+    bool Push(const T& x);
+
+    // Remove the oldest entry into x -- returns false if the queue is empty
+    bool Pop(T& x);
+
+    // Number of entries in the queue (approximate while others are active)
+    unsigned Depth() const;
+    unsigned Capacity() const;
+};
+
+template <class T>
+BoundedQueue<T>::BoundedQueue(unsigned capacity)
+{
+    unsigned long n = 2;
+    while(n < capacity) n *= 2;
+
+    cells = new Cell[n];
+    mask  = n-1;
+    for(unsigned long i=0; i<n; i++)
+	cells[i].seq.store(i, std::memory_order_relaxed);
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+}
+
+template <class T>
+BoundedQueue<T>::~BoundedQueue()
+{delete [] cells;}
+
+template <class T>
+bool BoundedQueue<T>::Push(const T& x)
+{
+    unsigned long pos = head.load(std::memory_order_relaxed);
+    for(;;)
+    {
+	Cell* cell = &cells[pos & mask];
+	unsigned long seq = cell->seq.load(std::memory_order_acquire);
+	long dif = (long)seq - (long)pos;
+	if(dif == 0)
+	{
+	    // Cell is empty -- try to claim pos
+	    if(head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+	    {
+		cell->data = x;
+		cell->seq.store(pos+1, std::memory_order_release);
+		return true;
+	    }
+	}
+	else if(dif < 0)
+	    return false; // Full: the consumer one lap behind hasn't drained it
+	else
+	    pos = head.load(std::memory_order_relaxed);
+    }
+}
+
+template <class T>
+bool BoundedQueue<T>::Pop(T& x)
+{
+    unsigned long pos = tail.load(std::memory_order_relaxed);
+    for(;;)
+    {
+	Cell* cell = &cells[pos & mask];
+	unsigned long seq = cell->seq.load(std::memory_order_acquire);
+	long dif = (long)seq - (long)(pos+1);
+	if(dif == 0)
+	{
+	    // Cell is full -- try to claim pos
+	    if(tail.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+	    {
+		x = cell->data;
+		cell->seq.store(pos+mask+1, std::memory_order_release);
+		return true;
+	    }
+	}
+	else if(dif < 0)
+	    return false; // Empty: the producer hasn't filled it yet
+	else
+	    pos = tail.load(std::memory_order_relaxed);
+    }
+}
+
+template <class T>
+unsigned BoundedQueue<T>::Depth() const
+{
+    unsigned long h = head.load(std::memory_order_relaxed);
+    unsigned long t = tail.load(std::memory_order_relaxed);
+    return (h > t ? (unsigned)(h-t) : 0);
+}
+
+template <class T>
+unsigned BoundedQueue<T>::Capacity() const
+{return (unsigned)(mask+1);}
+
+#endif
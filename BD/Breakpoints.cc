@@ -0,0 +1,208 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Breakpoints.h"
+
+// Names of the kinds for Print
+static const char* kindName[] = {"state", "trans", "step", "head", "cell", "reg"};
+
+Breakpoints::Breakpoints()
+{
+    cnt      = 0;
+    cap      = 16;
+    pts      = (Point*)malloc(cap*sizeof(Point));
+    assert(pts);
+    scan     = 0;
+    onCmd    = 0;
+    onCmdLen = 0;
+    last     = -1;
+}
+
+Breakpoints::~Breakpoints()
+{
+    free(pts);
+    free(onCmd);
+}
+
+unsigned Breakpoints::add(KIND k, unsigned a, unsigned x, unsigned long n)
+{
+    if(cnt == cap)
+    {
+	cap *= 2;
+	pts = (Point*)realloc(pts, cap*sizeof(Point));
+	assert(pts);
+    }
+    Point &p = pts[cnt];
+    p.kind  = k;
+    p.a     = a;
+    p.x     = x;
+    p.n     = n;
+    p.seen  = 0;
+    p.armed = false;
+    p.live  = true;
+
+    // Command conditions are found by index, the others are scanned
+    if(k == STATE || k == TRANS)
+    {
+	if(a >= onCmdLen)
+	{
+	    unsigned len = 2*a+16;
+	    onCmd = (uchar*)realloc(onCmd, len);
+	    assert(onCmd);
+	    memset(onCmd+onCmdLen, 0, len-onCmdLen);
+	    onCmdLen = len;
+	}
+	assert(onCmd[a] < 255);
+	onCmd[a]++;
+    }
+    else
+	scan++;
+    return cnt++;
+}
+
+unsigned Breakpoints::BreakState(unsigned s)
+{return add(STATE, s, 0, 0);}
+unsigned Breakpoints::BreakTransition(unsigned s, unsigned x)
+{return add(TRANS, s, x, 0);}
+unsigned Breakpoints::BreakStep(unsigned long n)
+{return add(STEP, 0, 0, n);}
+unsigned Breakpoints::BreakHead(unsigned pos, unsigned t)
+{assert(t < MAXTAPES); return add(HEAD, pos, t, 0);}
+unsigned Breakpoints::WatchCell(unsigned pos, unsigned t)
+{assert(t < MAXTAPES); return add(CELL, pos, t, 0);}
+unsigned Breakpoints::WatchReg(unsigned r)
+{assert(r < MAXREGS); return add(REG, r, 0, 0);}
+
+bool Breakpoints::Delete(unsigned i)
+{
+    if(i >= cnt || !pts[i].live) return false;
+    pts[i].live = false;
+    if(pts[i].kind == STATE || pts[i].kind == TRANS)
+	onCmd[pts[i].a]--;
+    else
+	scan--;
+    return true;
+}
+
+void Breakpoints::Clear()
+{
+    cnt  = 0;
+    scan = 0;
+    last = -1;
+    if(onCmd) memset(onCmd, 0, onCmdLen);
+}
+
+unsigned Breakpoints::Count() const
+{
+    unsigned n = 0;
+    for(unsigned i=0; i<cnt; i++)
+	if(pts[i].live) n++;
+    return n;
+}
+
+int Breakpoints::Last() const {return last;}
+
+bool Breakpoints::WatchesRegs() const
+{
+    for(unsigned i=0; i<cnt; i++)
+	if(pts[i].live && pts[i].kind == REG) return true;
+    return false;
+}
+
+// What a watchpoint (or a head point) watches -- a tape it watches may
+//   not be there
+unsigned Breakpoints::value(BitDeviceMachine &m, const Point &p) const
+{
+    if(p.kind == REG) return m.getRegisters()[p.a];
+    if(p.kind == HEAD)
+	return (p.x < m.TapeCount() ? m.GetHead(p.x) : ~0u);
+    if(p.x >= m.TapeCount() || p.a >= m.Tapelen(p.x)) return 0;
+    return m.ReadAt(p.x, p.a);
+}
+
+void Breakpoints::Rearm(BitDeviceMachine &m)
+{
+    for(unsigned i=0; i<cnt; i++)
+	if(pts[i].live && pts[i].kind >= HEAD)
+	{
+	    pts[i].seen  = value(m, pts[i]);
+	    pts[i].armed = true;
+	}
+}
+
+// The command first (a lookup), then whatever has to be scanned. Every
+//   watchpoint takes in what it sees, so two changes in one step are
+//   reported once, and a head point only holds when the head gets there
+//   (a Turing step through the bootstrap leaves it put for 33 steps)
+bool Breakpoints::Hit(BitDeviceMachine &m, unsigned long steps)
+{return HitSince(m, steps-1, steps);}
+
+bool Breakpoints::HitSince(BitDeviceMachine &m, unsigned long from,
+			   unsigned long steps)
+{
+    last = -1;
+    unsigned idx = m.GetCurrentCommand();
+    if(idx < onCmdLen && onCmd[idx])
+	for(unsigned i=0; i<cnt && last < 0; i++)
+	{
+	    Point &p = pts[i];
+	    if(!p.live || p.a != idx) continue;
+	    if(p.kind == STATE ||
+	       (p.kind == TRANS && m.Read() == p.x))
+		last = i;
+	}
+
+    for(unsigned i=0, k=0; k<scan; i++)
+    {
+	Point &p = pts[i];
+	if(!p.live || p.kind == STATE || p.kind == TRANS) continue;
+	k++;
+	bool hit = false;
+	switch(p.kind)
+	{
+	case STEP:
+	    hit = (from < p.n && p.n <= steps);
+	    break;
+	case HEAD:
+	case CELL:
+	case REG:
+	{
+	    unsigned v = value(m, p);
+	    hit     = (p.armed && v != p.seen &&
+		       (p.kind != HEAD || v == p.a));
+	    p.seen  = v;
+	    p.armed = true;
+	    break;
+	}
+	default:
+	    break;
+	}
+	if(hit && last < 0) last = i;
+    }
+    return (last >= 0);
+}
+
+void Breakpoints::Print(FILE* f, unsigned i) const
+{
+    assert(i < cnt);
+    const Point &p = pts[i];
+    fprintf(f, "%u: %s", i, kindName[p.kind]);
+    switch(p.kind)
+    {
+    case STATE: fprintf(f, " %u", p.a);                     break;
+    case TRANS: fprintf(f, " %u reading %u", p.a, p.x);     break;
+    case STEP:  fprintf(f, " %lu", p.n);                    break;
+    case HEAD:
+    case CELL:  fprintf(f, " %u on tape %u", p.a, p.x);     break;
+    case REG:   fprintf(f, " %u", p.a);                     break;
+    }
+    if(p.kind == CELL || p.kind == REG)
+	fprintf(f, " = %u", p.seen);
+    fprintf(f, "\n");
+}
+
+void Breakpoints::Print(FILE* f) const
+{
+    for(unsigned i=0; i<cnt; i++)
+	if(pts[i].live) Print(f, i);
+}
@@ -0,0 +1,94 @@
+#ifndef BREAKPOINTS_H
+#define BREAKPOINTS_H
+
+#include <stdio.h>
+#include "BitDeviceMachine.h"
+
+// Breakpoints are conditions to stop a run on, checked between steps:
+//
+//     STATE : the current command is the state s
+//     TRANS : the current command is the state s and it reads x
+//     STEP  : n steps have run
+//     HEAD  : the head of tape t has moved to symbol pos
+//     CELL  : the symbol at pos on tape t has changed (a watchpoint)
+//     REG   : register r has changed (a watchpoint)
+//
+//   A machine checks them after each step once given them with
+//   BitDeviceMachine::SetBreakpoints -- with none given the check is a
+//   single test of a null pointer. Native runs (ExecuteN, ExecuteTable,
+//   the DeciderPipeline) check them after each Turing step, so a point
+//   that holds part way through a pass through the bootstrap is only
+//   seen at the end of it, and registers aren't kept as the bootstrap
+//   keeps them. Conditions on the current command
+//   are a byte lookup by command index, so only the points of the other
+//   kinds are gone through each step. A watchpoint (and a head point)
+//   compares with what it saw last time; Rearm has them all look again
+//   (after the machine has been moved to another step, say)
+class Breakpoints
+{
+public:
+    enum KIND { STATE, TRANS, STEP, HEAD, CELL, REG };
+
+private:
+    struct Point
+    {
+	KIND          kind;
+	unsigned      a;     // State, position or register
+	unsigned      x;     // Symbol read (TRANS), tape (HEAD and CELL)
+	unsigned long n;     // Step (STEP)
+	unsigned      seen;  // Value last seen (HEAD, CELL and REG)
+	bool          armed; //   once it has been seen
+	bool          live;  // Not deleted
+    };
+
+    Point*   pts;
+    unsigned cnt;
+    unsigned cap;
+    unsigned scan;    // Live points that aren't about the command
+    uchar*   onCmd;   // Per command index: live STATE/TRANS points on it
+    unsigned onCmdLen;
+    int      last;    // Point that stopped the last run (-1 if none)
+
+    // Add a point, and the value a watchpoint watches now
+    unsigned add(KIND k, unsigned a, unsigned x, unsigned long n);
+    unsigned value(BitDeviceMachine &m, const Point &p) const;
+
+public:
+    Breakpoints();
+    ~Breakpoints();
+
+    // Add a point and return its number
+    unsigned BreakState(unsigned s);
+    unsigned BreakTransition(unsigned s, unsigned x);
+    unsigned BreakStep(unsigned long n);
+    unsigned BreakHead(unsigned pos, unsigned t=0);
+    unsigned WatchCell(unsigned pos, unsigned t=0);
+    unsigned WatchReg(unsigned r);
+
+    // Delete point i (false if there's no such point), or every point
+    bool     Delete(unsigned i);
+    void     Clear();
+
+    // Live points
+    unsigned Count() const;
+
+    // Have the watchpoints take what they watch now as what they saw
+    void     Rearm(BitDeviceMachine &m);
+
+    // True if a point holds for m, steps steps into its run -- Last is
+    //   then the first that did. HitSince is for a run that went from
+    //   step from to steps in one go: a STEP point in between holds
+    bool     Hit(BitDeviceMachine &m, unsigned long steps);
+    bool     HitSince(BitDeviceMachine &m, unsigned long from,
+		      unsigned long steps);
+    int      Last() const;
+
+    // Is a register watched (which only a step at a time can tell)
+    bool     WatchesRegs() const;
+
+    // Print point i, or all of them, a line each
+    void     Print(FILE* f, unsigned i) const;
+    void     Print(FILE* f) const;
+};
+
+#endif
@@ -0,0 +1,85 @@
+//=====================================================================================
+// Default constructor (never called -- everything is static)
+BitDeviceMachine::CheckpointLog::CheckpointLog()
+{assert("Default constructor for CheckpointLog should never be called");}
+
+// Append a record and its payload in one write
+bool BitDeviceMachine::CheckpointLog::Append(const char* fname, Record &r,
+					     const uchar* payload)
+{
+    std::ofstream lfile(fname, std::ofstream::out | std::ofstream::binary |
+			       std::ofstream::app);
+    if (!lfile) return false;
+    r.magic    = MAGIC;
+    r.checksum = TapeFile::Checksum(payload, r.len);
+    lfile.write((char*)&r, sizeof(Record));
+    lfile.write((char*)payload, r.len);
+    lfile.close();
+    return !lfile.fail();
+}
+
+// Read the log a record at a time, applying each to the tape
+uchar* BitDeviceMachine::CheckpointLog::Replay(const char* fname,
+					       Allocator* al, unsigned &len,
+					       unsigned long &steps,
+					       unsigned &records)
+{
+    std::ifstream lfile(fname, std::ifstream::in | std::ifstream::binary);
+    len = 0; steps = 0; records = 0;
+    if (!lfile) return 0;
+
+    uchar*   tape = 0;
+    uchar*   buf  = 0;
+    unsigned bufLen = 0;
+    Record   r;
+    while (lfile.read((char*)&r, sizeof(Record)))
+    {
+	if (r.magic != MAGIC || (r.kind != BASE && r.kind != DELTA)) break;
+	if (r.kind == DELTA && !tape) break;
+	if (r.len > bufLen)
+	{
+	    delete [] buf;
+	    buf    = new uchar[r.len];
+	    bufLen = r.len;
+	}
+	if (!lfile.read((char*)buf, r.len)) break;
+	if (r.checksum != TapeFile::Checksum(buf, r.len)) break;
+
+	if (r.kind == BASE)
+	{
+	    if (tape) al->Free(tape, len);
+	    len  = r.len;
+	    tape = al->Alloc(len);
+	    memcpy(tape, buf, len);
+	}
+	else
+	{
+	    // Check every chunk fits before touching the tape
+	    bool     ok = true;
+	    unsigned o  = 0;
+	    for (unsigned k=0; ok && k<r.chunks; k++)
+	    {
+		Chunk ch;
+		ok = (r.len-o >= sizeof(Chunk));
+		if (!ok) break;
+		memcpy(&ch, buf+o, sizeof(Chunk));
+		o += sizeof(Chunk);
+		ok = (ch.n <= r.len-o && ch.addr <= len && ch.n <= len-ch.addr);
+		o += ch.n;
+	    }
+	    if (!ok || o != r.len) break;
+	    o = 0;
+	    for (unsigned k=0; k<r.chunks; k++)
+	    {
+		Chunk ch;
+		memcpy(&ch, buf+o, sizeof(Chunk));
+		memcpy(tape+ch.addr, buf+o+sizeof(Chunk), ch.n);
+		o += sizeof(Chunk)+ch.n;
+	    }
+	}
+	steps = r.steps;
+	records++;
+    }
+    delete [] buf;
+    return tape;
+}
@@ -0,0 +1,70 @@
+#ifndef CHECKPOINTLOG_H
+#define CHECKPOINTLOG_H
+
+// Layout of a checkpoint log
+//
+// A checkpoint log is a file of records, only ever appended to:
+//
+//   <record 0> <record 1> ... <record n-1>
+//
+//   where a record is a header and a payload of len bytes:
+//
+//     magic    | "BDCK"                                    4 bytes
+//     kind     | BASE or DELTA                             4 bytes
+//     steps    | steps the machine had run                 8 bytes
+//     p        | current command (bit offset)              4 bytes
+//     h        | head of the first working tape            4 bytes
+//     chunks   | chunks in a DELTA's payload               4 bytes
+//     len      | bytes of payload                          4 bytes
+//     checksum | 64-bit FNV-1a of the payload              8 bytes
+//
+//   A BASE's payload is the whole flat tape (as in a machine file). A
+//   DELTA's is chunks of the tape that changed since the record before:
+//
+//     addr     | byte address on the tape                  4 bytes
+//     n        | bytes                                     4 bytes
+//     bytes    | the n bytes now at addr                   n bytes
+//
+// The machine after record i is the last BASE at or before i with the
+//   DELTAs after it applied in order. A record that is cut short or
+//   doesn't match its checksum (a crash while appending) ends the log
+class CheckpointLog
+{
+private:
+    friend class BitDeviceMachine;
+
+    enum { MAGIC = 0x4B434442, BASE = 1, DELTA = 2 };
+
+    struct Record
+    {
+	unsigned magic;
+	unsigned kind;
+	uint64_t steps;
+	unsigned p;
+	unsigned h;
+	unsigned chunks;
+	unsigned len;
+	uint64_t checksum;
+    };
+
+    struct Chunk
+    {
+	unsigned addr;
+	unsigned n;
+    };
+
+    // Default constructor (never called -- everything is static)
+    CheckpointLog();
+
+    // Append a record of kind with len bytes of payload to fname (the
+    //   checksum is filled in here)
+    static bool Append(const char* fname, Record &r, const uchar* payload);
+
+    // Replay fname into a flat tape taken from al (0 if there's no good
+    //   BASE): its length, the steps of the last good record and the
+    //   number of good records
+    static uchar* Replay(const char* fname, Allocator* al, unsigned &len,
+			 unsigned long &steps, unsigned &records);
+};
+
+#endif
@@ -38,6 +38,8 @@ void BitDeviceMachine::Command::DBGPRINT()
     {
     case Command::OPTMST: 
     {fprintf(DBGFILE, "OPTMST: ");TMState* s = (TMState*)this;s->DBGPRINT();break;}
+    case Command::OPTMMT: 
+    {fprintf(DBGFILE, "OPTMMT: ");MTState* s = (MTState*)this;s->DBGPRINT();break;}
     case Command::OPCLRR: 
     {fprintf(DBGFILE, "CLRR: \n"); break;}
     case Command::OPLOAD: 
@@ -58,6 +60,22 @@ void BitDeviceMachine::Command::DBGPRINT()
     {fprintf(DBGFILE, "HALT()\n");break;}
     case Command::OPRTRN: 
     {fprintf(DBGFILE, "RTRN()\n");break;}
+    case Command::OPBCPY: 
+    {fprintf(DBGFILE, "BCPY(%i, %i, %i)\n", arg[0], arg[1], arg[2]);break;}
+    case Command::OPSFIL: 
+    {fprintf(DBGFILE, "SFIL(%i, %i, %i)\n", arg[0], arg[1], arg[2]);break;}
+    case Command::OPBCMP: 
+    {fprintf(DBGFILE, "BCMP(%i, %i, %i)\n", arg[0], arg[1], arg[2]);break;}
+    case Command::OPJMPZ: 
+    {fprintf(DBGFILE, "JMPZ(%i, %i, %i)\n", arg[0], arg[1], arg[2]);break;}
+    case Command::OPJMNZ: 
+    {fprintf(DBGFILE, "JMNZ(%i, %i, %i)\n", arg[0], arg[1], arg[2]);break;}
+    case Command::OPJMLT: 
+    {fprintf(DBGFILE, "JMLT(%i, %i, %i)\n", arg[0], arg[1], arg[2]);break;}
+    case Command::OPCALL: 
+    {fprintf(DBGFILE, "CALL(%i)\n", arg[2]);break;}
+    case Command::OPRETN: 
+    {fprintf(DBGFILE, "RETN()\n");break;}
     default:
     {assert("Invalid opCode");break;}
     }
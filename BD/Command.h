@@ -8,6 +8,11 @@
 //    command  |    as args to command          | to next cmd  |
 //     32b     |    32b   +    32b   +    32b   |   32b
 //             Total size: 5 words/ 20 bytes/ 160 bits
+//
+// The branches JMPZ/JMNZ/JMLT compare the registers arg1 and arg2 and go
+//   to the command at bit offset arg3 instead of nxtCmd if they're
+//   equal/not equal/arg1 is less. CALL pushes nxtCmd on the return stack
+//   and goes to arg3; RETN pops the offset to go to
 class Command
 {
 private:
@@ -24,7 +29,9 @@ private:
 
     enum OPCODE { OPCLRR, OPLOAD, OPWRDR, OPSYMR, OPMULT,
 		  OPADDN, OPWRDW, OPSYMW, OPHALT, OPRTRN,
-		  OPTMST=1235};
+		  OPBCPY, OPSFIL, OPBCMP, OPJMPZ, OPJMNZ,
+		  OPJMLT, OPCALL, OPRETN,
+		  OPTMST=1235, OPTMMT=1236};
     void Init(OPCODE oc, int ar1, int ar2, int ar3, unsigned nxt);
 
     // Convert CMDIDX into bit offset from tape start and back again
@@ -0,0 +1,429 @@
+#include <assert.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <chrono>
+#include "DeciderPipeline.h"
+#include "Breakpoints.h"
+
+DeciderPipeline::DeciderPipeline()
+{
+    // One worker per stage and budgets that keep the cheap stages short
+    for(int s=0; s<STAGECNT; s++)
+    {
+	workers[s] = 1;
+	q[s]       = 0;
+    }
+    budget[DIRECT] = 1000;
+    budget[CYCLE]  = 100000;
+    budget[ACCEL]  = 10000000;
+    budget[STATIC] = 0;
+    queueLen = 1024;
+    done     = 0;
+    doneArg  = 0;
+    db       = 0;
+    pool     = 0;
+    poolLen  = 0;
+    startNs  = 0;
+    stopNs   = 0;
+    outstanding.store(0);
+    closed.store(false);
+}
+
+DeciderPipeline::~DeciderPipeline()
+{
+    if(pool) Finish();
+    for(int s=0; s<STAGECNT; s++)
+	delete q[s];
+}
+
+// Configuration (before Start)
+void DeciderPipeline::SetWorkers(STAGE s, unsigned n)
+{assert(!pool && s < STAGECNT && n > 0); workers[s] = n;}
+void DeciderPipeline::SetBudget(STAGE s, unsigned long n)
+{assert(!pool && s < STAGECNT); budget[s] = n;}
+void DeciderPipeline::SetQueueLen(unsigned n)
+{assert(!pool && n > 0); queueLen = n;}
+void DeciderPipeline::SetDone(DONEFN fn, void* arg)
+{assert(!pool); done = fn; doneArg = arg;}
+void DeciderPipeline::SetResults(ResultsDB* rdb)
+{assert(!pool); db = rdb;}
+
+unsigned long DeciderPipeline::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Make the queues and start every stage's workers
+void DeciderPipeline::Start()
+{
+    assert(!pool);
+    for(int s=0; s<STAGECNT; s++)
+    {
+	delete q[s];
+	q[s] = new BoundedQueue<Job*>(queueLen);
+	stats[s].in       = 0;
+	stats[s].decided  = 0;
+	stats[s].steps    = 0;
+	stats[s].busyNs   = 0;
+	stats[s].maxDepth = 0;
+    }
+    outstanding = 0;
+    cached      = 0;
+    closed      = false;
+    startNs     = now();
+    stopNs      = 0;
+
+    poolLen = 0;
+    for(int s=0; s<STAGECNT; s++)
+	poolLen += workers[s];
+    pool = new std::thread[poolLen];
+    unsigned t = 0;
+    for(int s=0; s<STAGECNT; s++)
+	for(unsigned w=0; w<workers[s]; w++)
+	    pool[t++] = std::thread(&DeciderPipeline::work, this, s);
+}
+
+void DeciderPipeline::Submit(Job* j)
+{
+    assert(pool && !closed);
+    j->verdict = UNDECIDED;
+    j->stage   = -1;
+    j->steps   = 0;
+    j->ones    = 0;
+    j->cached  = false;
+    j->stopped = false;
+    j->keyed   = (db && ResultsDB::KeyOf(*j->m, j->key));
+    outstanding++;
+
+    // Decided before?
+    ResultsDB::Result r;
+    if(j->keyed && db->Get(j->key, r))
+    {
+	j->verdict = (VERDICT)r.verdict;
+	j->stage   = r.decider;
+	j->steps   = r.steps;
+	j->ones    = r.ones;
+	j->cached  = true;
+	cached++;
+	complete(j);
+	return;
+    }
+    forward(DIRECT, j);
+}
+
+// Close the pipeline, wait for the queues to drain and join the workers
+void DeciderPipeline::Finish()
+{
+    if(!pool) return;
+    closed = true;
+    for(unsigned t=0; t<poolLen; t++)
+	pool[t].join();
+    delete [] pool;
+    pool    = 0;
+    poolLen = 0;
+    stopNs  = now();
+}
+
+// Hand j to stage s -- back off while the stage's queue is full
+void DeciderPipeline::forward(unsigned s, Job* j)
+{
+    for(unsigned spin=0; !q[s]->Push(j); spin++)
+	if(spin < 64) sched_yield(); else usleep(50);
+
+    // Track the high water mark of the queue depth
+    unsigned d = q[s]->Depth();
+    unsigned m = stats[s].maxDepth.load(std::memory_order_relaxed);
+    while(d > m && !stats[s].maxDepth.compare_exchange_weak(m, d))
+	;
+}
+
+// Note the score of a machine just decided and keep its result
+void DeciderPipeline::complete(Job* j)
+{
+    if(!j->cached && j->verdict != UNDECIDED)
+    {
+	unsigned long cnt[3];
+	j->m->CountSymbols(cnt);
+	j->ones = cnt[1];
+	if(j->keyed)
+	{
+	    ResultsDB::Result r;
+	    r.verdict = j->verdict;
+	    r.decider = j->stage;
+	    r.steps   = j->steps;
+	    r.ones    = j->ones;
+	    db->Put(j->key, r);
+	}
+    }
+    if(done) done(j, doneArg);
+    outstanding--;
+}
+
+// Take jobs off stage s's queue until the pipeline is closed and empty
+void DeciderPipeline::work(unsigned s)
+{
+    unsigned idle = 0;
+    for(;;)
+    {
+	Job* j;
+	if(!q[s]->Pop(j))
+	{
+	    if(closed && outstanding == 0) return;
+	    if(idle++ < 64) sched_yield(); else usleep(100);
+	    continue;
+	}
+	idle = 0;
+
+	unsigned long t0    = now();
+	unsigned long steps = j->steps;
+	bool decided = false;
+	switch(s)
+	{
+	case DIRECT: decided = direct(j); break;
+	case CYCLE:  decided = cycle(j);  break;
+	case ACCEL:  decided = accel(j);  break;
+	case STATIC: decided = statik(j); break;
+	}
+	stats[s].busyNs += now()-t0;
+	stats[s].steps  += j->steps-steps;
+	stats[s].in++;
+
+	// Decided jobs and those that got through every stage are done
+	if(decided)
+	{
+	    j->stage = s;
+	    stats[s].decided++;
+	}
+	if(decided || j->stopped || s+1 == STAGECNT)
+	    complete(j);
+	else
+	    forward(s+1, j);
+    }
+}
+
+// Run through the bootstrap for a few steps. Stops on a state boundary
+//   so the later stages can pick up with native transitions. A step is
+//   a TMState's pass through the bootstrap or an MTState (which ExecuteS
+//   runs natively in one go). The bootstrap doesn't clamp a head, so
+//   give up at a step that would take one off the tape
+bool DeciderPipeline::direct(Job* j)
+{
+    BitDeviceMachine* m = j->m;
+    unsigned long n = 0;
+    for(unsigned long ops=0; ops < 64*(budget[DIRECT]+1); ops++)
+    {
+	if(m->Halted())
+	{
+	    j->verdict = HALTS;
+	    return true;
+	}
+	if(m->atState())
+	{
+	    if(n == budget[DIRECT] || m->leavesTape())
+		return false;
+	    n++;
+	    j->steps++;
+	}
+	m->ExecuteS();
+	if(m->brk && m->atState() && m->brk->Hit(*m, j->steps))
+	{
+	    j->stopped = true;
+	    return false;
+	}
+    }
+    return false;
+}
+
+// Native transitions, comparing each configuration against one saved at
+//   power of two intervals (Brent). The tape is finite, so every machine
+//   that doesn't halt eventually repeats a configuration. ExecuteT clamps
+//   a head at the ends, which the machine as written doesn't, so a step
+//   that would take one off the tape is given up at here as in every
+//   stage. The incremental ConfigHash does the comparing --
+//   configurations are only compared in full when the hashes match
+bool DeciderPipeline::cycle(Job* j)
+{
+    BitDeviceMachine* m = j->m;
+    if(!m->atState()) return false;
+
+    unsigned len   = m->ConfigLen();
+    uchar*   saved = bufs.Alloc(len);
+    uchar*   cur   = bufs.Alloc(len);
+    m->GetConfig(saved);
+    uint64_t hs = m->ConfigHash();
+
+    bool decided = false;
+    unsigned long power = 1, lam = 0;
+    for(unsigned long n=0; n<budget[CYCLE]; n++)
+    {
+	if(m->Halted())
+	{
+	    j->verdict = HALTS;
+	    decided = true;
+	    break;
+	}
+	if(m->leavesTape() || !m->ExecuteT()) break;
+	j->steps++;
+	if(m->brk && m->brk->Hit(*m, j->steps))
+	{
+	    j->stopped = true;
+	    break;
+	}
+
+	uint64_t h = m->ConfigHash();
+	if(h == hs)
+	{
+	    m->GetConfig(cur);
+	    if(!memcmp(saved, cur, len))
+	    {
+		j->verdict = CYCLES;
+		decided = true;
+		break;
+	    }
+	}
+	if(++lam == power)
+	{
+	    m->GetConfig(saved);
+	    hs     = h;
+	    power *= 2;
+	    lam    = 0;
+	}
+    }
+    bufs.Free(saved, len);
+    bufs.Free(cur, len);
+    return decided;
+}
+
+// A long run of native transitions (up to a step off the tape)
+bool DeciderPipeline::accel(Job* j)
+{
+    BitDeviceMachine* m = j->m;
+    for(unsigned long n=0; n<budget[ACCEL] && !m->leavesTape(); n++)
+    {
+	if(!m->ExecuteT()) break;
+	j->steps++;
+	if(m->brk && m->brk->Hit(*m, j->steps))
+	{
+	    j->stopped = true;
+	    return false;
+	}
+    }
+    if(!m->Halted()) return false;
+    j->verdict = HALTS;
+    return true;
+}
+
+// Find every transition that can ever fire: start from the current state
+//   with the symbols on the tape now, then add the states and symbols that
+//   live transitions lead to and write until nothing changes. If no live
+//   transition goes to the halt command the machine never halts
+bool DeciderPipeline::statik(Job* j)
+{
+    BitDeviceMachine* m = j->m;
+    if(!m->currentState()) return false;
+
+    unsigned cnt = m->CommandCount();
+    bool* live = new bool[cnt];
+    memset(live, 0, cnt);
+    live[m->GetCurrentCommand()] = true;
+
+    // Symbols that can appear under the head, sized for the tape's
+    //   alphabet. A TMState reads only 0, 1 and blank, so a wider symbol
+    //   on the tape leaves the machine to the other stages
+    unsigned      nsym = (m->Width() < 2 ? 3 : 1u << m->Width());
+    unsigned long c[3];
+    m->CountSymbols(c);
+    if(c[0]+c[1]+c[2] != m->Tapelen())
+    {
+	delete [] live;
+	return false;
+    }
+    bool* sym = new bool[nsym];
+    memset(sym, 0, nsym);
+    for(uchar x=0; x<3; x++)
+	sym[x] = (c[x] != 0);
+
+    bool mayHalt = false, changed = true;
+    while(changed && !mayHalt)
+    {
+	changed = false;
+	for(unsigned i=0; i<cnt && !mayHalt; i++)
+	{
+	    if(!live[i]) continue;
+	    for(uchar x=0; x<3 && !mayHalt; x++)
+	    {
+		if(!sym[x]) continue;
+
+		// Anything but a turing state, including halt, might halt
+		uchar    w;
+		int      d;
+		unsigned nxt;
+		if(!m->Transition(i, x, w, d, nxt) || nxt == 0 || nxt >= cnt)
+		{
+		    mayHalt = true;
+		    break;
+		}
+		if(!live[nxt]) {live[nxt] = true; changed = true;}
+		if(!sym[w])    {sym[w]    = true; changed = true;}
+	    }
+	}
+    }
+    delete [] live;
+    delete [] sym;
+
+    if(mayHalt) return false;
+    j->verdict = NEVERHALTS;
+    return true;
+}
+
+// Print per stage throughput and queue depths
+void DeciderPipeline::Report(FILE* f) const
+{
+    unsigned long end  = (stopNs ? stopNs : now());
+    double        wall = (end-startNs)/1e9;
+    if(wall <= 0) wall = 1e-9;
+
+    fprintf(f, "%-7s %4s %10s %10s %12s %10s %6s %7s %9s\n",
+	    "stage", "wkrs", "in", "decided", "steps", "mach/s",
+	    "busy%", "queue", "maxqueue");
+    for(int s=0; s<STAGECNT; s++)
+    {
+	double busy = stats[s].busyNs/1e9;
+	double util = 100.0*busy/(wall*workers[s]);
+	fprintf(f, "%-7s %4u %10lu %10lu %12lu %10.0f %5.1f%% %7u %9u\n",
+		StageName(s), workers[s],
+		stats[s].in.load(), stats[s].decided.load(),
+		stats[s].steps.load(), stats[s].in/wall, util,
+		(q[s] ? q[s]->Depth() : 0), stats[s].maxDepth.load());
+    }
+    if(db)
+	fprintf(f, "cached %lu (results file holds %lu of %u)\n",
+		cached.load(), db->Count(), db->Slots());
+    fprintf(f, "wall %.3fs\n", wall);
+}
+
+const char* DeciderPipeline::StageName(int s)
+{
+    switch(s)
+    {
+    case DIRECT: return "direct";
+    case CYCLE:  return "cycle";
+    case ACCEL:  return "accel";
+    case STATIC: return "static";
+    }
+    return "none";
+}
+
+const char* DeciderPipeline::VerdictName(VERDICT v)
+{
+    switch(v)
+    {
+    case UNDECIDED:  return "undecided";
+    case HALTS:      return "halts";
+    case CYCLES:     return "cycles";
+    case NEVERHALTS: return "never halts";
+    }
+    return "?";
+}
@@ -0,0 +1,136 @@
+#ifndef DECIDERPIPELINE_H
+#define DECIDERPIPELINE_H
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include "BitDeviceMachine.h"
+#include "BoundedQueue.h"
+#include "ResultsDB.h"
+
+// A DeciderPipeline classifies BitDeviceMachines by passing them through
+//   a fixed sequence of stages, each more expensive than the last:
+//
+//     DIRECT : a short run through the turing bootstrap
+//     CYCLE  : native transitions, watching for a repeated configuration
+//     ACCEL  : a long run of native transitions
+//     STATIC : analysis of the state table -- can the halt state be reached?
+//
+//   A machine leaves the pipeline at the first stage that decides it.
+//   Stages are connected by BoundedQueues and each stage has its own pool
+//   of worker threads, so workers can be moved to whichever stage the
+//   Report shows is the bottleneck. Given a ResultsDB, a machine already
+//   decided there is done as it's submitted and every machine decided
+//   is put there. A machine given breakpoints leaves the pipeline,
+//   undecided, at the first step one holds after (a STEP point counts
+//   Turing steps here)
+class DeciderPipeline
+{
+public:
+    enum STAGE   { DIRECT, CYCLE, ACCEL, STATIC, STAGECNT };
+    enum VERDICT { UNDECIDED, HALTS, CYCLES, NEVERHALTS };
+
+    // A Job carries one machine through the pipeline and holds the outcome
+    struct Job
+    {
+	BitDeviceMachine* m;       // Machine to classify (owned by caller)
+	unsigned          id;      // Caller's tag for the machine
+	VERDICT           verdict; // Outcome
+	int               stage;   // Stage that decided it (-1 if none did)
+	unsigned long     steps;   // Turing steps executed in all stages
+	unsigned long     ones;    // 1s on the tape once decided
+	bool              cached;  // Outcome came from the ResultsDB
+	bool              stopped; // A breakpoint of the machine's held
+	bool              keyed;   // key holds the machine's ResultsDB key
+	ResultsDB::Key    key;
+    };
+
+    // Called by a worker thread as each job leaves the pipeline
+    typedef void (*DONEFN)(Job* j, void* arg);
+
+private:
+    // Per stage counters -- each on its own cache line
+    struct Stats
+    {
+	alignas(64) std::atomic<unsigned long> in;       // Jobs taken
+	std::atomic<unsigned long>             decided;  // Jobs decided here
+	std::atomic<unsigned long>             steps;    // Turing steps run
+	std::atomic<unsigned long>             busyNs;   // Worker time spent
+	std::atomic<unsigned>                  maxDepth; // High water of queue
+    };
+
+    // Configuration
+    unsigned      workers[STAGECNT];
+    unsigned long budget[STAGECNT];
+    unsigned      queueLen;
+    DONEFN        done;
+    void*         doneArg;
+    ResultsDB*    db;
+
+    // The configurations cycle compares come from here, so a job doesn't
+    //   cost a trip to the heap
+    PoolAllocator bufs;
+
+    // Running state
+    BoundedQueue<Job*>*        q[STAGECNT];
+    std::thread*               pool;
+    unsigned                   poolLen;
+    Stats                      stats[STAGECNT];
+    std::atomic<unsigned long> outstanding; // Submitted but not done
+    std::atomic<unsigned long> cached;      // Done from the ResultsDB
+    std::atomic<bool>          closed;      // No more submissions
+    unsigned long              startNs;
+    unsigned long              stopNs;
+
+    // Worker loop for stage s
+    void work(unsigned s);
+
+    // Hand j to stage s, waiting while its queue is full
+    void forward(unsigned s, Job* j);
+
+    // j has left the pipeline
+    void complete(Job* j);
+
+    // The stages -- each returns true if it decided the job
+    bool direct(Job* j);
+    bool cycle(Job* j);
+    bool accel(Job* j);
+    bool statik(Job* j);
+
+    static unsigned long now();
+
+    // Not copyable
+    DeciderPipeline(const DeciderPipeline&);
+    DeciderPipeline& operator=(const DeciderPipeline&);
+
+public:
+    DeciderPipeline();
+    ~DeciderPipeline();
+
+    // Configuration (before Start)
+    //   workers per stage, turing step budget per simulating stage,
+    //   capacity of each queue, a function to call as jobs finish (on
+    //   the submitting thread for a job found in the ResultsDB) and a
+    //   ResultsDB to consult and fill in (none if 0)
+    void SetWorkers(STAGE s, unsigned n);
+    void SetBudget(STAGE s, unsigned long steps);
+    void SetQueueLen(unsigned n);
+    void SetDone(DONEFN fn, void* arg);
+    void SetResults(ResultsDB* rdb);
+
+    // Start the worker pools
+    // Submit a job (waits while the first queue is full -- a job found
+    //   in the ResultsDB is done at once, its machine left as it was)
+    // Wait for every submitted job to finish and stop the pools
+    void Start();
+    void Submit(Job* j);
+    void Finish();
+
+    // Print per stage throughput and queue depths
+    void Report(FILE* f) const;
+
+    static const char* StageName(int s);
+    static const char* VerdictName(VERDICT v);
+};
+
+#endif
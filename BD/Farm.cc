@@ -0,0 +1,406 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <chrono>
+#include "Farm.h"
+
+static const char MAGIC[8] = {'B','D','M','S','H','A','R','D'};
+enum { VERSION = 2 }; // 2: bad samples skipped
+
+struct Farm::Header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t statsLen; // sizeof(Sampler::Stats)
+    uint64_t states;
+    uint64_t budget;
+    uint64_t seed;
+    uint64_t unit;     // UNIT
+    uint64_t k;
+    uint64_t samples;  // In unit k
+};
+
+// Read or write all n bytes of b (a pipe may hand them over in parts)
+static bool readAll(int fd, void* b, size_t n)
+{
+    for(ssize_t r; n; n -= r, b = (char*)b+r)
+	if((r = read(fd, b, n)) <= 0) return false;
+    return true;
+}
+static bool writeAll(int fd, const void* b, size_t n)
+{
+    for(ssize_t r; n; n -= r, b = (const char*)b+r)
+	if((r = write(fd, b, n)) <= 0) return false;
+    return true;
+}
+
+static double seconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count()/1e9;
+}
+
+Farm::Farm(Sampler &sm, unsigned long n, const char* d) : s(sm)
+{
+    assert(n > 0 && d);
+    samples = n;
+    dir     = d;
+    workers = 1;
+    first   = 0;
+    last    = NONE;
+    done    = had = failed = crashes = skipped = 0;
+    wall    = 0;
+    ran     = false;
+}
+
+void Farm::SetWorkers(unsigned n) {assert(n > 0); workers = n;}
+void Farm::SetUnits(unsigned long f, unsigned long l)
+{assert(f <= l); first = f; last = l;}
+
+unsigned long Farm::Units() const {return (samples+UNIT-1)/UNIT;}
+
+void Farm::shardName(char* buf, unsigned len, unsigned long k) const
+{snprintf(buf, len, "%s/shard-%08lu", dir, k);}
+
+void Farm::header(Header &h, unsigned long k) const
+{
+    memset((void*)&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version  = VERSION;
+    h.statsLen = sizeof(Sampler::Stats);
+    h.states   = s.States();
+    h.budget   = s.Budget();
+    h.seed     = s.Seed();
+    h.unit     = UNIT;
+    h.k        = k;
+    h.samples  = (samples-k*UNIT < UNIT ? samples-k*UNIT : (unsigned long)UNIT);
+}
+
+bool Farm::readShard(unsigned long k, Sampler::Stats &st,
+		     unsigned long* bad, unsigned* nbad) const
+{
+    char name[1024];
+    shardName(name, sizeof(name), k);
+    int fd = open(name, O_RDONLY);
+    if(fd < 0) return false;
+    Header   h, want;
+    uint64_t nb, b[MAXBAD];
+    header(want, k);
+    bool ok = (readAll(fd, &h, sizeof(h)) && !memcmp(&h, &want, sizeof(h)) &&
+	       readAll(fd, &st, sizeof(st)) && readAll(fd, &nb, sizeof(nb)) &&
+	       nb <= MAXBAD && nb == st.skipped &&
+	       readAll(fd, b, nb*sizeof(b[0])));
+    close(fd);
+    if(ok && bad)
+    {
+	for(unsigned j=0; j<nb; j++)
+	    bad[j] = b[j];
+	*nbad = nb;
+    }
+    return ok;
+}
+
+// Shards are written whole under a name of their own and renamed
+bool Farm::runUnit(unsigned long k, const unsigned long* bad,
+		   unsigned nbad) const
+{
+    Header h;
+    header(h, k);
+    s.SetSkip(bad, nbad);
+    s.Run(h.samples, k*UNIT);
+    s.SetSkip(0, 0);
+
+    char name[1024], tmp[1040];
+    shardName(name, sizeof(name), k);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return false;
+    const Sampler::Stats &st = s.Totals();
+    uint64_t nb = nbad, b[MAXBAD];
+    for(unsigned j=0; j<nbad; j++)
+	b[j] = bad[j];
+    bool ok = (writeAll(fd, &h, sizeof(h)) && writeAll(fd, &st, sizeof(st)) &&
+	       writeAll(fd, &nb, sizeof(nb)) &&
+	       writeAll(fd, b, nb*sizeof(b[0])) && fsync(fd) == 0);
+    close(fd);
+    return (ok && rename(tmp, name) == 0);
+}
+
+// A worker runs the units it's sent -- a unit number, how many samples
+//   to skip and which -- until its pipe closes, and goes away without
+//   answering if it can't write a shard. What a unit allocates for its
+//   machines is let go of in one go once it's done
+void Farm::serve(int in, int out, std::atomic<unsigned long>* at) const
+{
+    ArenaAllocator arena;
+    s.SetThreads(1);
+    s.SetAllocator(&arena);
+    s.SetProgress(at);
+    uint64_t      msg[2+MAXBAD];
+    unsigned long bad[MAXBAD];
+    while(readAll(in, msg, 2*sizeof(msg[0])))
+    {
+	uint64_t k = msg[0], nb = msg[1];
+	if(nb > MAXBAD || !readAll(in, msg+2, nb*sizeof(msg[0])))
+	    _exit(1);
+	for(unsigned j=0; j<nb; j++)
+	    bad[j] = msg[2+j];
+	if(!runUnit(k, bad, nb) || write(out, &k, sizeof(k)) != (ssize_t)sizeof(k))
+	    _exit(1);
+	arena.Release();
+    }
+    _exit(0);
+}
+
+// The worker keeps only its own ends -- a sibling's pipes held open
+//   by it would hide the sibling going away
+bool Farm::start(Worker* w, unsigned n, unsigned i)
+{
+    int down[2], up[2];
+    if(pipe(down)) return false;
+    if(pipe(up)) {close(down[0]); close(down[1]); return false;}
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if(pid < 0)
+    {
+	close(down[0]); close(down[1]); close(up[0]); close(up[1]);
+	return false;
+    }
+    if(pid == 0)
+    {
+	for(unsigned j=0; j<n; j++)
+	{
+	    if(w[j].to   >= 0) close(w[j].to);
+	    if(w[j].from >= 0) close(w[j].from);
+	}
+	close(down[1]);
+	close(up[0]);
+	serve(down[0], up[1], w[i].at);
+    }
+    close(down[0]);
+    close(up[1]);
+    w[i].pid  = pid;
+    w[i].to   = down[1];
+    w[i].from = up[0];
+    w[i].unit = NONE;
+    return true;
+}
+
+// Units go out one at a time to whichever workers are idle; a worker
+//   that answers is idle again and one whose pipe closes is replaced.
+//   A unit goes to the back of the queue when its worker goes, so the
+//   others get on while it's tried again (a unit is in the queue once
+//   at most, so it's a ring of a place for each). The words the workers
+//   say what sample they're on in are a cache line each
+bool Farm::Run()
+{
+    double t0 = seconds();
+    done = had = failed = crashes = skipped = 0;
+    ran  = true;
+    unsigned long units = Units();
+    unsigned long lo    = first;
+    unsigned long hi    = (last < units ? last : units-1);
+    if(lo > hi) {wall = 0; return true;}
+    mkdir(dir, 0755);
+
+    unsigned long  n       = hi-lo+1;
+    unsigned long* todo    = new unsigned long[n];
+    uchar*         tries   = new uchar[n];         // Losses since a bad
+    unsigned long* suspect = new unsigned long[n]; //   sample, the last
+    unsigned long* bad     = new unsigned long[n*MAXBAD]; // one's sample
+    uchar*         nbad    = new uchar[n];
+    unsigned long  qh = 0, qt = 0;
+    memset(tries, 0, n);
+    memset(nbad, 0, n);
+    for(unsigned long k=lo; k<=hi; k++)
+    {
+	Sampler::Stats st;
+	suspect[k-lo] = NONE;
+	if(readShard(k, st)) had++;
+	else                 todo[qt++ % n] = k;
+    }
+
+    // A write to a worker that's gone fails rather than killing us
+    struct sigaction ign, old;
+    memset(&ign, 0, sizeof(ign));
+    ign.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ign, &old);
+
+    unsigned       nw    = (workers < qt ? workers : qt);
+    Worker*        w     = new Worker[nw];
+    struct pollfd* pf    = new struct pollfd[nw];
+    unsigned       alive = 0;
+    enum { LINE = 64/sizeof(std::atomic<unsigned long>) };
+    void* shm = (nw ? mmap(0, nw*64, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANONYMOUS, -1, 0) : MAP_FAILED);
+    std::atomic<unsigned long>* at =
+	(shm == MAP_FAILED ? 0 : (std::atomic<unsigned long>*)shm);
+    for(unsigned i=0; i<nw; i++)
+    {
+	w[i].pid  = -1;
+	w[i].to   = w[i].from = -1;
+	w[i].unit = NONE;
+	w[i].at   = (at ? at+i*LINE : 0);
+    }
+    for(unsigned i=0; i<nw; i++)
+	if(start(w, nw, i)) alive++;
+
+    unsigned long outstanding = qt;
+    while(outstanding && alive)
+    {
+	for(unsigned i=0; i<nw && qh<qt; i++)
+	{
+	    if(w[i].pid < 0 || w[i].unit != NONE) continue;
+	    unsigned long k = todo[qh % n], u = k-lo;
+	    uint64_t      msg[2+MAXBAD];
+	    msg[0] = k;
+	    msg[1] = nbad[u];
+	    for(unsigned j=0; j<nbad[u]; j++)
+		msg[2+j] = bad[u*MAXBAD+j];
+	    if(w[i].at) w[i].at->store(NONE);
+	    if(write(w[i].to, msg, (2+nbad[u])*sizeof(msg[0])) !=
+	       (ssize_t)((2+nbad[u])*sizeof(msg[0])))
+		continue; // Gone -- poll will say so
+	    w[i].unit = k;
+	    qh++;
+	}
+	for(unsigned i=0; i<nw; i++)
+	{
+	    pf[i].fd      = w[i].from; // (-1 is passed over)
+	    pf[i].events  = POLLIN;
+	    pf[i].revents = 0;
+	}
+	if(poll(pf, nw, -1) < 0)
+	{
+	    if(errno == EINTR) continue;
+	    break;
+	}
+
+	for(unsigned i=0; i<nw; i++)
+	{
+	    if(!pf[i].revents) continue;
+	    uint64_t k;
+	    if(read(w[i].from, &k, sizeof(k)) == (ssize_t)sizeof(k) &&
+	       k == w[i].unit)
+	    {
+		done++;
+		outstanding--;
+		w[i].unit = NONE;
+		continue;
+	    }
+
+	    // Gone: wait for it, queue its unit again -- without the sample
+	    //   it was on, if that's the second time it went there -- and
+	    //   replace it
+	    close(w[i].to);
+	    close(w[i].from);
+	    waitpid(w[i].pid, 0, 0);
+	    crashes++;
+	    w[i].pid = -1;
+	    w[i].to  = w[i].from = -1;
+	    alive--;
+	    if(w[i].unit != NONE)
+	    {
+		unsigned long k  = w[i].unit, u = k-lo;
+		unsigned long on = (w[i].at ? w[i].at->load() : NONE);
+		if(on != NONE && on/UNIT != k) on = NONE;
+		if(on != NONE && on == suspect[u] && nbad[u] < MAXBAD)
+		{
+		    unsigned long* b = bad+u*MAXBAD;
+		    unsigned       j = nbad[u]++;
+		    for(; j > 0 && b[j-1] > on; j--)
+			b[j] = b[j-1];
+		    b[j]       = on;
+		    suspect[u] = NONE;
+		    tries[u]   = 0;
+		    skipped++;
+		    todo[qt++ % n] = k;
+		}
+		else if(++tries[u] < MAXTRIES)
+		{
+		    suspect[u]     = on;
+		    todo[qt++ % n] = k;
+		}
+		else
+		{
+		    failed++;
+		    outstanding--;
+		}
+		w[i].unit = NONE;
+	    }
+	    if(start(w, nw, i)) alive++;
+	}
+    }
+    failed += outstanding; // Left with no workers to run them
+
+    // Closing their pipes lets the workers go
+    for(unsigned i=0; i<nw; i++)
+	if(w[i].pid >= 0)
+	{
+	    close(w[i].to);
+	    close(w[i].from);
+	    waitpid(w[i].pid, 0, 0);
+	}
+    sigaction(SIGPIPE, &old, 0);
+    if(at) munmap(shm, nw*64);
+    delete [] w;
+    delete [] pf;
+    delete [] todo;
+    delete [] tries;
+    delete [] suspect;
+    delete [] bad;
+    delete [] nbad;
+    wall = seconds()-t0;
+    return (failed == 0);
+}
+
+unsigned long Farm::Merge(Sampler::Stats &st, FILE* f) const
+{
+    st.Clear();
+    unsigned long units   = Units();
+    unsigned long hi      = (last < units ? last : units-1);
+    unsigned long missing = 0;
+    for(unsigned long k=first; k<=hi; k++)
+    {
+	Sampler::Stats u;
+	unsigned long  bad[MAXBAD];
+	unsigned       nbad;
+	if(readShard(k, u, bad, &nbad))
+	{
+	    st.Merge(u);
+	    for(unsigned j=0; f && j<nbad; j++)
+		fprintf(f, "sample %lu skipped (unit %lu)\n", bad[j], k);
+	}
+	else
+	{
+	    missing++;
+	    if(f) fprintf(f, "unit %lu missing\n", k);
+	}
+    }
+    return missing;
+}
+
+void Farm::Report(FILE* f) const
+{
+    unsigned long units = Units();
+    unsigned long hi    = (last < units ? last : units-1);
+    if(ran)
+	fprintf(f, "units %lu-%lu of %lu: run %lu, there already %lu, "
+		"failed %lu, workers lost %lu, samples skipped %lu\n",
+		first, hi, units, done, had, failed, crashes, skipped);
+    Sampler::Stats st;
+    unsigned long missing = Merge(st, f);
+    if(!ran)
+	fprintf(f, "units %lu-%lu of %lu: merged %lu\n",
+		first, hi, units, hi-first+1-missing);
+    s.Report(f, st, (had ? 0 : wall), workers);
+}
@@ -0,0 +1,117 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <atomic>
+#include "Sampler.h"
+
+// A Farm runs a Sampler's machines in worker processes, so a machine
+//   that trips an assert takes down one worker and not the run. The
+//   samples are cut into units of UNIT samples -- unit k is samples
+//   k*UNIT..(k+1)*UNIT-1, so its number says what it holds whoever runs
+//   it -- and each unit done leaves a shard file in a directory:
+//
+//     shard-<k> : magic "BDMSHARD" | version | the sampler's states,
+//                 budget and seed | UNIT | k | samples | Sampler::Stats
+//                 | bad | the bad samples skipped (bad of them)
+//
+//   written under another name and renamed into place, so a shard is
+//   there whole or not at all. The coordinator forks the workers, hands
+//   them unit numbers (and the samples to skip) over a pipe each and
+//   hears the number back once the shard is there. A worker says which
+//   sample it's on in a word of memory it shares with the coordinator.
+//   A worker that goes away (its pipe closes) is waited for and
+//   replaced, and its unit handed out again. If it went away on the
+//   same sample twice the sample is bad -- it's skipped from then on and
+//   recorded in the shard -- so a machine that trips an assert costs a
+//   sample, not the unit. Past MAXTRIES losses with no bad sample to
+//   show for them, or MAXBAD bad samples, the unit is given up as
+//   failed. Units with a shard already are skipped, so a run can be
+//   picked up again, and several hosts can each run a range of units
+//   and Merge all the shards afterwards. Shards are raw structs, so
+//   they're merged on the same kind of host as made them
+class Farm
+{
+public:
+    enum { UNIT = 1 << 16, MAXTRIES = 3, MAXBAD = 16 };
+
+private:
+    // The coordinator's end of a worker
+    struct Worker
+    {
+	pid_t         pid;
+	int           to;   // Unit numbers out
+	int           from; //   and back
+	unsigned long unit; // Unit it's running (NONE if idle)
+	std::atomic<unsigned long>* at; // Sample it's on (NONE if none,
+					//   0 if it can't say)
+    };
+    static const unsigned long NONE = ~0ul;
+
+    // Configuration
+    Sampler&      s;
+    unsigned long samples;
+    const char*   dir;
+    unsigned      workers;
+    unsigned long first;   // Units to run
+    unsigned long last;
+
+    // Counts from the last Run
+    unsigned long done;    // Units run
+    unsigned long had;     // Units with a shard already
+    unsigned long failed;  // Units given up on
+    unsigned long crashes; // Workers that went away
+    unsigned long skipped; // Bad samples skipped
+    double        wall;
+    bool          ran;
+
+    // Shard file name and header of unit k
+    void shardName(char* buf, unsigned len, unsigned long k) const;
+    struct Header;
+    void header(Header &h, unsigned long k) const;
+
+    // Read unit k's shard into st and its bad samples into bad (up to
+    //   MAXBAD of them, nbad set to how many -- if bad isn't 0), false
+    //   if it isn't there or isn't one of this sampler's. Run unit k
+    //   without its nbad bad samples and write its shard
+    bool readShard(unsigned long k, Sampler::Stats &st,
+		   unsigned long* bad=0, unsigned* nbad=0) const;
+    bool runUnit(unsigned long k, const unsigned long* bad,
+		 unsigned nbad) const;
+
+    // Fork a worker, and the loop it runs (never returns) saying which
+    //   sample it's on in at
+    bool start(Worker* w, unsigned n, unsigned i);
+    void serve(int in, int out, std::atomic<unsigned long>* at) const;
+
+    // Not copyable
+    Farm(const Farm&);
+    Farm& operator=(const Farm&);
+
+public:
+    // Run the first n samples of sm (sm's own threads aren't used) with
+    //   the shards in directory d
+    Farm(Sampler &sm, unsigned long n, const char* d);
+
+    // Workers to run at once, and the units to run (all by default)
+    void SetWorkers(unsigned n);
+    void SetUnits(unsigned long first, unsigned long last);
+
+    // Units the samples make
+    unsigned long Units() const;
+
+    // Run every unit in range without a shard -- false if any failed
+    bool Run();
+
+    // Add up the shards of the units in range into st -- returns how
+    //   many weren't there (their numbers, and the bad samples skipped,
+    //   go to f if it isn't 0)
+    unsigned long Merge(Sampler::Stats &st, FILE* f=0) const;
+
+    // Print what the last Run did (if there was one) and the totals of
+    //   the shards in range
+    void Report(FILE* f) const;
+};
+
+#endif
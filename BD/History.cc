@@ -0,0 +1,264 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "History.h"
+
+// Bytes of a record's size field and of a range's header (byte address
+//   and length)
+enum { SIZELEN = sizeof(unsigned), RANGEHDR = sizeof(unsigned)+2 };
+
+History::History(BitDeviceMachine* m0, unsigned K, unsigned undoBytes,
+		 unsigned maxSnaps)
+{
+    assert(K > 0 && maxSnaps >= 2 && undoBytes > 0);
+    every   = K;
+    now     = 0;
+    snapMax = maxSnaps;
+    snaps   = new Snap[snapMax];
+    snapCnt = 0;
+    cap     = undoBytes;
+    ring    = (uchar*)malloc(cap);
+    assert(ring);
+    head    = 0;
+    used    = 0;
+    recs    = 0;
+    recCap  = 1024;
+    rec     = (uchar*)malloc(recCap);
+    assert(rec);
+    recLen  = 0;
+
+    // Step 0 is the first snapshot and is never dropped
+    m = m0->Fork();
+    snapshot();
+}
+
+History::~History()
+{
+    for(unsigned i=0; i<snapCnt; i++)
+	delete snaps[i].m;
+    delete [] snaps;
+    delete m;
+    free(ring);
+    free(rec);
+}
+
+BitDeviceMachine* History::Machine()   {return m;}
+unsigned long History::Steps() const    {return now;}
+unsigned long History::Undoable() const {return recs;}
+
+// Ring access, in up to two pieces
+void History::put(unsigned o, const void* src, unsigned n)
+{
+    o %= cap;
+    unsigned k = (n < cap-o ? n : cap-o);
+    memcpy(ring+o, src, k);
+    memcpy(ring, (const uchar*)src+k, n-k);
+}
+
+void History::get(unsigned o, void* dst, unsigned n) const
+{
+    o %= cap;
+    unsigned k = (n < cap-o ? n : cap-o);
+    memcpy(dst, ring+o, k);
+    memcpy((uchar*)dst+k, ring, n-k);
+}
+
+// Append a range header and its old bytes to the record under way
+void History::addRange(unsigned b, unsigned n, const uchar* old)
+{
+    assert(n <= MAXRANGE);
+    while(recLen+RANGEHDR+n+SIZELEN > recCap)
+    {
+	recCap *= 2;
+	rec = (uchar*)realloc(rec, recCap);
+	assert(rec);
+    }
+    unsigned short len = n;
+    memcpy(rec+recLen, &b, sizeof(b));
+    memcpy(rec+recLen+sizeof(b), &len, sizeof(len));
+    memcpy(rec+recLen+RANGEHDR, old, n);
+    recLen += RANGEHDR+n;
+}
+
+// Close the record under way with its size at both ends and append it
+//   -- a record bigger than the whole ring can't be kept, and then
+//   nothing older can be undone either
+void History::push()
+{
+    unsigned size = recLen+SIZELEN;
+    memcpy(rec, &size, SIZELEN);
+    memcpy(rec+recLen, &size, SIZELEN);
+    if(size > cap)
+    {
+	clearLog();
+	return;
+    }
+    while(used+size > cap)
+    {
+	unsigned old;
+	get(head, &old, SIZELEN);
+	head  = (head+old)%cap;
+	used -= old;
+	recs--;
+    }
+    put(head+used, rec, size);
+    used += size;
+    recs++;
+}
+
+void History::clearLog()
+{
+    head = 0;
+    used = 0;
+    recs = 0;
+}
+
+// Put back the old bytes of the newest record and go back a step
+void History::pop()
+{
+    assert(recs > 0 && now > 0);
+    unsigned size;
+    get(head+used-SIZELEN, &size, SIZELEN);
+    unsigned o   = head+used-size+SIZELEN;
+    unsigned end = head+used-SIZELEN;
+    uchar    buf[MAXRANGE];
+    while(o < end)
+    {
+	unsigned       b;
+	unsigned short n;
+	get(o, &b, sizeof(b));
+	get(o+sizeof(b), &n, sizeof(n));
+	get(o+RANGEHDR, buf, n);
+	for(unsigned i=0; i<n; i++)
+	    m->bd.WriteBits(bPB*(b+i), bPB, buf[i]);
+	o += RANGEHDR+n;
+    }
+    used -= size;
+    recs--;
+    now--;
+    m->zhashOk = false; // Written behind its back
+}
+
+// Keep a fork of the machine as of now -- at snapMax, every other one
+//   (the first kept) makes room and they're taken half as often from
+//   then on, so they stay spread evenly over the whole run
+void History::snapshot()
+{
+    if(snapCnt == snapMax)
+    {
+	unsigned k = 1;
+	for(unsigned i=1; i<snapCnt; i++)
+	    if(i%2) delete snaps[i].m;
+	    else    snaps[k++] = snaps[i];
+	snapCnt = k;
+	every  *= 2;
+    }
+    snaps[snapCnt].step = now;
+    snaps[snapCnt].m    = m->Fork();
+    snapCnt++;
+}
+
+// Run a step, logging what it overwrites: the bytes writeSet names,
+//   read before the step, and the registers the step changed
+bool History::Forward()
+{
+    if(m->Halted()) return false;
+
+    int old[MAXREGS];
+    memcpy(old, m->getRegisters(), sizeof(old));
+    unsigned b[MAXRANGES], n[MAXRANGES];
+    unsigned k  = m->writeSet(b, n, MAXRANGES);
+    bool     ok = (k <= MAXRANGES);
+    uchar    buf[MAXRANGE];
+    recLen = SIZELEN;
+    for(unsigned i=0; ok && i<k; i++)
+    {
+	ok = (n[i] <= MAXRANGE);
+	if(!ok) break;
+	m->bd.Copy(buf, b[i], n[i]);
+	addRange(b[i], n[i], buf);
+    }
+
+    m->ExecuteS();
+    now++;
+
+    // Each run of registers the step changed is a range
+    int*     reg = m->getRegisters();
+    unsigned ra  = m->regA();
+    for(unsigned i=0; ok && i<MAXREGS; )
+    {
+	if(reg[i] == old[i]) {i++; continue;}
+	unsigned j = i;
+	while(j < MAXREGS && reg[j] != old[j]) j++;
+	addRange(ra+i*sizeof(int), (j-i)*sizeof(int), (uchar*)(old+i));
+	i = j;
+    }
+    if(ok) push();
+    else   clearLog();
+
+    if(now%every == 0 && snaps[snapCnt-1].step < now)
+	snapshot();
+    return true;
+}
+
+unsigned long History::StepBack(unsigned long n)
+{
+    if(n > now) n = now;
+    SeekTo(now-n);
+    return n;
+}
+
+// Forward by running, back by the undo log if it reaches, otherwise
+//   from the last snapshot at or before s
+bool History::SeekTo(unsigned long s)
+{
+    if(s < now && now-s > recs)
+    {
+	unsigned i = snapCnt;
+	while(snaps[i-1].step > s) i--;
+	delete m;
+	m   = snaps[i-1].m->Fork();
+	now = snaps[i-1].step;
+	clearLog();
+    }
+    while(now > s)
+	pop();
+    while(now < s)
+	if(!Forward()) return false;
+    return true;
+}
+
+// Natively a snapshot's worth of steps at a time
+bool History::Continue(Breakpoints &bp)
+{
+    bp.Rearm(*m);
+    bool regs = bp.WatchesRegs();
+    for(;;)
+    {
+	// Through the bootstrap (or everything, for a register) a step
+	//   at a time
+	if(regs || !m->atState())
+	{
+	    if(!Forward()) return false;
+	    if(bp.Hit(*m, now)) return true;
+	    continue;
+	}
+	if(m->Halted()) return false;
+
+	clearLog();
+	m->SetBreakpoints(&bp);
+	unsigned long per = m->ExecuteN(now, (now/every+1)*every);
+	m->SetBreakpoints(0);
+	if(now >= (snaps[snapCnt-1].step/every+1)*every)
+	    snapshot();
+	if(!per) continue;
+	if(per == 1) return true;
+
+	// The point held in the last transition -- find the step
+	SeekTo(now-per);
+	bp.Rearm(*m);
+	while(Forward())
+	    if(bp.Hit(*m, now)) return true;
+	return false;
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "BitDeviceMachine.h"
+#include "Breakpoints.h"
+
+// A History runs a BitDeviceMachine a step (ExecuteS) at a time and can
+//   take it back to any step it has run:
+//
+//     undo log  : for each step, the bytes it was about to write (p,
+//                 the symbols and heads, anything an op writes) and the
+//                 registers it changed, as they were before it. Records
+//                 go in a ring of undoBytes bytes and the oldest ones
+//                 are dropped to make room, so a step back undoes the
+//                 newest record
+//     snapshots : a Fork of the machine every K steps (a copy-on-write
+//                 fork costs its registers plus the pages written after
+//                 it). When maxSnaps are held every other one is
+//                 dropped (the first is kept) and K doubles, so they
+//                 stay spread evenly from step 0 to the newest
+//
+//   Going back further than the undo log reaches restores the last
+//   snapshot at or before the step and runs forward from it, at most K
+//   steps while the snapshots are every K. A step whose writes can't be
+//   told in advance (see BitDeviceMachine::writeSet) can't be undone and
+//   empties the log, so stepping back over it goes through a snapshot.
+//   Execution is deterministic, so snapshots past the current step stay
+//   good and running forward again reuses them
+class History
+{
+private:
+    struct Snap
+    {
+	unsigned long     step; // Steps run when it was taken
+	BitDeviceMachine* m;    // Fork of the machine then
+    };
+
+    // Most ranges a step writes outside the registers, and the most
+    //   bytes of any one (a longer op can't be undone)
+    enum { MAXRANGES = 2*MAXTAPES+2, MAXRANGE = 4096 };
+
+    BitDeviceMachine* m;     // The machine as of step now
+    unsigned long     now;   // Steps run
+    unsigned          every; // Steps between snapshots (K, doubling)
+    Snap*             snaps; // Snapshots in step order
+    unsigned          snapCnt;
+    unsigned          snapMax;
+
+    // Undo ring: records from head (oldest) on, used bytes of cap. A
+    //   record is its size, (byte address, length, old bytes) for each
+    //   range it restores, and its size again, so it can be dropped from
+    //   either end
+    uchar*            ring;
+    unsigned          cap;
+    unsigned          head;
+    unsigned          used;
+    unsigned long     recs;
+
+    // Record being built for the step under way
+    uchar*            rec;
+    unsigned          recLen;
+    unsigned          recCap;
+
+    // Copy n bytes into/out of the ring at o (wrapping at cap)
+    void put(unsigned o, const void* src, unsigned n);
+    void get(unsigned o, void* dst, unsigned n) const;
+
+    // Add a range to the record under way
+    void addRange(unsigned b, unsigned n, const uchar* old);
+
+    // Append the record under way, dropping old records for room
+    void push();
+
+    // Forget every record
+    void clearLog();
+
+    // Undo the newest record
+    void pop();
+
+    // Fork the machine as a snapshot at step now
+    void snapshot();
+
+public:
+    // Keep the history of a fork of m0 (m0 itself is left alone)
+    History(BitDeviceMachine* m0, unsigned K=1000,
+	    unsigned undoBytes=1<<20, unsigned maxSnaps=32);
+    ~History();
+
+    // The machine as of the current step (owned by the history -- a
+    //   step back may replace it) and the steps it has run
+    BitDeviceMachine* Machine();
+    unsigned long     Steps() const;
+
+    // Steps the undo log can take back without a snapshot
+    unsigned long     Undoable() const;
+
+    // Run a step and log it -- false if the machine had halted
+    bool              Forward();
+
+    // Go back n steps (no further than the start) and return how many
+    //   were gone back
+    unsigned long     StepBack(unsigned long n);
+
+    // Go to step s, forward or back -- false if the machine halts
+    //   before it (it's left halted)
+    bool              SeekTo(unsigned long s);
+
+    // Run till the machine halts or a point of bp holds -- true if one
+    //   does. From state to state this runs natively (ExecuteN), with
+    //   the snapshots taken as ever and no undo log, and a point that
+    //   holds part way through a transition is found by going back over
+    //   it a step at a time. Registers aren't kept as the bootstrap keeps
+    //   them natively, so with a register watched it all goes a step at
+    //   a time
+    bool              Continue(Breakpoints &bp);
+};
+
+#endif
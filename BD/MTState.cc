@@ -0,0 +1,169 @@
+#include <fstream>
+#include <assert.h>
+#include <string.h>
+#include "BitDeviceMachine.h"
+
+#include "debugfile.h"
+
+// Default constructor (never called because of "casting creation")
+BitDeviceMachine::MTState::MTState()
+{ assert("Default constructor for MTState should never be called");}
+
+// n^k combinations of symbols and the command slots they take up
+unsigned BitDeviceMachine::MTState::Combos(unsigned k, unsigned n)
+{
+    assert(k >= 1 && k <= MAXTAPES && n >= 3 && n <= 256);
+    unsigned c = 1;
+    for(unsigned t=0; t<k; t++)
+	c *= n;
+    return c;
+}
+unsigned BitDeviceMachine::MTState::Slots(unsigned k, unsigned n)
+{
+    unsigned len = 2*sizeof(unsigned) + Combos(k, n)*sizeof(Move);
+    return (len+sizeof(Command)-1)/sizeof(Command);
+}
+
+// Read the symbols as the digits of a base n number, tape 0 lowest
+unsigned BitDeviceMachine::MTState::Index(unsigned k, unsigned n,
+					  const uchar* x)
+{
+    unsigned i = 0;
+    for(unsigned t=k; t>0; t--)
+    {
+	assert(x[t-1] < n);
+	i = n*i + x[t-1];
+    }
+    return i;
+}
+
+// Initialize to a state that halts in place whatever it reads
+void BitDeviceMachine::MTState::Init(unsigned nk, unsigned nn)
+{
+    // We aren't constructed per se so ensure opcode is set here
+    opCode = Command::OPTMMT;
+    k      = nk;
+    n      = nn;
+    for(unsigned i=0; i<Combos(k, n); i++)
+    {
+	mv[i].sym = 0;
+	mv[i].dir = 0;
+	for(unsigned t=0, x=i; t<k; t++, x/=n)
+	{
+	    mv[i].sym |= (x%n) << 8*t;
+	    mv[i].dir |= TMState::Dir2SYM(0) << 2*t;
+	}
+	mv[i].pad[0] = mv[i].pad[1] = mv[i].pad[2] = 0;
+	mv[i].nxt = Command::CMDIDX2OFF(0);
+    }
+}
+
+// Symbol for a character of a pattern ('*' is ANY)
+enum { ANY = 256 };
+static unsigned charSym(char c)
+{
+    assert((c >= '0' && c <= '9') || c == ' ' || c == '*');
+    return (c == ' ' ? 2 : (c == '*' ? ANY : c-'0'));
+}
+
+// Set every move whose symbols match read
+void BitDeviceMachine::MTState::Set(const char* read, const char* write,
+				    const char* move, unsigned nxt)
+{
+    assert(strlen(read) == k && strlen(write) == k && strlen(move) == k);
+    for(unsigned i=0; i<Combos(k, n); i++)
+    {
+	bool match = true;
+	for(unsigned t=0, x=i; t<k && match; t++, x/=n)
+	    match = (charSym(read[t]) == ANY || charSym(read[t]) == x%n);
+	if(!match) continue;
+
+	mv[i].sym = 0;
+	mv[i].dir = 0;
+	for(unsigned t=0, x=i; t<k; t++, x/=n)
+	{
+	    unsigned s = charSym(write[t]);
+	    int      d = (move[t] == 'L' ? -1 : (move[t] == 'R' ? +1 : 0));
+	    assert(s == ANY || s < n);
+	    assert(move[t] == 'L' || move[t] == 'N' || move[t] == 'R');
+	    mv[i].sym |= (s == ANY ? x%n : s) << 8*t;
+	    mv[i].dir |= TMState::Dir2SYM(d) << 2*t;
+	}
+	mv[i].nxt = Command::CMDIDX2OFF(nxt);
+    }
+}
+
+// Accessors
+unsigned BitDeviceMachine::MTState::Tapes()
+{
+    assert(opCode == Command::OPTMMT);
+    return k;
+}
+
+unsigned BitDeviceMachine::MTState::Colors()
+{
+    assert(opCode == Command::OPTMMT);
+    return n;
+}
+
+uchar BitDeviceMachine::MTState::Sym(unsigned i, unsigned t)
+{
+    assert(i < Combos(k, n) && t < k);
+    return (mv[i].sym >> 8*t) & 0xFF;
+}
+
+int BitDeviceMachine::MTState::Dird(unsigned i, unsigned t)
+{
+    assert(i < Combos(k, n) && t < k);
+    return TMState::SYM2Dir((mv[i].dir >> 2*t) & 3);
+}
+
+unsigned BitDeviceMachine::MTState::Nxto(unsigned i)
+{
+    assert(i < Combos(k, n));
+    return mv[i].nxt;
+}
+
+unsigned BitDeviceMachine::MTState::Nxts(unsigned i)
+{
+    assert(i < Combos(k, n));
+    return Command::OFF2CMDIDX(mv[i].nxt);
+}
+
+// Print the state to debug file -- a move per line
+void BitDeviceMachine::MTState::DBGPRINT()
+{
+    assert(opCode == Command::OPTMMT);
+    fprintf(DBGFILE, "%u tapes, %u colors\n", k, n);
+    for(unsigned i=0; i<Combos(k, n); i++)
+    {
+	fprintf(DBGFILE, "    Read:(");
+	for(unsigned t=0, x=i; t<k; t++, x/=n)
+	    fprintf(DBGFILE, t ? ",%u" : "%u", x%n);
+	fprintf(DBGFILE, ") Sym:(");
+	for(unsigned t=0; t<k; t++)
+	    fprintf(DBGFILE, t ? ",%u" : "%u", Sym(i, t));
+	fprintf(DBGFILE, ") Dir:(");
+	for(unsigned t=0; t<k; t++)
+	    fprintf(DBGFILE, t ? ",%i" : "%i", Dird(i, t));
+	fprintf(DBGFILE, ") Nxt:%u[%u]\n", Nxts(i), Nxto(i));
+    }
+}
+
+// Equality and inequality operators
+bool BitDeviceMachine::MTState::operator==(const MTState &other) const
+{
+    if(opCode != other.opCode || k != other.k || n != other.n) return false;
+    for(unsigned i=0; i<Combos(k, n); i++)
+    {
+	if(mv[i].sym != other.mv[i].sym) return false;
+	if(mv[i].dir != other.mv[i].dir) return false;
+	if(mv[i].nxt != other.mv[i].nxt) return false;
+    }
+    return true;
+}
+
+bool BitDeviceMachine::MTState::operator!=(const MTState &other) const
+{
+    return !(*this == other);
+}
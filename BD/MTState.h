@@ -0,0 +1,86 @@
+#ifndef MTSTATE_H
+#define MTSTATE_H
+
+#include "syntactic_sugar.h"
+
+// Layout of a Multi-Tape Turing Machine State
+//
+// A state of a machine with k working tapes and an alphabet of n colors
+//   (symbols 0 to n-1, 2 being the blank) reads a symbol from each tape
+//   and, for each of the n^k combinations it can read, writes a symbol on
+//   each tape, moves each head and names the next state:
+//
+//   MTSOPCODE | k | n | <move 0> <move 1> ... <move n^k-1>
+//
+//   where <move i> is for the symbols x0, x1, ... x(k-1) read from tapes
+//   0, 1, ... k-1 with i = x0 + n*x1 + n*n*x2 + ... and is:
+//
+//     sym  | k 8-bit symbols, tape t's in bits 8t to 8t+7
+//     dir  | k 2-bit directions in [00, 01, 10] (-1, 0, +1), tape t's
+//          |   in bits 2t, 2t+1
+//     pad  | 3 uchar pads for alignment
+//     nxt  | bit offset of the next command (as for a TMState)
+//
+// A state is 8+12*n^k bytes and takes up Slots(k, n) consecutive entries
+//   of the command table (6 for two tapes of three colors), so the index
+//   of the state after it is Slots(k, n) on. Tapes past k aren't touched.
+//   More than 3 colors needs tapes at least 4 bits wide
+class MTState
+{
+private:
+    friend class BitDeviceMachine;
+
+    struct Move
+    {
+	unsigned sym;    // k 8-bit symbols to write
+	uchar    dir;    // k 2-bit directions to move
+	uchar    pad[3]; // 3 uchar pads for alignment
+	unsigned nxt;    // Bit offset to next command
+    };
+
+    // Private data members
+    //   Total size: 8+12*n^k bytes
+    unsigned       opCode; // OPCODE for MultiTapeState
+    unsigned short k;      // Number of tapes read and written
+    unsigned short n;      // Number of colors
+    Move           mv[1];  // Variable length array of n^k moves
+
+    // Default constructor (never called because of "casting creation")
+    MTState();
+
+    // Number of symbol combinations a k-tape, n-color state reads and
+    //   the number of command table entries it takes up
+    static unsigned Combos(unsigned k, unsigned n=3);
+    static unsigned Slots(unsigned k, unsigned n=3);
+
+    // Index of the move for the symbols x[0], x[1], ... x[k-1]
+    static unsigned Index(unsigned k, unsigned n, const uchar* x);
+
+    // Init to a k-tape, n-color state that halts whatever it reads
+    //   (writes what it read and doesn't move)
+    void Init(unsigned k, unsigned n=3);
+
+    // Set the moves for the symbols in read -- one character per tape,
+    //   a digit, ' ' (blank, the same as '2') or '*' (any) -- to write
+    //   the symbols in write ('*' writes back what was read), move the
+    //   heads as in move ('L' -1, 'N' 0, 'R' +1) and go to command nxt
+    void Set(const char* read, const char* write, const char* move,
+	     unsigned nxt);
+
+    // Accessors for move i
+    unsigned Tapes();                    // Return k
+    unsigned Colors();                   // Return n
+    uchar    Sym (unsigned i, unsigned t); // Symbol to write on tape t
+    int      Dird(unsigned i, unsigned t); // Direction for tape t in [-1,0,1]
+    unsigned Nxto(unsigned i);           // Next command as offset
+    unsigned Nxts(unsigned i);           // Next command as index
+
+    // Print the state to debug file
+    void DBGPRINT();
+
+    // Equality and inequality operators
+    bool operator==(const MTState &other) const;
+    bool operator!=(const MTState &other) const;
+};
+
+#endif
@@ -46,9 +46,6 @@ bool BitDeviceMachine::MachineTape::operator==(const BitDeviceMachine::MachineTa
 {
     if (z != other.z) return false;
     if (p != other.p) return false;
-    for(int i=0; i<getNumberOfCommands(); i++)
-	if(cmd[i] != other.cmd[i])
-	    return false;
     return true;
 }
 bool BitDeviceMachine::MachineTape::operator!=(const BitDeviceMachine::MachineTape &other) const
@@ -19,6 +19,10 @@
 // opcode@(32+p), arg1@(64+p), arg2@(96+p), arg3@(128+p)
 // nxtCmd@(160+p)
 // n -- number of commands = 4*(z-2)/sizeof(Command);
+//
+// On a segmented BitDevice only z and p can be reached through a
+//   MachineTape -- the commands are in a segment of their own (see
+//   BitDeviceMachine::cmdA)
 class MachineTape
 {
 private:
@@ -46,7 +50,7 @@ private:
     //      so sizeof(MachineTape) doesn't tell the whole story
     unsigned Len();
 
-    // Equality and inequality operators
+    // Equality and inequality operators (of z and p)
     bool operator==(const MachineTape &other) const;
     bool operator!=(const MachineTape &other) const;
 
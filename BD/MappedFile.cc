@@ -0,0 +1,62 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MappedFile.h"
+
+MappedFile::MappedFile()
+{
+    base = 0; len = 0; shared = false;
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+// Map the whole file -- the descriptor isn't needed once it's mapped
+bool MappedFile::Open(const char* name, bool sh)
+{
+    Close();
+    int fd = open(name, sh ? O_RDWR : O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+	close(fd);
+	return false;
+    }
+    void* p = mmap(0, st.st_size, PROT_READ | PROT_WRITE,
+		   sh ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED) return false;
+
+    base   = (uchar*)p;
+    len    = st.st_size;
+    shared = sh;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(base)
+	munmap(base, len);
+    base = 0; len = 0; shared = false;
+}
+
+uchar* MappedFile::Base()   const {return base;}
+size_t MappedFile::Len()    const {return len;}
+bool   MappedFile::Shared() const {return shared;}
+
+// msync wants a page aligned start
+bool MappedFile::Sync(size_t off, size_t n)
+{
+    if(!base || !shared) return false;
+    if(n == 0) {off = 0; n = len;}
+    assert(off+n <= len);
+    size_t pg    = sysconf(_SC_PAGESIZE);
+    size_t start = off/pg*pg;
+    return (msync(base+start, off+n-start, MS_SYNC) == 0);
+}
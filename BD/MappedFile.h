@@ -0,0 +1,42 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stddef.h>
+#include "syntactic_sugar.h"
+
+// A MappedFile maps a whole file into memory, readable and writable.
+//   A private mapping is copy-on-write -- writes stay in this process and
+//   the file is left as it was. A shared mapping writes through to the
+//   file: the kernel writes dirty pages back in its own time, and Sync
+//   forces them out. The mapping goes away with Close or the MappedFile
+class MappedFile
+{
+private:
+    // Private data members
+    uchar* base;   // Start of the mapping (0 if none)
+    size_t len;    // Bytes mapped
+    bool   shared; // Writes go to the file
+
+    // Not copyable
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map the file name -- false if it can't be opened or mapped
+    bool Open(const char* name, bool shared);
+    void Close();
+
+    // The mapping
+    uchar* Base() const;
+    size_t Len() const;
+    bool   Shared() const;
+
+    // Write the dirty pages of n bytes at off (the whole file if n is 0)
+    //   back to the file and wait for them (false for a private mapping)
+    bool Sync(size_t off=0, size_t n=0);
+};
+
+#endif
@@ -27,7 +27,9 @@ void BitDeviceMachine::RegTape::DBGPRINT()
 			      "H", "X", "P", "p+2x", "HSTOFF", "28", "currentState",
 			      "az", "ap", "z", "p", "34", "op", "aarg1",
 			      "arg1", "aarg2", "arg2", "aarg3", "arg3", "anxtCmd",
-			      "nxtCmd", "44", "45", "46", "47", "48", "1stcmdoff"};
+			      "nxtCmd", "44", "45", "46", "47", "48", "1stcmdoff",
+			      "rsp", "rs0", "rs1", "rs2", "rs3", "rs4", "rs5",
+			      "rs6", "rs7", "rs8", "rs9", "rs10", "rs11", "rs12"};
 	
     for(int i=0; i<MAXREGS; i++)
     {
@@ -0,0 +1,190 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+#include "ResultsDB.h"
+#include "BitDeviceMachine.h"
+
+static const char MAGIC[8] = {'B','D','M','R','S','L','T','S'};
+
+// Turns to wait on a slot being written before giving up on its writer,
+//   and reads of a slot that's rewritten under them before giving up
+enum { SPINS = 1u<<16, RETRIES = 64 };
+
+ResultsDB::ResultsDB()  {h = 0; slot = 0;}
+ResultsDB::~ResultsDB() {Close();}
+
+// A new file is made under a name of its own and linked into place once
+//   it's set up, so no one opens it half made
+bool ResultsDB::Open(const char* name, unsigned slots)
+{
+    Close();
+    unsigned n = 1;
+    while(n < slots) n *= 2;
+
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", name, (int)getpid());
+    int fd = open(name, O_RDONLY);
+    if(fd >= 0)
+	close(fd);
+    else if((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) >= 0)
+    {
+	Header hd;
+	memset((void*)&hd, 0, sizeof(hd));
+	memcpy(hd.magic, MAGIC, sizeof(MAGIC));
+	hd.version = VERSION;
+	hd.slots   = n;
+	bool ok = (write(fd, &hd, sizeof(hd)) == (ssize_t)sizeof(hd) &&
+		   ftruncate(fd, sizeof(Header)+(off_t)n*sizeof(Slot)) == 0);
+	close(fd);
+	if(ok) link(tmp, name); // Whoever links first made the file
+	unlink(tmp);
+    }
+
+    if(!file.Open(name, true)) return false;
+    Header* hd = (Header*)file.Base();
+    if(file.Len() < sizeof(Header) || memcmp(hd->magic, MAGIC, sizeof(MAGIC)) ||
+       hd->version != VERSION || hd->slots == 0 ||
+       (hd->slots & (hd->slots-1)) ||
+       file.Len() != sizeof(Header)+(size_t)hd->slots*sizeof(Slot))
+    {
+	file.Close();
+	return false;
+    }
+    h    = hd;
+    slot = (Slot*)(file.Base()+sizeof(Header));
+    return true;
+}
+
+void ResultsDB::Close()
+{
+    file.Close();
+    h    = 0;
+    slot = 0;
+}
+
+// Wait for a slot to be written at least once and not be being written
+//   -- false if its writer seems to have gone
+static bool settled(const std::atomic<uint32_t> &seq, uint32_t &e)
+{
+    for(unsigned spin=0; spin<SPINS; spin++)
+    {
+	e = seq.load(std::memory_order_acquire);
+	if(e && !(e & 1)) return true;
+	sched_yield();
+    }
+    return false;
+}
+
+// Linear probing from the tag: a free slot ends the search (or is
+//   claimed), a slot with our tag is ours if the rest of the key matches
+ResultsDB::Slot* ResultsDB::find(const Key &k, bool claim) const
+{
+    assert(h && k.hi);
+    uint32_t mask = h->slots-1;
+    for(uint32_t n=0, i=k.hi & mask; n<h->slots; n++, i=(i+1) & mask)
+    {
+	Slot*    s = slot+i;
+	uint64_t t = s->tag.load(std::memory_order_acquire);
+	if(t == 0)
+	{
+	    if(!claim) return 0;
+	    if(s->tag.compare_exchange_strong(t, k.hi))
+	    {
+		h->entries++;
+		return s;
+	    }
+	}
+	if(t != k.hi) continue;
+
+	// Our tag -- the rest of the key doesn't change once written
+	uint32_t e;
+	if(settled(s->seq, e) && s->lo == k.lo) return s;
+    }
+    return 0;
+}
+
+bool ResultsDB::Get(const Key &k, Result &r) const
+{
+    Slot* s = find(k, false);
+    if(!s) return false;
+    for(unsigned n=0; n<RETRIES; n++)
+    {
+	uint32_t e;
+	if(!settled(s->seq, e)) return false;
+	r.verdict = s->verdict;
+	r.decider = s->decider;
+	r.steps   = s->steps;
+	r.ones    = s->ones;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if(s->seq.load(std::memory_order_relaxed) == e) return true;
+    }
+    return false;
+}
+
+bool ResultsDB::Put(const Key &k, const Result &r)
+{
+    Slot* s = find(k, true);
+    if(!s) return false;
+
+    // Take the slot for writing: from even (0 if new) to odd
+    uint32_t e = s->seq.load(std::memory_order_acquire);
+    for(unsigned spin=0; ; spin++)
+    {
+	if(!(e & 1) && s->seq.compare_exchange_weak(e, e+1)) break;
+	if(spin == SPINS) return false;
+	sched_yield();
+	e = s->seq.load(std::memory_order_acquire);
+    }
+    s->lo      = k.lo;
+    s->verdict = r.verdict;
+    s->decider = r.decider;
+    s->steps   = r.steps;
+    s->ones    = r.ones;
+    s->seq.store(e+2, std::memory_order_release);
+    return true;
+}
+
+unsigned long ResultsDB::Count() const {return (h ? h->entries.load() : 0);}
+unsigned      ResultsDB::Slots() const {return (h ? h->slots : 0);}
+
+bool ResultsDB::Sync() {return file.Sync();}
+
+// Two FNV-1a streams with different starts, each finished with a
+//   splitmix64 mix so every bit of the input reaches every bit of the key
+static uint64_t finish(uint64_t x)
+{
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27; x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+ResultsDB::Key ResultsDB::Hash(const uchar* b, unsigned n, uint64_t seed)
+{
+    uint64_t h1 = 0xCBF29CE484222325ull ^ seed;
+    uint64_t h2 = 0x84222325CBF29CE4ull ^ (seed*0x9E3779B97F4A7C15ull);
+    for(unsigned i=0; i<n; i++)
+    {
+	h1 = (h1 ^ b[i]) * 0x100000001B3ull;
+	h2 = (h2 ^ b[i] ^ (h2 >> 29)) * 0x100000001B3ull;
+    }
+    Key k;
+    k.hi = finish(h1 ^ n);
+    k.lo = finish(h2 + k.hi);
+    if(k.hi == 0) k.hi = 1;
+    return k;
+}
+
+bool ResultsDB::KeyOf(BitDeviceMachine &m, Key &k)
+{
+    unsigned len = 4+9*m.CommandCount();
+    uchar*   buf = new uchar[len];
+    bool     mirrored;
+    unsigned n   = m.Canonical(buf, len, &mirrored);
+    if(n) k = Hash(buf, n, m.TapeHash(mirrored));
+    delete [] buf;
+    return (n != 0);
+}
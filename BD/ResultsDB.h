@@ -0,0 +1,108 @@
+#ifndef RESULTSDB_H
+#define RESULTSDB_H
+
+#include <stdint.h>
+#include <atomic>
+#include "MappedFile.h"
+
+class BitDeviceMachine;
+
+// A ResultsDB is a file of results of runs, looked up by a 128-bit key
+//   for the machine (see KeyOf) so a machine is only ever decided once.
+//   The file is mapped shared, so every process that opens it sees the
+//   same table, and it's laid out as:
+//
+//     Header : magic "BDMRSLTS" | version | slot count | entries
+//     Slots  : an open addressing hash table (linear probing) of Slots
+//
+//   A slot is claimed with a compare and swap of its tag (the first half
+//   of the key, never 0) from 0, so two processes putting the same key
+//   end up in the same slot, and its fields are written under a sequence
+//   count that is odd while they are being written (a seqlock): readers
+//   retry if it changed while they read. Slots are never freed and the
+//   table doesn't grow, so it's made with room to spare. A writer that
+//   dies mid write leaves its slot odd, and after a while others treat it
+//   as missing rather than wait on it -- as they do a slot rewritten
+//   under them every time they read it, after a few tries
+class ResultsDB
+{
+public:
+    struct Key
+    {
+	uint64_t hi; // Tag -- never 0
+	uint64_t lo;
+    };
+
+    struct Result
+    {
+	uint8_t       verdict; // DeciderPipeline::VERDICT
+	int8_t        decider; // Stage that decided it (-1 for a plain run)
+	unsigned long steps;   // Turing steps to decide it
+	unsigned long ones;    // 1s on the tape when decided (the score)
+    };
+
+private:
+    struct Header
+    {
+	char                       magic[8];
+	uint32_t                   version;
+	uint32_t                   slots;   // A power of two
+	std::atomic<uint64_t>      entries; // Slots claimed
+	uchar                      pad[40];
+    };
+
+    struct Slot
+    {
+	std::atomic<uint64_t> tag;   // key.hi once claimed, 0 if free
+	std::atomic<uint32_t> seq;   // Odd while being written, 0 if never
+	uint8_t               verdict;
+	int8_t                decider;
+	uint8_t               pad[2];
+	uint64_t              lo;    // key.lo
+	uint64_t              steps;
+	uint64_t              ones;
+    };
+
+    enum { VERSION = 2 }; // 2: keyed by normal form
+
+    MappedFile file;
+    Header*    h;     // Header and slots in the mapping (0 if closed)
+    Slot*      slot;
+
+    // Slot of k, claiming one for it if claim (0 if none, or the table
+    //   is full)
+    Slot* find(const Key &k, bool claim) const;
+
+public:
+    ResultsDB();
+    ~ResultsDB();
+
+    // Open the results file name, making it with room for slots results
+    //   (rounded up to a power of two) if there isn't one -- false if it
+    //   can't be made or isn't a results file
+    bool Open(const char* name, unsigned slots=1u<<20);
+    void Close();
+
+    // Look up k (false if it isn't there) and put a result for it --
+    //   false if the table is full. Putting a key again replaces its result
+    bool Get(const Key &k, Result &r) const;
+    bool Put(const Key &k, const Result &r);
+
+    // Results held and room for them
+    unsigned long Count() const;
+    unsigned      Slots() const;
+
+    // Write the table back to the file
+    bool Sync();
+
+    // Key for a machine as it stands: its normal form (BitDeviceMachine::
+    //   Canonical) and its tape, mirrored with it -- so machines that only
+    //   differ in state numbering, unreachable states or mirroring share
+    //   a key (and a result). False if it can't be encoded
+    static bool KeyOf(BitDeviceMachine &m, Key &k);
+
+    // 128-bit hash of n bytes (the tag half never 0)
+    static Key  Hash(const uchar* b, unsigned n, uint64_t seed=0);
+};
+
+#endif
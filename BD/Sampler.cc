@@ -0,0 +1,272 @@
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "Sampler.h"
+
+// splitmix64: the Rng's seeding, and a mix of the sample index into it
+static uint64_t splitmix(uint64_t &x)
+{
+    uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k) {return (x << k) | (x >> (64-k));}
+
+Sampler::Rng::Rng(uint64_t seed) {Seed(seed);}
+
+void Sampler::Rng::Seed(uint64_t seed)
+{
+    for(int k=0; k<4; k++)
+	s[k] = splitmix(seed);
+}
+
+uint64_t Sampler::Rng::Next()
+{
+    uint64_t r = rotl(s[1]*5, 7)*9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3]  = rotl(s[3], 45);
+    return r;
+}
+
+unsigned Sampler::Rng::Below(unsigned n)
+{return (unsigned)(((Next() >> 32)*n) >> 32);}
+
+// Bucket of v by powers of two (0 and 1 share the first)
+static unsigned bucket(unsigned long v)
+{return (v < 2 ? 0 : 63-__builtin_clzl(v));}
+
+void Sampler::Stats::Clear()
+{
+    memset((void*)this, 0, sizeof(*this));
+    maxTimeAt = maxOnesAt = NONE;
+}
+
+// Sums add; of two equal maxima the earlier sample is kept, so the
+//   totals don't depend on which thread ran what
+void Sampler::Stats::Merge(const Stats &o)
+{
+    samples += o.samples;
+    halted  += o.halted;
+    skipped += o.skipped;
+    steps   += o.steps;
+    timeSum += o.timeSum;
+    timeSq  += o.timeSq;
+    if(o.maxTime > maxTime || (o.maxTime == maxTime && o.maxTimeAt < maxTimeAt))
+    {
+	maxTime   = o.maxTime;
+	maxTimeAt = o.maxTimeAt;
+    }
+    if(o.maxOnes > maxOnes || (o.maxOnes == maxOnes && o.maxOnesAt < maxOnesAt))
+    {
+	maxOnes   = o.maxOnes;
+	maxOnesAt = o.maxOnesAt;
+    }
+    for(unsigned k=0; k<BUCKETS; k++)
+    {
+	time[k]   += o.time[k];
+	extent[k] += o.extent[k];
+    }
+    for(unsigned k=0; k<=MAXONES; k++)
+	ones[k] += o.ones[k];
+}
+
+Sampler::Sampler(unsigned n, unsigned long budget, uint64_t seed)
+{
+    assert(n > 0 && budget > 0);
+    states        = n;
+    this->budget  = budget;
+    this->seed    = seed;
+    threads       = 1;
+    alloc         = 0;
+    sparse        = false;
+    skip          = 0;
+    skips         = 0;
+    progress      = 0;
+    end           = 0;
+    next          = 0;
+    startNs       = 0;
+    stopNs        = 0;
+    total.Clear();
+}
+
+void Sampler::SetThreads(unsigned n) {assert(n > 0); threads = n;}
+void Sampler::SetAllocator(Allocator* al) {alloc = al;}
+void Sampler::SparseTape(bool sp) {sparse = sp;}
+void Sampler::SetSkip(const unsigned long* list, unsigned n)
+{skip = list; skips = n;}
+void Sampler::SetProgress(std::atomic<unsigned long>* at) {progress = at;}
+const Sampler::Stats& Sampler::Totals() const {return total;}
+unsigned      Sampler::States() const {return states;}
+unsigned long Sampler::Budget() const {return budget;}
+uint64_t      Sampler::Seed()   const {return seed;}
+
+unsigned long Sampler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Each transition is one draw: symbol, move and next state (0 is halt)
+//   out of 9*(states+1) outcomes
+void Sampler::Draw(TransitionTable &t, unsigned s, unsigned long i,
+		   Rng &r) const
+{
+    uint64_t mix = i;
+    r.Seed(seed ^ splitmix(mix));
+    unsigned outcomes = 9*(states+1);
+    for(unsigned k=0; k<states; k++)
+	for(uchar x=0; x<3; x++)
+	{
+	    unsigned v = r.Below(outcomes);
+	    unsigned n = v/9;
+	    t.Set(s+k, x, v%3, (int)(v/3%3)-1, (n ? s+n-1 : 0));
+	}
+}
+
+void Sampler::Make(BitDeviceMachine &m, unsigned long i) const
+{
+    m.SparseTape(sparse);
+    unsigned        s = m.InitToStates(states, 2*budget+1);
+    TransitionTable t;
+    Rng             r;
+    m.GetTable(t);
+    Draw(t, s, i, r);
+    m.SetTable(t);
+}
+
+void Sampler::work(Stats* st, std::atomic<unsigned long>* at)
+{
+    BitDeviceMachine m;
+    m.SetAllocator(alloc);
+    m.SparseTape(sparse);
+    unsigned        s = m.InitToStates(states, 2*budget+1);
+    TransitionTable t;
+    Rng             r;
+    m.GetTable(t);
+
+    unsigned long i0;
+    while((i0 = next.fetch_add(CHUNK)) < end)
+    {
+	unsigned long i1 = (end-i0 < CHUNK ? end : i0+CHUNK);
+	for(unsigned long i=i0; i<i1; i++)
+	{
+	    if(skips && std::binary_search(skip, skip+skips, i))
+	    {
+		st->skipped++;
+		continue;
+	    }
+	    if(at) at->store(i, std::memory_order_relaxed);
+	    Draw(t, s, i, r);
+	    m.FillTape(2);
+	    m.SetHead(budget);
+	    m.SetCurrentCommand(s);
+	    unsigned long n = m.ExecuteTable(t, budget);
+
+	    unsigned      left, right;
+	    unsigned long w = (m.Extent(left, right) ? right-left+1 : 0);
+	    st->samples++;
+	    st->steps += n;
+	    st->extent[bucket(w)]++;
+	    if(!m.Halted()) continue;
+
+	    unsigned long cnt[3];
+	    m.CountSymbols(cnt);
+	    st->halted++;
+	    st->timeSum += n;
+	    st->timeSq  += (double)n*n;
+	    st->time[bucket(n)]++;
+	    st->ones[cnt[1] < MAXONES ? cnt[1] : (unsigned long)MAXONES]++;
+	    if(n > st->maxTime || st->maxTimeAt == NONE)
+	    {
+		st->maxTime   = n;
+		st->maxTimeAt = i;
+	    }
+	    if(cnt[1] > st->maxOnes || st->maxOnesAt == NONE)
+	    {
+		st->maxOnes   = cnt[1];
+		st->maxOnesAt = i;
+	    }
+	}
+    }
+    if(at) at->store(NONE, std::memory_order_relaxed);
+}
+
+void Sampler::Run(unsigned long n, unsigned long first)
+{
+    end     = first+n;
+    next    = first;
+    startNs = now();
+
+    Stats*       st   = new Stats[threads];
+    std::thread* pool = new std::thread[threads];
+    for(unsigned k=0; k<threads; k++)
+    {
+	st[k].Clear();
+	pool[k] = std::thread(&Sampler::work, this, st+k,
+			      (progress ? progress+k : 0));
+    }
+    total.Clear();
+    for(unsigned k=0; k<threads; k++)
+    {
+	pool[k].join();
+	total.Merge(st[k]);
+    }
+    delete [] pool;
+    delete [] st;
+    stopNs = now();
+}
+
+void Sampler::Report(FILE* f) const
+{
+    double wall = (stopNs-startNs)/1e9;
+    Report(f, total, (wall > 0 ? wall : 1e-9), threads);
+}
+
+void Sampler::Report(FILE* f, const Stats &t, double wall,
+		     unsigned threads) const
+{
+    unsigned long undecided = t.samples-t.halted;
+
+    fprintf(f, "%u states, %lu step budget, seed %llu, %u threads\n",
+	    states, budget, (unsigned long long)seed, threads);
+    fprintf(f, "samples %lu  halted %lu  undecided %lu (%.2f%%)\n",
+	    t.samples, t.halted, undecided,
+	    (t.samples ? 100.0*undecided/t.samples : 0.0));
+    if(t.skipped)
+	fprintf(f, "skipped %lu\n", t.skipped);
+    if(wall > 0)
+	fprintf(f, "steps %lu  samples/s %.0f  steps/s %.0f  wall %.3fs\n",
+		t.steps, t.samples/wall, t.steps/wall, wall);
+    else
+	fprintf(f, "steps %lu\n", t.steps);
+    if(t.halted)
+    {
+	double mean = (double)t.timeSum/t.halted;
+	double var  = t.timeSq/t.halted - mean*mean;
+	fprintf(f, "time to halt: mean %.2f  sd %.2f  max %lu (sample %lu)\n",
+		mean, sqrt(var > 0 ? var : 0), t.maxTime, t.maxTimeAt);
+	fprintf(f, "ones when halted: max %lu (sample %lu)\n",
+		t.maxOnes, t.maxOnesAt);
+    }
+
+    fprintf(f, "%-12s %12s %12s\n", "steps/width", "halted", "extent");
+    for(unsigned k=0; k<BUCKETS; k++)
+	if(t.time[k] || t.extent[k])
+	    fprintf(f, "%5lu-%-6lu %12lu %12lu\n", (k ? 1ul << k : 0ul),
+		    (2ul << k)-1, t.time[k], t.extent[k]);
+    fprintf(f, "%-12s %12s\n", "ones", "halted");
+    for(unsigned k=0; k<=MAXONES; k++)
+	if(t.ones[k])
+	    fprintf(f, "%3u%-9s %12lu\n", k, (k == MAXONES ? "+" : ""),
+		    t.ones[k]);
+}
@@ -0,0 +1,158 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include "BitDeviceMachine.h"
+#include "TransitionTable.h"
+
+// A Sampler runs random n-state machines from a blank tape, each for up
+//   to a budget of steps, and gathers what they did:
+//
+//     halted     : how many halted within the budget (the rest didn't)
+//     time       : steps to halt, by powers of two, with their mean
+//     ones       : 1s left on the tape by the machines that halted
+//     extent     : width of the part of the tape written, every machine
+//
+//   Machine i of a seed is the same however many threads run and in
+//   whatever order: its table is drawn from an Rng seeded from the seed
+//   and i alone, so Make can build it again to look at. Each thread has
+//   its own machine, packed table, Rng and Stats, takes samples a chunk
+//   at a time from a shared counter and shares nothing else; the Stats
+//   are added up when the threads are done. A step is one ExecuteTable
+//   table load, and the tape is 2*budget+1 symbols with the head in the
+//   middle, so no machine reaches an end of it
+//
+//   Samples aren't looked up in a ResultsDB or put together by their
+//   Canonical form: the Stats are of the draws, so a machine drawn twice
+//   counts twice, and a stored result has no extent and was run to some
+//   other budget. A key (Encode, Canonicalize and a hash, then a probe
+//   of the shared file) also costs about what running a sample to a
+//   budget of a few hundred steps does
+class Sampler
+{
+public:
+    // xoshiro256** -- its state filled by splitmix64, so any seed does
+    class Rng
+    {
+    private:
+	uint64_t s[4];
+
+    public:
+	Rng(uint64_t seed=0);
+	void     Seed(uint64_t seed);
+	uint64_t Next();
+
+	// Uniform in [0, n) (the high bits, by a multiply)
+	unsigned Below(unsigned n);
+    };
+
+    enum { BUCKETS = 64, MAXONES = 255 };
+    static const unsigned long NONE = ~0ul;
+
+    // Totals for the samples a thread ran, or all of them once merged
+    //   -- each thread's on cache lines of their own
+    struct Stats
+    {
+	alignas(64) unsigned long samples;
+	unsigned long halted;
+	unsigned long skipped;         // Passed over (see SetSkip), not
+				       //   counted in samples
+	unsigned long steps;           // Steps run by every sample
+	unsigned long timeSum;         // Steps to halt, added up
+	double        timeSq;          //   and squared
+	unsigned long maxTime;         // Longest time to halt
+	unsigned long maxTimeAt;       //   and the first sample to take it
+				       //   (NONE if none halted)
+	unsigned long maxOnes;         // Most 1s left by one that halted
+	unsigned long maxOnesAt;
+	unsigned long time[BUCKETS];   // Bucket k: 2^k <= time < 2^(k+1)
+	unsigned long ones[MAXONES+1]; // The last is MAXONES or more
+	unsigned long extent[BUCKETS]; // Bucket k as for time (0 is 0 or 1)
+
+	void Clear();
+	void Merge(const Stats &o);
+    };
+
+private:
+    // Configuration
+    unsigned      states;
+    unsigned long budget;
+    uint64_t      seed;
+    unsigned      threads;
+    Allocator*    alloc;
+    bool          sparse;
+
+    // Samples to pass over, in order, and where each thread says which
+    //   sample it's on (see SetSkip and SetProgress)
+    const unsigned long*        skip;
+    unsigned                    skips;
+    std::atomic<unsigned long>* progress;
+
+    // Running state
+    unsigned long              end;   // Sample after the last to run
+    std::atomic<unsigned long> next;  // First sample not yet taken
+    Stats                      total;
+    unsigned long              startNs;
+    unsigned long              stopNs;
+
+    // Samples are taken this many at a time
+    enum { CHUNK = 1024 };
+
+    // Thread loop: run chunks into st until there are none left,
+    //   storing each sample's number in at (if it isn't 0) first
+    void work(Stats* st, std::atomic<unsigned long>* at);
+
+    static unsigned long now();
+
+    // Not copyable
+    Sampler(const Sampler&);
+    Sampler& operator=(const Sampler&);
+
+public:
+    // Machines of n states run for up to budget steps
+    Sampler(unsigned n, unsigned long budget, uint64_t seed=0);
+
+    // Threads to run on, and the allocator their machines' tapes come
+    //   from (the heap if al is 0) -- before Run
+    void SetThreads(unsigned n);
+    void SetAllocator(Allocator* al);
+
+    // Lay the machines' tapes out sparse (see BitDeviceMachine::SparseTape),
+    //   so a big budget costs the pages each machine writes rather than
+    //   the whole tape -- before Run (or Make)
+    void SparseTape(bool sp);
+
+    // Samples to pass over (n of them, in order, kept by the caller) --
+    //   they count as skipped and not in samples
+    // Where thread k of a Run stores the number of each sample as it
+    //   starts on it, and NONE once it's done (at[k] -- none if at is
+    //   0), so a process watching this one can tell which sample it was
+    //   on if it goes away
+    void SetSkip(const unsigned long* list, unsigned n);
+    void SetProgress(std::atomic<unsigned long>* at);
+
+    unsigned      States() const;
+    unsigned long Budget() const;
+    uint64_t      Seed()   const;
+
+    // Run samples first..first+count-1 (waits for them) and add up
+    //   their Stats
+    void Run(unsigned long count, unsigned long first=0);
+    const Stats& Totals() const;
+
+    // Print the totals and the rate they were run at -- or t, run by
+    //   threads threads in wall seconds (no rates if wall is 0)
+    void Report(FILE* f) const;
+    void Report(FILE* f, const Stats &t, double wall, unsigned threads) const;
+
+    // Draw sample i's states into rows s..s+states-1 of t, where s is
+    //   the command index InitToStates gave
+    void Draw(TransitionTable &t, unsigned s, unsigned long i, Rng &r) const;
+
+    // Make m sample i, ready to run
+    void Make(BitDeviceMachine &m, unsigned long i) const;
+};
+
+#endif
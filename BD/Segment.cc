@@ -0,0 +1,279 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "Segment.h"
+
+// A segment of len bytes at start, split into 2^shift byte pages
+//    (shift 0 gives a single, contiguous page)
+Segment::Segment(unsigned st, unsigned ln, unsigned sh, uchar f, unsigned ex)
+{
+    assert(sh <= MAXPAGESHIFT);
+    assert(ex == 0 || sh == 0);
+    start   = st;
+    len     = ln;
+    shift   = sh;
+    extra   = ex;
+    fill    = f;
+    pageCnt = (shift ? (len+(1u<<shift)-1)>>shift : 1);
+    live    = 0;
+    dirty   = 0;
+    dirtyCnt = 0;
+    mark    = 0;
+
+    // Zeroed by calloc -- a big table is fresh pages the OS zeroes lazily
+    page    = (Page**)calloc(pageCnt, sizeof(Page*));
+    assert(page);
+
+    // Contiguous segments are always resident (structs overlay them)
+    if(!shift) {page[0] = newPage(0); live++;}
+}
+
+Segment::~Segment()
+{
+    for(unsigned i=0; i<pageCnt; i++)
+	unref(page[i]);
+    free(page);
+    delete [] dirty;
+    delete [] mark;
+}
+
+// Share every page of other
+Segment::Segment(const Segment& o)
+{
+    start   = o.start;
+    len     = o.len;
+    shift   = o.shift;
+    extra   = o.extra;
+    fill    = o.fill;
+    pageCnt = o.pageCnt;
+    live    = o.live;
+    dirty   = 0;      // A fork doesn't inherit tracking
+    dirtyCnt = 0;
+    mark    = 0;
+    page    = (Page**)malloc(pageCnt*sizeof(Page*));
+    assert(page);
+    for(unsigned i=0; i<pageCnt; i++)
+    {
+	page[i] = o.page[i];
+	if(page[i]) page[i]->refs++;
+    }
+}
+
+// A new segment sharing every page with this one
+Segment* Segment::Fork() const
+{
+    return new Segment(*this);
+}
+
+// Bytes of the page with index i (the last page may be short)
+unsigned Segment::pageLen(unsigned i) const
+{
+    if(!shift) return len;
+    unsigned pl = 1u<<shift;
+    return (i+1 < pageCnt ? pl : len-i*pl);
+}
+
+// Allocate page i full of fill bytes (plus any private extra bytes)
+Segment::Page* Segment::newPage(unsigned i)
+{
+    unsigned pl = pageLen(i);
+    Page* p = (Page*)malloc(sizeof(Page)+pl+extra);
+    assert(p);
+    new (&p->refs) std::atomic<int>(1);
+    p->len = pl;
+    memset(p->Data(), fill, pl+extra);
+    return p;
+}
+
+// Make a private copy of a shared page and drop our share of it
+Segment::Page* Segment::copyPage(Page* p)
+{
+    Page* np = (Page*)malloc(sizeof(Page)+p->len+extra);
+    assert(np);
+    new (&np->refs) std::atomic<int>(1);
+    np->len = p->len;
+    memcpy(np->Data(), p->Data(), p->len+extra);
+    unref(p);
+    return np;
+}
+
+void Segment::unref(Page* p)
+{
+    if(p && --p->refs == 0)
+	free(p);
+}
+
+// Page full of fill bytes that absent pages read from. Built once per fill
+//   value and never freed
+const uchar* Segment::fillPage(uchar f)
+{
+    static std::atomic<uchar*> fills[256];
+    uchar* fp = fills[f].load(std::memory_order_acquire);
+    if(!fp)
+    {
+	uchar* np = new uchar[1u<<MAXPAGESHIFT];
+	memset(np, f, 1u<<MAXPAGESHIFT);
+	if(fills[f].compare_exchange_strong(fp, np))
+	    fp = np;
+	else
+	    delete [] np; // Another thread got there first
+    }
+    return fp;
+}
+
+// Geometry
+unsigned Segment::Start()   const {return start;}
+unsigned Segment::Len()     const {return len;}
+unsigned Segment::End()     const {return start+len;}
+unsigned Segment::PageLen() const {return (shift ? 1u<<shift : len);}
+bool     Segment::Contains(unsigned b) const
+{return (b >= start && b-start < len);}
+
+// Address of the byte at b for reading -- absent pages read as fill
+const uchar* Segment::ReadA(unsigned b) const
+{
+    assert(Contains(b));
+    unsigned off = b-start;
+    unsigned i   = (shift ? off>>shift : 0);
+    unsigned o   = (shift ? off&((1u<<shift)-1) : off);
+    if(!page[i]) return fillPage(fill)+o;
+    return page[i]->Data()+o;
+}
+
+// Address of the byte at b for writing -- copy a shared page, allocate
+//   an absent one
+uchar* Segment::WriteA(unsigned b)
+{
+    assert(Contains(b));
+    unsigned off = b-start;
+    unsigned i   = (shift ? off>>shift : 0);
+    unsigned o   = (shift ? off&((1u<<shift)-1) : off);
+    Page* p = page[i];
+    if(!p)
+    {
+	p = page[i] = newPage(i);
+	live++;
+	touch(i);
+    }
+    else if(p->refs.load(std::memory_order_acquire) > 1)
+    {
+	p = page[i] = copyPage(p);
+	touch(i);
+    }
+    return p->Data()+o;
+}
+
+// Bytes from b to the end of its page
+unsigned Segment::Span(unsigned b) const
+{
+    assert(Contains(b));
+    unsigned off = b-start;
+    if(!shift) return len-off;
+    unsigned k = (1u<<shift) - (off&((1u<<shift)-1));
+    return (k < len-off ? k : len-off);
+}
+
+// Private bytes past the end of a single page segment
+uchar* Segment::Extra()
+{
+    assert(!shift && extra);
+    return WriteA(start)+len;
+}
+
+// Copy n bytes at b out of the segment, a page at a time
+void Segment::Get(uchar* buf, unsigned b, unsigned n) const
+{
+    while(n)
+    {
+	unsigned o = (shift ? (b-start)&((1u<<shift)-1) : b-start);
+	unsigned k = PageLen()-o;
+	if(k > n) k = n;
+	memcpy(buf, ReadA(b), k);
+	buf += k; b += k; n -= k;
+    }
+}
+
+// Copy n bytes into the segment at b, a page at a time
+void Segment::Put(const uchar* buf, unsigned b, unsigned n)
+{
+    while(n)
+    {
+	unsigned o = (shift ? (b-start)&((1u<<shift)-1) : b-start);
+	unsigned k = PageLen()-o;
+	if(k > n) k = n;
+	memcpy(WriteA(b), buf, k);
+	buf += k; b += k; n -= k;
+    }
+}
+
+// Drop every page. A contiguous segment keeps its page, refilled
+void Segment::Clear()
+{
+    if(!shift)
+    {
+	memset(WriteA(start), fill, len);
+	return;
+    }
+    for(unsigned i=0; live && i<pageCnt; i++)
+	if(page[i])
+	{
+	    unref(page[i]);
+	    page[i] = 0;
+	    live--;
+	    touch(i);
+	}
+}
+
+// Bytes held in pages this segment has allocated or shares
+unsigned Segment::Resident() const
+{
+    unsigned r = 0;
+    for(unsigned i=0; i<pageCnt; i++)
+	if(page[i]) r += page[i]->len;
+    return r;
+}
+
+// Note a touched page once
+void Segment::touch(unsigned i)
+{
+    if(dirty && !mark[i])
+    {
+	mark[i] = 1;
+	dirty[dirtyCnt++] = i;
+    }
+}
+
+// Start or stop tracking touched pages (starting again keeps the list)
+void Segment::Track(bool on)
+{
+    if(on == (dirty != 0)) return;
+    delete [] dirty;
+    delete [] mark;
+    dirty    = 0;
+    mark     = 0;
+    dirtyCnt = 0;
+    if(on)
+    {
+	dirty = new unsigned[pageCnt];
+	mark  = new uchar[pageCnt];
+	memset(mark, 0, pageCnt);
+    }
+}
+
+// Forget the pages touched so far -- only they need their flags reset
+void Segment::ClearDirty()
+{
+    for(unsigned k=0; k<dirtyCnt; k++)
+	mark[dirty[k]] = 0;
+    dirtyCnt = 0;
+}
+
+unsigned Segment::DirtyCount() const {return dirtyCnt;}
+
+void Segment::DirtyPage(unsigned k, unsigned &b, unsigned &n) const
+{
+    assert(k < dirtyCnt);
+    b = start + (dirty[k] << shift);
+    n = pageLen(dirty[k]);
+}
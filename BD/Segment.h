@@ -0,0 +1,117 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <atomic>
+#include "syntactic_sugar.h"
+
+// A Segment holds len bytes of a BitDevice's address space, beginning at
+//   byte start, in fixed size pages:
+//
+//      start                                          start+len
+//        | page 0 | page 1 | page 2 |  ...  | page n-1 |
+//
+// Pages are reference counted so a Segment can be forked: the fork shares
+//   every page with its parent and whichever side writes a shared page
+//   first gets its own copy. A page that has never been written is not
+//   allocated at all and reads as the segment's fill byte, so a segment
+//   costs only the pages that have been written (and its page table).
+//
+// A segment with a single page (pageLen >= len) is contiguous, so a struct
+//   can be overlaid on it. Such a page may carry extra bytes past len that
+//   are outside the address space and private to the segment's owner
+class Segment
+{
+private:
+    // A reference counted page, followed by its bytes
+    struct Page
+    {
+	std::atomic<int> refs;
+	unsigned         len;
+	uchar* Data() {return (uchar*)(this+1);}
+    };
+
+    // Private data members
+    unsigned start;   // First byte of the segment in the device
+    unsigned len;     // Length of the segment in bytes
+    unsigned shift;   // log2 of page length
+    unsigned extra;   // Private bytes past the end of a single page
+    uchar    fill;    // Value of bytes in pages never written
+    unsigned pageCnt; // Number of pages
+    unsigned live;    // Pages that aren't 0
+    Page**   page;    // Pages (0 if never written)
+    unsigned* dirty;  // Pages touched since ClearDirty (0 if not tracking)
+    unsigned  dirtyCnt;
+    uchar*    mark;   //    and a flag per page for those in dirty
+
+    // Note that page i was made private or dropped (if tracking)
+    void touch(unsigned i);
+
+    // Allocate a page for page index i (filled) or copy one
+    Page* newPage(unsigned i);
+    Page* copyPage(Page* p);
+    static void unref(Page* p);
+
+    // Bytes of the page with index i
+    unsigned pageLen(unsigned i) const;
+
+    // Page full of fill bytes that absent pages read from
+    static const uchar* fillPage(uchar f);
+
+    // Share every page of other (Fork) -- not otherwise copyable
+    Segment(const Segment& other);
+    Segment& operator=(const Segment&);
+
+public:
+    // Largest page of a segment that has more than one
+    enum { MAXPAGESHIFT = 12 };
+
+    // A segment of len bytes at start, split into 2^shift byte pages
+    //    (shift 0 gives a single, contiguous page)
+    Segment(unsigned start, unsigned len, unsigned shift,
+	    uchar fill, unsigned extra=0);
+    ~Segment();
+
+    // A new segment sharing every page with this one
+    Segment* Fork() const;
+
+    // Geometry
+    unsigned Start() const;
+    unsigned Len() const;
+    unsigned End() const;
+    unsigned PageLen() const;
+    bool     Contains(unsigned byteAddress) const;
+
+    // Addressors for the byte at byteAddress (a device address). The
+    //   pointer stays good to the end of its page. For writing, a page
+    //   that is shared or was never written is made private first
+    const uchar* ReadA(unsigned byteAddress) const;
+    uchar*       WriteA(unsigned byteAddress);
+
+    // Bytes from byteAddress to the end of its page
+    unsigned Span(unsigned byteAddress) const;
+
+    // Private bytes past the end of a single page segment
+    uchar* Extra();
+
+    // Copy n bytes at byteAddress out of / into the segment
+    void Get(uchar* buf, unsigned byteAddress, unsigned n) const;
+    void Put(const uchar* buf, unsigned byteAddress, unsigned n);
+
+    // Drop every page, so the whole segment reads as fill again
+    void Clear();
+
+    // Bytes held in pages this segment has allocated or shares
+    unsigned Resident() const;
+
+    // Track the pages touched since the last ClearDirty. A page counts
+    //   when it is first made private or dropped, so once a Fork shares
+    //   every page (as at a checkpoint) each page written is caught the
+    //   first time and costs nothing after. DirtyPage gives the device
+    //   address and length of the kth page touched
+    void     Track(bool on);
+    void     ClearDirty();
+    unsigned DirtyCount() const;
+    void     DirtyPage(unsigned k, unsigned &byteAddress, unsigned &n) const;
+};
+
+#endif
@@ -44,12 +44,12 @@ void BitDeviceMachine::TMState::Random(int scnt)
     // Choose random values for the symbols, directions and next states
     //   for each of the three read symbols
     sym  = smask[rand()%3][0]; 
-    sym &= smask[rand()%3][1];
-    sym &= smask[rand()%3][2];
+    sym |= smask[rand()%3][1];
+    sym |= smask[rand()%3][2];
     
     dir  = smask[rand()%3][0];
-    dir &= smask[rand()%3][1];
-    dir &= smask[rand()%3][2];
+    dir |= smask[rand()%3][1];
+    dir |= smask[rand()%3][2];
     
     nxt[0] = STATE2OFF(rand()%(scnt+1));
     nxt[1] = STATE2OFF(rand()%(scnt+1));
@@ -0,0 +1,69 @@
+//=====================================================================================
+// Default constructor (never called because of "casting creation")
+BitDeviceMachine::TapeFile::TapeFile()
+{assert("Default constructor for TapeFile should never be called");}
+
+static const char TAPEFILEMAGIC[8] = {'B','D','M','T','A','P','E',0};
+
+// Init to a header for an image of len bytes with no sections
+void BitDeviceMachine::TapeFile::Init(unsigned len)
+{
+    memset(this, 0, sizeof(TapeFile));
+    memcpy(magic, TAPEFILEMAGIC, sizeof(magic));
+    version  = VERSION;
+    endian   = ENDIAN;
+    hdrLen   = 64;
+    sections = 0;
+    imageOff = (sizeof(TapeFile)+ALIGN-1)/ALIGN*ALIGN;
+    imageLen = len;
+    checksum = 0;
+}
+
+// Add a section at offset off in the image
+void BitDeviceMachine::TapeFile::AddSection(unsigned kind, unsigned index,
+					    unsigned off, unsigned len)
+{
+    assert(sections < MAXSECTIONS && off+len <= imageLen);
+    dir[sections].kind  = kind;
+    dir[sections].index = index;
+    dir[sections].off   = imageOff+off;
+    dir[sections].len   = len;
+    sections++;
+    hdrLen = 64+sections*sizeof(Section);
+}
+
+// Does buf start with the magic
+bool BitDeviceMachine::TapeFile::IsTapeFile(const uchar* buf, unsigned len)
+{
+    return (len >= sizeof(TAPEFILEMAGIC) &&
+	    !memcmp(buf, TAPEFILEMAGIC, sizeof(TAPEFILEMAGIC)));
+}
+
+// Is the header well formed for a file of fileLen bytes
+bool BitDeviceMachine::TapeFile::Valid(unsigned fileLen) const
+{
+    if(memcmp(magic, TAPEFILEMAGIC, sizeof(magic))) return false;
+    if(version != VERSION || endian != ENDIAN)      return false;
+    if(sections > MAXSECTIONS || (flags & ~LIVE))  return false;
+    if(hdrLen != 64+sections*sizeof(Section))       return false;
+    if(imageOff%ALIGN || imageOff < hdrLen)         return false;
+    if(imageOff > fileLen || imageLen > fileLen-imageOff) return false;
+    for(unsigned i=0; i<sections; i++)
+    {
+	if(dir[i].off < imageOff || dir[i].off > imageOff+imageLen) return false;
+	if(dir[i].len > imageOff+imageLen-dir[i].off) return false;
+    }
+    return true;
+}
+
+// 64-bit FNV-1a
+uint64_t BitDeviceMachine::TapeFile::Checksum(const uchar* buf, unsigned len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(unsigned i=0; i<len; i++)
+    {
+	h ^= buf[i];
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
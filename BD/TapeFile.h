@@ -0,0 +1,90 @@
+#ifndef TAPEFILE_H
+#define TAPEFILE_H
+
+// Layout of a machine file (version 2)
+//
+//   header | section directory | pad to 64 bytes | image
+//
+// The image is the machine's flat tape exactly as it runs -- MachineTape,
+//   RegTape and WorkingTape(s) back to back -- starting on a 64-byte
+//   boundary, so the file can be mapped and the image executed in place.
+//   The header is:
+//
+//     magic    | "BDMTAPE" and a 0                          8 bytes
+//     version  | 2                                          4 bytes
+//     endian   | 0x01020304 as the writer stores it         4 bytes
+//     hdrLen   | bytes of header and directory              4 bytes
+//     sections | entries in the directory                   4 bytes
+//     imageOff | file offset of the image (64-byte aligned) 4 bytes
+//     imageLen | bytes in the image                         4 bytes
+//     checksum | 64-bit FNV-1a of the image                 8 bytes
+//     flags    | LIVE while a machine runs on the file       4 bytes
+//     pad      | 0s to 64 bytes                            20 bytes
+//
+//   and each directory entry (kind, index, off, len) names a part of the
+//   image by its file offset and length: the MachineTape header and the
+//   commands before the first state (CMDS), the state table (STATES),
+//   the registers (REGS) and working tape index (TAPE). The sections are
+//   the image cut up, not copies, so they follow each other without gaps
+//   -- only the image as a whole is aligned.
+//
+// A machine run in place on a shared mapping of the file (MapFiles) sets
+//   LIVE as it starts and clears it as it lets go. The checksum is only
+//   brought up to date at a SyncFile, so a LIVE file -- the last state of
+//   a machine that stopped without letting go -- is read without it
+//
+// A file that doesn't start with the magic is a legacy file: a bare flat
+//   tape, as version 1 wrote it. Files are read only on machines with the
+//   writer's byte order
+class TapeFile
+{
+private:
+    friend class BitDeviceMachine;
+
+    enum { VERSION = 2, ENDIAN = 0x01020304, ALIGN = 64,
+	   MAXSECTIONS = 3+MAXTAPES };
+    enum SECTIONS { CMDS = 1, STATES = 2, REGS = 3, TAPE = 4 };
+    enum FLAGS    { LIVE = 1 };
+
+    struct Section
+    {
+	unsigned kind;  // One of SECTIONS
+	unsigned index; // Which tape for TAPE (0 otherwise)
+	unsigned off;   // File offset
+	unsigned len;   // Bytes
+    };
+
+    // Private data members
+    //   Total size: 64+16*MAXSECTIONS bytes
+    char     magic[8];
+    unsigned version;
+    unsigned endian;
+    unsigned hdrLen;
+    unsigned sections;
+    unsigned imageOff;
+    unsigned imageLen;
+    uint64_t checksum;
+    unsigned flags;
+    uchar    pad[20];
+    Section  dir[MAXSECTIONS];
+
+    // Default constructor (never called because of "casting creation")
+    TapeFile();
+
+    // Init to a header for an image of len bytes with no sections
+    void Init(unsigned len);
+
+    // Add a section of len bytes at offset off in the image
+    void AddSection(unsigned kind, unsigned index, unsigned off,
+		    unsigned len);
+
+    // Does buf (of len bytes) start with the magic, and is the header
+    //   well formed for a file of fileLen bytes
+    static bool IsTapeFile(const uchar* buf, unsigned len);
+    bool        Valid(unsigned fileLen) const;
+
+    // 64-bit FNV-1a of len bytes
+    static uint64_t Checksum(const uchar* buf, unsigned len);
+};
+
+#endif
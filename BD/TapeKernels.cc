@@ -0,0 +1,244 @@
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include "TapeKernels.h"
+
+// Low bit of every symbol in a word and a word of blanks
+#define LOBITS  0x5555555555555555ULL
+#define BLANKW  0xAAAAAAAAAAAAAAAAULL
+
+// Unaligned 64-bit load
+static inline uint64_t load64(const uchar* p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+// Symbol for a character of an initial tape string
+static inline uchar symOf(char c)
+{
+    assert(c == '0' || c == '1' || c == ' ');
+    return (c == '0' ? 0 : (c == '1' ? 1 : 2));
+}
+
+// A byte of 8/w blanks: a 1-bit blank is a 0 bit, wider blanks are 2
+uchar TapeKernels::BlankByte(unsigned w)
+{
+    switch(w)
+    {
+    case 1: return 0x00;
+    case 2: return BLANKS;
+    case 4: return 0x22;
+    case 8: return 0x02;
+    }
+    assert("Invalid symbol width");
+    return BLANKS;
+}
+
+// A byte of 8/w x's (a 1-bit tape holds 1s and blanks, never a 0)
+uchar TapeKernels::FillByte(uchar x, unsigned w)
+{
+    switch(w)
+    {
+    case 1: assert(x != 0); return (x == 1 ? 0xFF : 0x00);
+    case 2: assert(x < 3); return x*0x55;
+    case 4: assert(x < 16); return x*0x11;
+    case 8: return x;
+    }
+    assert("Invalid symbol width");
+    return 0;
+}
+
+// Set all 4n symbols to x -- a byte holds x four times
+void TapeKernels::Fill(uchar* t, unsigned n, uchar x)
+{
+    assert(x < 3);
+    memset(t, x*0x55, n);
+}
+
+// Write str at pos: a symbol at a time up to a byte boundary, then four
+//   symbols a byte, then whatever is left
+void TapeKernels::Load(uchar* t, unsigned pos, const char* str, unsigned len)
+{
+    unsigned i = 0;
+    for(; i < len && (pos+i)%SYMPERBYTE; i++)
+    {
+	unsigned p = pos+i, sh = 2*(p%SYMPERBYTE);
+	t[p/SYMPERBYTE] = (t[p/SYMPERBYTE] & ~(3<<sh)) | (symOf(str[i])<<sh);
+    }
+    for(; i+SYMPERBYTE <= len; i += SYMPERBYTE)
+	t[(pos+i)/SYMPERBYTE] = symOf(str[i])        | symOf(str[i+1]) << 2 |
+	                        symOf(str[i+2]) << 4 | symOf(str[i+3]) << 6;
+    for(; i < len; i++)
+    {
+	unsigned p = pos+i, sh = 2*(p%SYMPERBYTE);
+	t[p/SYMPERBYTE] = (t[p/SYMPERBYTE] & ~(3<<sh)) | (symOf(str[i])<<sh);
+    }
+}
+
+// Other widths a symbol at a time -- Load is only used to set up tapes
+void TapeKernels::Load(uchar* t, unsigned pos, const char* str, unsigned len,
+		       unsigned w)
+{
+    if(w == 2) {Load(t, pos, str, len); return;}
+    unsigned spb = 8/w, m = (1u<<w)-1;
+    for(unsigned i=0; i<len; i++)
+    {
+	unsigned p = pos+i, sh = w*(p%spb);
+	uchar    x = symOf(str[i]);
+	if(w == 1) {assert(x != 0); x = (x == 1);}
+	t[p/spb] = (t[p/spb] & ~(m<<sh)) | (x<<sh);
+    }
+}
+
+bool TapeKernels::Equal(const uchar* a, const uchar* b, unsigned n)
+{
+    return !memcmp(a, b, n);
+}
+
+// The lowest set bit of a^b is in the first symbol that differs
+unsigned TapeKernels::FirstDiff(const uchar* a, const uchar* b, unsigned n)
+{
+    unsigned i = 0;
+    for(; i+8 <= n; i += 8)
+    {
+	uint64_t d = load64(a+i) ^ load64(b+i);
+	if(d) return SYMPERBYTE*i + __builtin_ctzll(d)/2;
+    }
+    for(; i < n; i++)
+	if(a[i] != b[i])
+	    return SYMPERBYTE*i + __builtin_ctz(a[i]^b[i])/2;
+    return SYMPERBYTE*n;
+}
+
+// The lowest set bit of a^b is in symbol ctz/w whatever the width
+unsigned TapeKernels::FirstDiff(const uchar* a, const uchar* b, unsigned n,
+				unsigned w)
+{
+    if(w == 2) return FirstDiff(a, b, n);
+    unsigned spb = 8/w, i = 0;
+    for(; i+8 <= n; i += 8)
+    {
+	uint64_t d = load64(a+i) ^ load64(b+i);
+	if(d) return spb*i + __builtin_ctzll(d)/w;
+    }
+    for(; i < n; i++)
+	if(a[i] != b[i])
+	    return spb*i + __builtin_ctz(a[i]^b[i])/w;
+    return spb*n;
+}
+
+// Split each word into the low and high bits of its symbols: 01 is a 1,
+//   10 a blank and 00 a 0 -- then it's three popcounts
+void TapeKernels::Count(const uchar* t, unsigned n, unsigned long cnt[3])
+{
+    unsigned i = 0;
+    for(; i+8 <= n; i += 8)
+    {
+	uint64_t w  = load64(t+i);
+	uint64_t lo = w & LOBITS, hi = (w>>1) & LOBITS;
+	cnt[0] += __builtin_popcountll(~(lo|hi) & LOBITS);
+	cnt[1] += __builtin_popcountll(lo & ~hi);
+	cnt[2] += __builtin_popcountll(hi & ~lo);
+    }
+    for(; i < n; i++)
+    {
+	unsigned lo = t[i] & 0x55, hi = (t[i]>>1) & 0x55;
+	cnt[0] += __builtin_popcount(~(lo|hi) & 0x55);
+	cnt[1] += __builtin_popcount(lo & ~hi);
+	cnt[2] += __builtin_popcount(hi & ~lo);
+    }
+}
+
+// A 1-bit tape is a popcount: set bits are 1s, the rest blanks. Wider
+//   symbols are counted one at a time
+void TapeKernels::Count(const uchar* t, unsigned n, unsigned long cnt[3],
+			unsigned w)
+{
+    if(w == 2) {Count(t, n, cnt); return;}
+    if(w == 1)
+    {
+	unsigned long ones = 0;
+	unsigned i = 0;
+	for(; i+8 <= n; i += 8)
+	    ones += __builtin_popcountll(load64(t+i));
+	for(; i < n; i++)
+	    ones += __builtin_popcount(t[i]);
+	cnt[1] += ones;
+	cnt[2] += 8ul*n - ones;
+	return;
+    }
+    unsigned spb = 8/w, m = (1u<<w)-1;
+    for(unsigned i=0; i<n; i++)
+	for(unsigned j=0; j<spb; j++)
+	{
+	    unsigned x = (t[i] >> w*j) & m;
+	    if(x < 3) cnt[x]++;
+	}
+}
+
+// The first set bit of w^blanks is in the first symbol that isn't blank
+unsigned TapeKernels::FirstNonBlank(const uchar* t, unsigned n)
+{
+    unsigned i = 0;
+    for(; i+8 <= n; i += 8)
+    {
+	uint64_t d = load64(t+i) ^ BLANKW;
+	if(d) return SYMPERBYTE*i + __builtin_ctzll(d)/2;
+    }
+    for(; i < n; i++)
+	if(t[i] != BLANKS)
+	    return SYMPERBYTE*i + __builtin_ctz(t[i]^BLANKS)/2;
+    return SYMPERBYTE*n;
+}
+
+// ...for any width, given a word of its blanks
+unsigned TapeKernels::FirstNonBlank(const uchar* t, unsigned n, unsigned w)
+{
+    if(w == 2) return FirstNonBlank(t, n);
+    uchar    bb  = BlankByte(w);
+    uint64_t bw  = bb*0x0101010101010101ULL;
+    unsigned spb = 8/w, i = 0;
+    for(; i+8 <= n; i += 8)
+    {
+	uint64_t d = load64(t+i) ^ bw;
+	if(d) return spb*i + __builtin_ctzll(d)/w;
+    }
+    for(; i < n; i++)
+	if(t[i] != bb)
+	    return spb*i + __builtin_ctz(t[i]^bb)/w;
+    return spb*n;
+}
+
+// ...and the last set bit is in the last one
+unsigned TapeKernels::LastNonBlank(const uchar* t, unsigned n)
+{
+    unsigned i = n;
+    for(; i%8; i--)
+	if(t[i-1] != BLANKS)
+	    return SYMPERBYTE*(i-1) + (31-__builtin_clz(t[i-1]^BLANKS))/2;
+    for(; i; i -= 8)
+    {
+	uint64_t d = load64(t+i-8) ^ BLANKW;
+	if(d) return SYMPERBYTE*(i-8) + (63-__builtin_clzll(d))/2;
+    }
+    return SYMPERBYTE*n;
+}
+
+unsigned TapeKernels::LastNonBlank(const uchar* t, unsigned n, unsigned w)
+{
+    if(w == 2) return LastNonBlank(t, n);
+    uchar    bb  = BlankByte(w);
+    uint64_t bw  = bb*0x0101010101010101ULL;
+    unsigned spb = 8/w, i = n;
+    for(; i%8; i--)
+	if(t[i-1] != bb)
+	    return spb*(i-1) + (31-__builtin_clz(t[i-1]^bb))/w;
+    for(; i; i -= 8)
+    {
+	uint64_t d = load64(t+i-8) ^ bw;
+	if(d) return spb*(i-8) + (63-__builtin_clzll(d))/w;
+    }
+    return spb*n;
+}
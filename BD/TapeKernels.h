@@ -0,0 +1,60 @@
+#ifndef TAPEKERNELS_H
+#define TAPEKERNELS_H
+
+#include "syntactic_sugar.h"
+
+// TapeKernels work on runs of packed symbols -- four 2-bit symbols to a
+//   byte, symbol i in bits 2(i%4) and 2(i%4)+1 of byte i/4 -- a 64-bit
+//   word (32 symbols) at a time instead of a symbol at a time:
+//
+//   byte   |   0   |   1   | ...      word  | s31 ... s1 s0 |
+//   symbol |3 2 1 0|7 6 5 4| ...            |  (little endian)
+//
+// Lengths are in bytes and positions in symbols (from the start of the
+//   run) unless they say otherwise. Symbols are 0, 1 and 2 (blank)
+//
+// The kernels also take runs of symbols w = 1, 4 or 8 bits wide (8/w to
+//   a byte, the same little endian order). A 1-bit symbol is a 1 or a
+//   blank (there is no 0 to write). Wider symbols are their value, with 2
+//   still the blank, so alphabets of up to 16 or 256 symbols fit
+class TapeKernels
+{
+public:
+    // A byte of four blanks
+    enum { BLANKS = 0xAA };
+
+    // A byte of blanks/of x's for symbols w bits wide
+    static uchar BlankByte(unsigned w);
+    static uchar FillByte(uchar x, unsigned w);
+
+    // Set all 4n symbols in t to x
+    static void Fill(uchar* t, unsigned n, uchar x);
+
+    // Write the len symbols in str ('0', '1' and ' ' for blank) at
+    //   positions pos, pos+1, ... of t
+    static void Load(uchar* t, unsigned pos, const char* str, unsigned len);
+    static void Load(uchar* t, unsigned pos, const char* str, unsigned len,
+		     unsigned w);
+
+    // Compare n bytes of a and b: equal? and the first position
+    //   that differs (4n if none)
+    static bool     Equal(const uchar* a, const uchar* b, unsigned n);
+    static unsigned FirstDiff(const uchar* a, const uchar* b, unsigned n);
+    static unsigned FirstDiff(const uchar* a, const uchar* b, unsigned n,
+			      unsigned w);
+
+    // Add the number of 0s, 1s and blanks in n bytes of t to cnt
+    //   (symbols past the blank aren't counted)
+    static void Count(const uchar* t, unsigned n, unsigned long cnt[3]);
+    static void Count(const uchar* t, unsigned n, unsigned long cnt[3],
+		      unsigned w);
+
+    // Position of the first/last symbol in n bytes of t that isn't
+    //   blank (4n if all are)
+    static unsigned FirstNonBlank(const uchar* t, unsigned n);
+    static unsigned LastNonBlank(const uchar* t, unsigned n);
+    static unsigned FirstNonBlank(const uchar* t, unsigned n, unsigned w);
+    static unsigned LastNonBlank(const uchar* t, unsigned n, unsigned w);
+};
+
+#endif
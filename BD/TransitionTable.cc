@@ -0,0 +1,82 @@
+#include <assert.h>
+#include <string.h>
+#include "TransitionTable.h"
+
+// Fields of an entry
+#define SYMBITS(e) ((e) & 3)
+#define DIRBITS(e) (((e) >> 2) & 3)
+#define NXTBITS(e) ((e) >> 4)
+
+// Constructor and destructor
+TransitionTable::TransitionTable(unsigned n)
+{
+    rows = 0; e = 0;
+    Resize(n);
+}
+
+TransitionTable::~TransitionTable()
+{
+    delete [] e;
+}
+
+// Make the table n rows long with none of them states
+void TransitionTable::Resize(unsigned n)
+{
+    delete [] e;
+    rows = n;
+    e    = new uint32_t[4*n];
+    for(unsigned i=0; i<n; i++)
+    {
+	e[4*i] = e[4*i+1] = e[4*i+2] = 0;
+	e[4*i+3] = NOSTATE;
+    }
+}
+
+unsigned        TransitionTable::Rows()    const {return rows;}
+const uint32_t* TransitionTable::Entries() const {return e;}
+
+bool TransitionTable::IsState(unsigned i) const
+{
+    assert(i < rows);
+    return (e[4*i+3] == 0);
+}
+
+// Pack one entry of row i and mark the row as a state
+void TransitionTable::Set(unsigned i, uchar x, uchar sym, int dir,
+			  unsigned nxt)
+{
+    assert(i < rows && x < 3 && sym < 3 && dir >= -1 && dir <= 1);
+    assert(nxt < (1u << 28));
+    e[4*i+x] = sym | (dir+1) << 2 | nxt << 4;
+    e[4*i+3] = 0;
+}
+
+// Unpack the entries of state i
+uchar TransitionTable::Sym(unsigned i, uchar x) const
+{
+    assert(IsState(i) && x < 3);
+    return SYMBITS(e[4*i+x]);
+}
+
+int TransitionTable::Dir(unsigned i, uchar x) const
+{
+    assert(IsState(i) && x < 3);
+    return (int)DIRBITS(e[4*i+x]) - 1;
+}
+
+unsigned TransitionTable::Nxt(unsigned i, uchar x) const
+{
+    assert(IsState(i) && x < 3);
+    return NXTBITS(e[4*i+x]);
+}
+
+// Equality and inequality operators
+bool TransitionTable::operator==(const TransitionTable &o) const
+{
+    return (rows == o.rows && !memcmp(e, o.e, 4*rows*sizeof(uint32_t)));
+}
+
+bool TransitionTable::operator!=(const TransitionTable &o) const
+{
+    return !(*this == o);
+}
@@ -0,0 +1,66 @@
+#ifndef TRANSITIONTABLE_H
+#define TRANSITIONTABLE_H
+
+#include <stdint.h>
+#include "syntactic_sugar.h"
+
+// A TransitionTable holds the Turing states of a command table packed
+//   into one 32-bit entry per (command, symbol read):
+//
+//   bits  | 31 ... 4 | 3 2 | 1 0
+//   entry |   nxt    | dir | sym
+//
+//   where sym is the symbol to write, dir the move as a symbol in
+//   [0, 1, 2] (-1, 0, +1) and nxt the index of the next command. Each
+//   command has a row of four entries -- for reading 0, 1 and blank, and
+//   a fourth that is 0 for a Turing state and NOSTATE for any other
+//   command (the bootstrap, an MTState) -- so entry (i, x) is word 4i+x.
+//   A row is 16 bytes, four to a cache line, so a step is one load and
+//   a few shifts and a 100-state machine's table fits in 1.6K of L1.
+//   Conversion to and from TMStates (see BitDeviceMachine::GetTable) is
+//   lossless
+class TransitionTable
+{
+private:
+    // Private data members
+    unsigned  rows; // Commands
+    uint32_t* e;    // 4 entries to a row
+
+    // Not copyable
+    TransitionTable(const TransitionTable&);
+    TransitionTable& operator=(const TransitionTable&);
+
+public:
+    // Fourth entry of a row that isn't a Turing state
+    enum { NOSTATE = 0xFFFFFFFF };
+
+    // A table of n rows, none of them states
+    TransitionTable(unsigned n=0);
+    ~TransitionTable();
+
+    // Make the table n rows long with none of them states
+    void Resize(unsigned n);
+
+    // Number of rows and the entries (4*Rows() of them)
+    unsigned        Rows() const;
+    const uint32_t* Entries() const;
+
+    // Is row i a Turing state
+    bool IsState(unsigned i) const;
+
+    // Make row i a state that on reading x writes sym, moves dir in
+    //   [-1, 0, 1] and goes to command nxt (the other symbols' entries
+    //   are left as they were)
+    void Set(unsigned i, uchar x, uchar sym, int dir, unsigned nxt);
+
+    // Symbol written, direction moved and next command of state i on x
+    uchar    Sym(unsigned i, uchar x) const;
+    int      Dir(unsigned i, uchar x) const;
+    unsigned Nxt(unsigned i, uchar x) const;
+
+    // Equality and inequality operators
+    bool operator==(const TransitionTable &other) const;
+    bool operator!=(const TransitionTable &other) const;
+};
+
+#endif
@@ -2,12 +2,9 @@
 // Default constructor
 BitDeviceMachine::WorkingTape::WorkingTape(){assert("Should never be called");}
 
-// Set all of a tapes symbols to 0
+// Set all of a tapes symbols to blank
 void BitDeviceMachine::WorkingTape::clear()
-{
-    for(int i=0; i<tapeLen(); i++)
-	assign(2, i);
-}
+{fill(2);}
 
 // Bits are fundamental unit
 // 1   symbol == 2 bits
@@ -24,17 +21,20 @@ void BitDeviceMachine::WorkingTape::initTape(const char* str,
     // Set tape to all blanks
     clear();
 
-    // Position the head at given position and copy each symbol in the string
-    // onto successive postions on the tape,  moving the head to the right
-    // 2-bits at a time
-    setHead(strPos);
-    for(int i=0; i<strlen(str); i++)
+    // Copy the string onto the tape leftwards from strPos. The first
+    //   symbol has always been overwritten by the second, so str[i]
+    //   lands at strPos-i+1 (a lone symbol at strPos)
+    unsigned len = strlen(str);
+    if(len == 1)
+	load(strPos, str, 1);
+    else if(len > 1)
     {
-	assert(str[i] == '0' || str[i] == '1' || str[i] == ' ');
-	uchar x = (str[i] == '0' ? 0 : (str[i] == '1' ? 1 : 2));
-	Write(x);
-	assert(Read() == x);
-	setHead(strPos-i);
+	char* rev = new char[len-1];
+	for(unsigned i=1; i<len; i++)
+	    rev[len-1-i] = str[i];
+	assert(strPos+2 >= len);
+	load(strPos+2-len, rev, len-1);
+	delete [] rev;
     }
 
     // Position the head at given np
@@ -44,24 +44,43 @@ void BitDeviceMachine::WorkingTape::initTape(const char* str,
 // Length of the whole structure including: z, p and tape in bytes
 unsigned BitDeviceMachine::WorkingTape::Len() const
 {
+    unsigned wz  = z & ~FLAGS;
     unsigned sz1 = sizeof(BitDeviceMachine::WorkingTape) +
-	           ((BYTESPERWORD*z)-sizeof(BitDeviceMachine::WorkingTape));
-    unsigned sz2 = MT_HEADERSZ + 4 + (BYTESPERWORD*z-12);
-    unsigned sz3 = z*BYTESPERWORD;
+	           ((BYTESPERWORD*wz)-sizeof(BitDeviceMachine::WorkingTape));
+    unsigned sz2 = MT_HEADERSZ + 4 + (BYTESPERWORD*wz-12);
+    unsigned sz3 = wz*BYTESPERWORD;
     assert(sz1 == sz2 && sz3 == sz1);
     return sz1;
 }
 
 // Length of the (usable) tape in symbols
 // TODO: Lets elimintate use of setTapeLen and set in terms of bits/bytes
-void BitDeviceMachine::WorkingTape::setTapeLen(unsigned nl)
+void BitDeviceMachine::WorkingTape::setTapeLen(unsigned nl, unsigned w)
 {
-    unsigned nz = ((nl/SYMPERBYTE)/BYTESPERWORD) +2;
-    z = nz;
+    static const unsigned code[9] = {0, 1, 0, 0, 2, 0, 0, 0, 3};
+    assert(w == 1 || w == 2 || w == 4 || w == 8);
+    unsigned nz = (bytesFor(nl, w)/BYTESPERWORD) +2;
+    z = nz | (code[w] << WIDTHSHIFT);
 }
 unsigned BitDeviceMachine::WorkingTape::tapeLen() const 
 {
-    return (BYTESPERWORD*(z-2))*SYMPERBYTE;
+    return tapeBytes()*(bPB/width());
+}
+unsigned BitDeviceMachine::WorkingTape::tapeBytes() const
+{
+    return BYTESPERWORD*((z & ~FLAGS)-2);
+}
+unsigned BitDeviceMachine::WorkingTape::width() const
+{
+    static const unsigned w[4] = {2, 1, 4, 8};
+    return w[(z & WIDTH) >> WIDTHSHIFT];
+}
+
+// Whole words of symbols
+unsigned BitDeviceMachine::WorkingTape::bytesFor(unsigned nl, unsigned w)
+{
+    unsigned bits = nl*w, wb = bPB*BYTESPERWORD;
+    return ((bits+wb-1)/wb)*BYTESPERWORD;
 }
 
 // Set head -- given in symbols, stored in bit offset
@@ -88,17 +107,13 @@ void BitDeviceMachine::WorkingTape::printTapeLine(unsigned opCnt)
     // reading each symbol and printing it out as you go...
     // Write a line with the values on the tape, each seperated by '.'
     // Finally, replace the head to the original positon
-    int oldHead = getHead();
-    setHead(tapeLen()-1);
-    for(int i=tapeLen()-1; i>=0; i--, Move(-1))
+    for(int i=tapeLen()-1; i>=0; i--)
     {
-	unsigned x = Read();
-	assert(x == 0 || x == 1 | x == 2);
-	char c = (x == 0 ? '0' : (x == 1 ? '1' : ' '));
+	unsigned x = value(i);
+	char c = (x == 2 ? ' ' : (x < 10 ? '0'+x : '?'));
 	std::cout<<c<< '|';
     }
     std::cout<<"    :" << opCnt << std::endl;
-    setHead(oldHead);
 }
 
 void BitDeviceMachine::WorkingTape::printHeadLine()
@@ -124,18 +139,30 @@ void BitDeviceMachine::WorkingTape::printStateLine(unsigned state)
     std::cout<<std::endl;
 }
 
-// Assign the symbol in s to the symbol location np
+// Assign the symbol in s to the symbol location np -- a 1-bit tape
+//   holds a 1 as a set bit and a blank as a clear one (it has no 0)
 void BitDeviceMachine::WorkingTape::assign(uchar sbyte, unsigned nh)
 {
     STATIC_MASKS;
     
     assert(nh < tapeLen());
+    unsigned w = width();
+    if(w != 2)
+    {
+	unsigned bit = nh*w, m = (1u<<w)-1;
+	if(w == 1) {assert(sbyte != 0); sbyte = (sbyte == 1);}
+	assert(sbyte <= m);
+	uchar* t = writeA(bit/bPB);
+	*t = (*t & ~(m << bit%bPB)) | (sbyte << bit%bPB);
+	return;
+    }
 
     // Identify the target byte
     // We expect both bits to be in same byte
     unsigned tbyteA   = nh/SYMPERBYTE;
     unsigned toffsetA = nh%SYMPERBYTE*2;
-    uchar tbyte = *(T+tbyteA);
+    uchar* t     = writeA(tbyteA);
+    uchar  tbyte = *t;
 
     // Mask out the target bits and replace them with source bits
     switch(toffsetA)
@@ -161,7 +188,7 @@ void BitDeviceMachine::WorkingTape::assign(uchar sbyte, unsigned nh)
     tbyte = tbyte | sbyte;
 
     // Replace original target byte with newly edited tbyte
-    *((uchar*)(T)+tbyteA) = tbyte;
+    *t = tbyte;
 }
 
 // Return the symbol at nh -- in symbols
@@ -170,12 +197,19 @@ uchar BitDeviceMachine::WorkingTape::value(unsigned nh)
     STATIC_MASKS;
     
     assert(nh < tapeLen());
+    unsigned w = width();
+    if(w != 2)
+    {
+	unsigned bit = nh*w;
+	uchar    x   = (*readA(bit/bPB) >> bit%bPB) & ((1u<<w)-1);
+	return (w == 1 ? (x ? 1 : 2) : x);
+    }
 
     // Identify the target byte
     // We expect both bits to be in same byte
     unsigned tbyteA   = nh/SYMPERBYTE;
     unsigned toffsetA = nh%SYMPERBYTE*2;
-    uchar tbyte = *(((uchar*)T)+tbyteA);
+    uchar tbyte = *readA(tbyteA);
 
     // Mask out the target bits and shift them to pos 0 and 1 in the byte
     switch(toffsetA)
@@ -202,12 +236,145 @@ uchar BitDeviceMachine::WorkingTape::value(unsigned nh)
     return tbyte;
 }
 
+// Address of byte i of the symbols -- in T or in the Segment T points to
+const uchar* BitDeviceMachine::WorkingTape::readA(unsigned i) const
+{
+    if(!(z & PAGED)) return T+i;
+    const Segment* s = *(Segment* const*)T;
+    return s->ReadA(s->Start()+i);
+}
+uchar* BitDeviceMachine::WorkingTape::writeA(unsigned i)
+{
+    if(!(z & PAGED)) return T+i;
+    Segment* s = *(Segment**)T;
+    return s->WriteA(s->Start()+i);
+}
+
+// Bytes from byte i of the symbols to the end of i's page (or the tape)
+unsigned BitDeviceMachine::WorkingTape::span(unsigned i) const
+{
+    unsigned n = tapeBytes();
+    assert(i < n);
+    if(!(z & PAGED)) return n-i;
+    unsigned pl = (*(Segment* const*)T)->PageLen();
+    unsigned k  = pl - i%pl;
+    return (k < n-i ? k : n-i);
+}
+
+// Bytes from the start of byte i's page (or the tape) up to and with i
+unsigned BitDeviceMachine::WorkingTape::spanBack(unsigned i) const
+{
+    assert(i < tapeBytes());
+    if(!(z & PAGED)) return i+1;
+    unsigned pl = (*(Segment* const*)T)->PageLen();
+    return i%pl+1;
+}
+
+// Set every symbol to x -- blanks on a paged tape just drop its pages
+//   (they read as blanks), so it costs the pages written
+void BitDeviceMachine::WorkingTape::fill(uchar x)
+{
+    if((z & PAGED) && x == 2)
+    {
+	(*(Segment**)T)->Clear();
+	return;
+    }
+    unsigned n = tapeBytes();
+    uchar    f = TapeKernels::FillByte(x, width());
+    for(unsigned i=0, k; i<n; i+=k)
+    {
+	k = span(i);
+	memset(writeA(i), f, k);
+    }
+}
+
+// Write the len symbols in str at pos, pos+1, ...
+void BitDeviceMachine::WorkingTape::load(unsigned pos, const char* str,
+					 unsigned len)
+{
+    assert(pos+len <= tapeLen());
+    unsigned w   = width(), spb = bPB/w;
+    unsigned end = pos+len;
+    while(pos < end)
+    {
+	unsigned i = pos/spb;
+	unsigned e = (i+span(i))*spb;
+	if(e > end) e = end;
+	TapeKernels::Load(writeA(i), pos-i*spb, str, e-pos, w);
+	str += e-pos;
+	pos  = e;
+    }
+}
+
+// Copy in tapeBytes() bytes of packed symbols
+void BitDeviceMachine::WorkingTape::loadPacked(const uchar* buf)
+{
+    unsigned n = tapeBytes();
+    for(unsigned i=0, k; i<n; i+=k)
+    {
+	k = span(i);
+	memcpy(writeA(i), buf+i, k);
+    }
+}
+
+// Add up the 0s, 1s and blanks
+void BitDeviceMachine::WorkingTape::count(unsigned long cnt[3]) const
+{
+    cnt[0] = cnt[1] = cnt[2] = 0;
+    unsigned n = tapeBytes();
+    for(unsigned i=0, k; i<n; i+=k)
+    {
+	k = span(i);
+	TapeKernels::Count(readA(i), k, cnt, width());
+    }
+}
+
+// First/last symbol that isn't blank (tapeLen() if none)
+unsigned BitDeviceMachine::WorkingTape::firstNonBlank() const
+{
+    unsigned n = tapeBytes(), w = width(), spb = bPB/w;
+    for(unsigned i=0, k; i<n; i+=k)
+    {
+	k = span(i);
+	unsigned p = TapeKernels::FirstNonBlank(readA(i), k, w);
+	if(p < k*spb) return i*spb+p;
+    }
+    return tapeLen();
+}
+unsigned BitDeviceMachine::WorkingTape::lastNonBlank() const
+{
+    unsigned w = width(), spb = bPB/w;
+    for(unsigned e=tapeBytes(), k; e>0; e-=k)
+    {
+	k = spanBack(e-1);
+	unsigned p = TapeKernels::LastNonBlank(readA(e-k), k, w);
+	if(p < k*spb) return (e-k)*spb+p;
+    }
+    return tapeLen();
+}
+
+// First symbol that differs from other's (tapeLen() if none) -- the
+//   tapes must be the same length and width
+unsigned BitDeviceMachine::WorkingTape::firstDiff(const WorkingTape &o) const
+{
+    assert(tapeLen() == o.tapeLen() && width() == o.width());
+    unsigned n = tapeBytes(), w = width(), spb = bPB/w;
+    for(unsigned i=0, k; i<n; i+=k)
+    {
+	k = span(i);
+	if(o.span(i) < k) k = o.span(i);
+	unsigned p = TapeKernels::FirstDiff(readA(i), o.readA(i), k, w);
+	if(p < k*spb) return i*spb+p;
+    }
+    return tapeLen();
+}
+
 // Covert a symbol position in a tape into a bit offset and back again
 //   Count from the start of the tape
-unsigned BitDeviceMachine::WorkingTape::IND2OFF(unsigned ns)
-{return (MT_HEADERSZ+2*(ns));}
-unsigned BitDeviceMachine::WorkingTape::OFF2IND(unsigned o)
-{return ((o)-MT_HEADERSZ)/2;}
+unsigned BitDeviceMachine::WorkingTape::IND2OFF(unsigned ns) const
+{return (MT_HEADERSZ*bPB+width()*(ns));}
+unsigned BitDeviceMachine::WorkingTape::OFF2IND(unsigned o) const
+{return ((o)-MT_HEADERSZ*bPB)/width();}
 
 // Move the head left or right (or leave it)
 //   clamp between 0 and tapeLen-1 without fault
@@ -218,7 +385,7 @@ void BitDeviceMachine::WorkingTape::Move(int d)
     assert(d == -1 || d == 0 | d == 1);
 
     unsigned nh;
-    if(h == 0)
+    if(getHead() == 0 && d < 0)
 	nh = 0;
     else 
 	nh = getHead()+d;
@@ -268,18 +435,14 @@ void BitDeviceMachine::WorkingTape::DBGPRINT()
     // reading each symbol and printing it out as you go...
     // Write a line with the values on the tape, each seperated by '.'
     // Finally, replace the head to the original positon
-    int oldHead = getHead();
-    setHead(tapeLen()-1);
     int j=0;
-    for(int i=tapeLen()-1; i>=0; i--, Move(-1))
+    for(int i=tapeLen()-1; i>=0 && j+2<sizeof(buffer); i--)
     {
-	unsigned x = Read();
-	assert(x == 0 || x == 1 | x == 2);
-	char c = (x == 0 ? '0' : (x == 1 ? '1' : ' '));
+	unsigned x = value(i);
+	char c = (x == 2 ? ' ' : (x < 10 ? '0'+x : '?'));
 	buffer[j++] = c;
 	buffer[j++] = '|';
     }
-    setHead(oldHead);
     buffer[j] = '\0';
     fprintf(DBGFILE, "%s\n", buffer);
 }
@@ -289,10 +452,8 @@ void BitDeviceMachine::WorkingTape::DBGPRINT()
 bool BitDeviceMachine::WorkingTape::operator==(const BitDeviceMachine::WorkingTape &other) const
 {
     if (h != other.h) return false;
-    if (z != other.z)  return false;
-    for(int i=0; i<tapeLen()/bPB; i+=bPB)
-	if(T[i] != other.T[i]) return false;
-    return true;
+    if ((z & ~PAGED) != (other.z & ~PAGED)) return false; // Length and width
+    return (firstDiff(other) == tapeLen());
 }
 
 bool BitDeviceMachine::WorkingTape::operator!=(const BitDeviceMachine::WorkingTape &other) const
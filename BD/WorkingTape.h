@@ -9,6 +9,13 @@
 // wds in tape  to current symbol
 //   (buflen)       (head)
 //
+// A paged WorkingTape (PAGED set in z) keeps its symbols in a Segment of
+//   their own: the header is overlaid on a segment of its own and the
+//   first bytes of T hold a pointer to the symbols' Segment instead
+//
+// Symbols are 2 bits wide unless the WIDTH bits of z say otherwise
+//   (1, 4 or 8 bits -- see TapeKernels). h is still a bit offset, so
+//   a head moves width() bits at a time
 class WorkingTape
 {
 private:
@@ -20,19 +27,32 @@ private:
     unsigned h; // Position of head in bits
     uchar T[4]; // Variable length array containing 4(z-2)uchars
 
+    // Flag in z for a tape whose symbols are in a Segment, the field in
+    //   z for the symbol width (0 is 2 bits so older tapes read right)
+    //   and a byte of four blanks (10101010)
+    enum { PAGED = 0x80000000, WIDTH = 0x30000000, WIDTHSHIFT = 28,
+	   FLAGS = PAGED | WIDTH, BLANKS = 0xAA };
+
     // Default constructor (never called because of "casting creation")
     WorkingTape();
 
-    // Set all of a tapes symbols to 0
+    // Set all of a tapes symbols to blank
     void clear();
 	
     // Initialize the tape to a given string
     void initTape(const char* str, unsigned strPos, unsigned p);
 
-    // Set the length of the tape in symbols
-    // Get the length of the tape in symbols
-    void     setTapeLen(unsigned ln);
+    // Set the length of the tape in symbols of w bits (rounded up to a
+    //   whole number of words)
+    // Get the length of the tape in symbols/in bytes and the width of
+    //   a symbol in bits
+    void     setTapeLen(unsigned ln, unsigned w=2);
     unsigned tapeLen() const;
+    unsigned tapeBytes() const;
+    unsigned width() const;
+
+    // Bytes a tape of ln symbols w bits wide takes up
+    static unsigned bytesFor(unsigned ln, unsigned w);
     
     // Set the head to position p (in symbols)
     // Get the head (in symbols)
@@ -49,10 +69,30 @@ private:
 
     // Return the symbol at p
     uchar value(unsigned p);
+
+    // Address of byte i of the symbols for reading or writing, and the
+    //   number of bytes from i that are contiguous there (on to the end,
+    //   or back to and with i)
+    const uchar* readA(unsigned i) const;
+    uchar*       writeA(unsigned i);
+    unsigned     span(unsigned i) const;
+    unsigned     spanBack(unsigned i) const;
+
+    // Bulk operations (see TapeKernels) a contiguous run at a time
+    //   set every symbol to x, write str at pos, copy in packed symbols,
+    //   count each symbol, find the first and last symbol that isn't
+    //   blank (tapeLen() if none) and the first that differs from other's
+    void     fill(uchar x);
+    void     load(unsigned pos, const char* str, unsigned len);
+    void     loadPacked(const uchar* buf);
+    void     count(unsigned long cnt[3]) const;
+    unsigned firstNonBlank() const;
+    unsigned lastNonBlank() const;
+    unsigned firstDiff(const WorkingTape &other) const;
 	
     // Some syntactic sugar to convert from head index (symbols) to offset(bits)
-    static unsigned IND2OFF(unsigned s);
-    static unsigned OFF2IND(unsigned o);
+    unsigned IND2OFF(unsigned s) const;
+    unsigned OFF2IND(unsigned o) const;
     
     // Length of the whole structure including: l, p and tape in bytes    
     unsigned Len() const;
@@ -8,6 +8,9 @@ extern FILE* DBGFILE;
 extern void DBGPRINTS(const char* s);
 extern void DBGFLUSH();
 
+// Trace to the debug file only if one has been opened
+#define DBGPRINTF(...) do {if(DBGFILE) fprintf(DBGFILE, __VA_ARGS__);} while(0)
+
 
 /*
 FILE* DBGFILE;
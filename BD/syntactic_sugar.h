@@ -13,12 +13,14 @@
     else\
 	firstTime = false;
     
+// Seed rand() from the clock the first time through, and only then
 #define RANDINIT \
     static bool firstTime = true;\
     if(firstTime)\
+    {\
 	srand (time(NULL));\
-    else\
-	firstTime = false;
+	firstTime = false;\
+    }
 
 
 // Experiment with uchar for unsigned char
@@ -44,7 +46,18 @@
 //=============================================================
 // Cheats to help with address arithmetic
 //TODO: Put these where they belong
-#define MAXREGS 50
+#define MAXREGS 64
+
+// Return stack for CALL/RETN: reg[RSPREG] return offsets are held in
+//   reg[RSTACKREG] on up (RSTACKLEN deep). A CALL with the stack full or
+//   a RETN with it empty halts the program with reg[RSPREG] RSTACKERR
+#define RSPREG    50
+#define RSTACKREG 51
+#define RSTACKLEN (MAXREGS-RSTACKREG)
+#define RSTACKERR (-1)
+
+// Most working tapes a machine can have
+#define MAXTAPES 4
 
 // Bits per bytes
 #define bPB 8
@@ -61,9 +74,12 @@
 // Offset to the halt state
 #define HALTSTATEOFF 2*MT_HEADERSZ*bPB
 
+// Offset to the halt command (command 0)
+#define HALTCMDOFF   (MT_HEADERSZ*bPB)
+
 // Offset to the first command (skip header and halt state)(224)
 //   using 160 instead of sizeof(Command)
-#define FIRSTCMDOFF  MT_HEADERSZ+160
+#define FIRSTCMDOFF  (MT_HEADERSZ*bPB+160)
 
 
 